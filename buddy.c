@@ -0,0 +1,430 @@
+/**********************************************************************
+ * Copyright (c) 2019-2024
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "buddy.h"
+
+/**
+ * Insert the block at @pfn into the free list of @order, keeping the list
+ * sorted by pfn so that the lowest frames are always picked first.
+ */
+static void __add_free_block(struct buddy *b, unsigned int pfn, unsigned int order)
+{
+	struct buddy_page *page = b->pages + pfn;
+	struct list_head *pos;
+
+	list_for_each(pos, &b->free_lists[order]) {
+		if (list_entry(pos, struct buddy_page, list) > page) break;
+	}
+	list_add_tail(&page->list, pos);
+
+	page->free = true;
+	page->order = order;
+	b->nr_free_blocks[order]++;
+	b->nr_free += 1 << order;
+}
+
+static void __del_free_block(struct buddy *b, unsigned int pfn)
+{
+	struct buddy_page *page = b->pages + pfn;
+
+	assert(page->free);
+
+	list_del_init(&page->list);
+	page->free = false;
+	b->nr_free_blocks[page->order]--;
+	b->nr_free -= 1 << page->order;
+}
+
+static unsigned int __first_pfn(struct buddy *b, unsigned int order)
+{
+	struct buddy_page *page;
+
+	if (list_empty(&b->free_lists[order])) return -1;
+
+	page = list_first_entry(&b->free_lists[order], struct buddy_page, list);
+	return page - b->pages;
+}
+
+/**
+ * buddy_init(@b, @nr_frames)
+ *
+ * DESCRIPTION
+ *   Initialize the buddy allocator to manage @nr_frames page frames, all of
+ *   which are free initially.
+ *
+ * RETURN
+ *   @true on success, @false if out of memory
+ */
+bool buddy_init(struct buddy *b, unsigned int nr_frames)
+{
+	unsigned int pfn = 0;
+
+	b->nr_frames = nr_frames;
+	b->nr_free = 0;
+	b->pages = calloc(nr_frames, sizeof(*b->pages));
+	if (!b->pages) return false;
+
+	for (int i = 0; i < NR_ORDERS; i++) {
+		INIT_LIST_HEAD(&b->free_lists[i]);
+		b->nr_free_blocks[i] = 0;
+	}
+	for (unsigned int i = 0; i < nr_frames; i++) {
+		INIT_LIST_HEAD(&b->pages[i].list);
+	}
+
+	/* Carve the frames into the largest naturally aligned blocks */
+	while (pfn < nr_frames) {
+		int order = NR_ORDERS - 1;
+
+		while (order && ((pfn & ((1 << order) - 1)) ||
+				pfn + (1 << order) > nr_frames)) {
+			order--;
+		}
+		__add_free_block(b, pfn, order);
+		pfn += 1 << order;
+	}
+	b->nr_free_min = b->nr_free;
+	return true;
+}
+
+void buddy_exit(struct buddy *b)
+{
+	free(b->pages);
+	b->pages = NULL;
+}
+
+/**
+ * buddy_restore(@b, @pages, @nr_free_min)
+ *
+ * DESCRIPTION
+ *   Restore the frames of @b, initialized with the same number of frames,
+ *   from @pages saved by a checkpoint. The free lists are rebuilt from the
+ *   heads of the free blocks in @pages; their list heads are not looked into.
+ */
+void buddy_restore(struct buddy *b, const struct buddy_page *pages, unsigned int nr_free_min)
+{
+	b->nr_free = 0;
+	b->nr_free_min = nr_free_min;
+
+	for (int i = 0; i < NR_ORDERS; i++) {
+		INIT_LIST_HEAD(&b->free_lists[i]);
+		b->nr_free_blocks[i] = 0;
+	}
+
+	/* Append in the order of pfn to keep the free lists sorted */
+	for (unsigned int i = 0; i < b->nr_frames; i++) {
+		struct buddy_page *page = b->pages + i;
+
+		page->free = pages[i].free;
+		page->head = pages[i].head;
+		page->order = pages[i].order;
+		INIT_LIST_HEAD(&page->list);
+
+		if (page->free) {
+			list_add_tail(&page->list, &b->free_lists[page->order]);
+			b->nr_free_blocks[page->order]++;
+			b->nr_free += 1 << page->order;
+		}
+	}
+}
+
+/**
+ * buddy_alloc(@b, @order)
+ *
+ * DESCRIPTION
+ *   Allocate 2^@order contiguous page frames aligned to their size.
+ *   Order-0 requests always get the free frame with the smallest pfn. Larger
+ *   requests take the lowest block from the smallest order that can satisfy
+ *   them, to leave large blocks intact as long as possible. The block is
+ *   split, and the upper halves are returned to the free lists.
+ *
+ * RETURN
+ *   The first pfn of the allocated block, or -1 if no block is available.
+ */
+unsigned int buddy_alloc(struct buddy *b, unsigned int order)
+{
+	unsigned int pfn = -1;
+	unsigned int from = NR_ORDERS;
+
+	if (order >= NR_ORDERS) return -1;
+
+	for (unsigned int i = order; i < NR_ORDERS; i++) {
+		unsigned int first = __first_pfn(b, i);
+
+		if (first == -1) continue;
+		if (pfn == -1 || first < pfn) {
+			pfn = first;
+			from = i;
+		}
+		if (order) break;
+	}
+	if (pfn == -1) return -1;
+
+	__del_free_block(b, pfn);
+
+	while (from > order) {
+		from--;
+		__add_free_block(b, pfn + (1 << from), from);
+	}
+	b->pages[pfn].order = order;
+	b->pages[pfn].head = true;
+
+	if (b->nr_free < b->nr_free_min) b->nr_free_min = b->nr_free;
+
+	return pfn;
+}
+
+/**
+ * buddy_alloc_range(@b, @start, @end)
+ *
+ * DESCRIPTION
+ *   Allocate the free frame with the smallest pfn in [@start, @end) as an
+ *   order-0 block. The free block containing it is split.
+ *
+ * RETURN
+ *   The pfn of the frame, or -1 if no frame in the range is free.
+ */
+unsigned int buddy_alloc_range(struct buddy *b, unsigned int start, unsigned int end)
+{
+	unsigned int pfn = -1;
+
+	for (unsigned int order = 0; order < NR_ORDERS; order++) {
+		struct buddy_page *page;
+
+		/* The lowest block reaching into the range, as the lists are sorted */
+		list_for_each_entry(page, &b->free_lists[order], list) {
+			unsigned int head = page - b->pages;
+
+			if (head >= end || head >= pfn) break;
+			if (head + (1 << order) <= start) continue;
+
+			pfn = head > start ? head : start;
+			break;
+		}
+	}
+	if (pfn == -1) return -1;
+
+	buddy_take(b, pfn);
+	return pfn;
+}
+
+/**
+ * buddy_take(@b, @pfn)
+ *
+ * DESCRIPTION
+ *   Allocate the specific free frame @pfn as an order-0 block. The free block
+ *   containing it is split, and the other parts are returned to the free lists.
+ *
+ * RETURN
+ *   @true if @pfn was free and is allocated now
+ */
+bool buddy_take(struct buddy *b, unsigned int pfn)
+{
+	unsigned int head = -1;
+	unsigned int order;
+
+	for (order = 0; order < NR_ORDERS; order++) {
+		unsigned int h = pfn & ~((1 << order) - 1);
+
+		if (b->pages[h].free && b->pages[h].order == order) {
+			head = h;
+			break;
+		}
+	}
+	if (head == -1) return false;
+
+	__del_free_block(b, head);
+
+	while (order) {
+		order--;
+		if (pfn & (1 << order)) {
+			__add_free_block(b, head, order);
+			head += 1 << order;
+		} else {
+			__add_free_block(b, head + (1 << order), order);
+		}
+	}
+	b->pages[pfn].order = 0;
+	b->pages[pfn].head = true;
+
+	if (b->nr_free < b->nr_free_min) b->nr_free_min = b->nr_free;
+
+	return true;
+}
+
+/**
+ * buddy_free(@b, @pfn)
+ *
+ * DESCRIPTION
+ *   Free the block allocated at @pfn, and coalesce it with its buddies as long
+ *   as they are free as a whole.
+ */
+void buddy_free(struct buddy *b, unsigned int pfn)
+{
+	unsigned int order = b->pages[pfn].order;
+
+	assert(pfn < b->nr_frames);
+	assert(b->pages[pfn].head);
+
+	b->pages[pfn].head = false;
+
+	while (order < NR_ORDERS - 1) {
+		unsigned int buddy = pfn ^ (1 << order);
+		struct buddy_page *page = b->pages + buddy;
+
+		if (buddy >= b->nr_frames) break;
+		if (!page->free || page->order != order) break;
+
+		__del_free_block(b, buddy);
+		if (buddy < pfn) pfn = buddy;
+		order++;
+	}
+	__add_free_block(b, pfn, order);
+}
+
+/**
+ * buddy_split(@b, @pfn)
+ *
+ * DESCRIPTION
+ *   Turn the allocated block at @pfn into independent order-0 frames, so that
+ *   each of them can be freed separately.
+ */
+void buddy_split(struct buddy *b, unsigned int pfn)
+{
+	unsigned int nr = 1 << b->pages[pfn].order;
+
+	for (unsigned int i = 0; i < nr; i++) {
+		b->pages[pfn + i].order = 0;
+		b->pages[pfn + i].head = true;
+	}
+}
+
+/**
+ * buddy_is_free(@b, @pfn)
+ *
+ * RETURN
+ *   @true if the frame @pfn is in a free block
+ */
+bool buddy_is_free(struct buddy *b, unsigned int pfn)
+{
+	for (unsigned int order = 0; order < NR_ORDERS; order++) {
+		unsigned int head = pfn & ~((1 << order) - 1);
+		struct buddy_page *page = b->pages + head;
+
+		if (page->free && page->order >= order &&
+				pfn < head + (1 << page->order)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * buddy_is_head(@b, @pfn)
+ *
+ * RETURN
+ *   @true if an allocated block starts from @pfn
+ */
+bool buddy_is_head(struct buddy *b, unsigned int pfn)
+{
+	return b->pages[pfn].head;
+}
+
+/**
+ * buddy_nr_free_range(@b, @start, @end)
+ *
+ * RETURN
+ *   The number of free frames in [@start, @end)
+ */
+unsigned int buddy_nr_free_range(struct buddy *b, unsigned int start, unsigned int end)
+{
+	unsigned int nr_free = 0;
+
+	for (unsigned int order = 0; order < NR_ORDERS; order++) {
+		struct buddy_page *page;
+
+		list_for_each_entry(page, &b->free_lists[order], list) {
+			unsigned int head = page - b->pages;
+			unsigned int first = head > start ? head : start;
+			unsigned int last = head + (1 << order) < end ? head + (1 << order) : end;
+
+			if (head >= end) break;
+			if (first < last) nr_free += last - first;
+		}
+	}
+	return nr_free;
+}
+
+/**
+ * buddy_largest_order(@b)
+ *
+ * RETURN
+ *   The order of the largest free block, or -1 if no frame is free
+ */
+unsigned int buddy_largest_order(struct buddy *b)
+{
+	for (int order = NR_ORDERS - 1; order >= 0; order--) {
+		if (b->nr_free_blocks[order]) return order;
+	}
+	return -1;
+}
+
+/**
+ * buddy_unusable_index(@b, @order)
+ *
+ * RETURN
+ *   The unusable free space index for an allocation of @order in 1/1000, or
+ *   0 if no frame is free
+ */
+unsigned int buddy_unusable_index(struct buddy *b, unsigned int order)
+{
+	unsigned int usable = 0;
+
+	if (!b->nr_free) return 0;
+
+	for (unsigned int i = order; i < NR_ORDERS; i++) {
+		usable += b->nr_free_blocks[i] << i;
+	}
+	return (b->nr_free - usable) * 1000 / b->nr_free;
+}
+
+/**
+ * buddy_show(@b, @out)
+ *
+ * DESCRIPTION
+ *   Report the free blocks of each order and the fragmentation. The unusable
+ *   free space index of an order is the fraction of the free frames that
+ *   cannot be used for an allocation of that order because they are in
+ *   smaller blocks. It is 0 when all free memory is usable for the order, and
+ *   approaches 1 as the free memory gets scattered.
+ */
+void buddy_show(struct buddy *b, FILE *out)
+{
+	unsigned int usable = b->nr_free;
+
+	fprintf(out, "free: %u / %u frames, largest order %d\n",
+			b->nr_free, b->nr_frames, (int)buddy_largest_order(b));
+	fprintf(out, "order | blocks | unusable\n");
+
+	for (unsigned int order = 0; order < NR_ORDERS; order++) {
+		fprintf(out, "%5u | %6u | %.3f\n", order, b->nr_free_blocks[order],
+				b->nr_free ? (double)(b->nr_free - usable) / b->nr_free : 0.0);
+		usable -= b->nr_free_blocks[order] << order;
+	}
+}
@@ -0,0 +1,64 @@
+/**********************************************************************
+ * Copyright (c) 2019-2024
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+#ifndef __BUDDY_H__
+#define __BUDDY_H__
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "list_head.h"
+
+/* Blocks of up to 2^(NR_ORDERS - 1) page frames are managed */
+#define NR_ORDERS	8
+
+/**
+ * Per page frame metadata of the buddy allocator
+ */
+struct buddy_page {
+	bool free;				/* Head of a free block */
+	bool head;				/* Head of an allocated block */
+	unsigned int order;		/* Order of the block starting from this frame */
+	struct list_head list;	/* Chained to the free list when @free */
+};
+
+struct buddy {
+	unsigned int nr_frames;
+	unsigned int nr_free;
+	unsigned int nr_free_min;	/* Lowest @nr_free so far, for the peak usage */
+	struct buddy_page *pages;
+
+	/* Free blocks of each order, sorted by pfn */
+	struct list_head free_lists[NR_ORDERS];
+	unsigned int nr_free_blocks[NR_ORDERS];
+};
+
+bool buddy_init(struct buddy *b, unsigned int nr_frames);
+void buddy_exit(struct buddy *b);
+void buddy_restore(struct buddy *b, const struct buddy_page *pages, unsigned int nr_free_min);
+
+unsigned int buddy_alloc(struct buddy *b, unsigned int order);
+unsigned int buddy_alloc_range(struct buddy *b, unsigned int start, unsigned int end);
+bool buddy_take(struct buddy *b, unsigned int pfn);
+void buddy_free(struct buddy *b, unsigned int pfn);
+void buddy_split(struct buddy *b, unsigned int pfn);
+
+bool buddy_is_free(struct buddy *b, unsigned int pfn);
+bool buddy_is_head(struct buddy *b, unsigned int pfn);
+unsigned int buddy_nr_free_range(struct buddy *b, unsigned int start, unsigned int end);
+unsigned int buddy_largest_order(struct buddy *b);
+unsigned int buddy_unusable_index(struct buddy *b, unsigned int order);
+void buddy_show(struct buddy *b, FILE *out);
+
+#endif
@@ -0,0 +1,273 @@
+/**********************************************************************
+ * Copyright (c) 2019-2024
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "cache.h"
+
+static const char * const level_names[MAX_CACHE_LEVELS] = {
+	"l1", "l2", "llc",
+};
+
+static const char * const policy_names[] = {
+	[CACHE_POLICY_LRU] = "lru",
+	[CACHE_POLICY_FIFO] = "fifo",
+	[CACHE_POLICY_RANDOM] = "random",
+};
+
+static const unsigned int default_cycles[MAX_CACHE_LEVELS] = {
+	CACHE_L1_CYCLES, CACHE_L2_CYCLES, CACHE_LLC_CYCLES,
+};
+
+static unsigned int __parse_size(const char *str)
+{
+	char *end;
+	unsigned int size = strtoimax(str, &end, 0);
+
+	if (*end == 'k') size <<= 10;
+	if (*end == 'm') size <<= 20;
+
+	return size;
+}
+
+static bool __parse_level(char *str, struct cache_config *config)
+{
+	char *fields[5] = { NULL };
+	int nr_fields = 0;
+
+	while (str && nr_fields < 5) {
+		fields[nr_fields++] = strsep(&str, ":");
+	}
+	if (nr_fields < 2 || str) return false;
+
+	config->size = __parse_size(fields[0]);
+	config->ways = strtoimax(fields[1], NULL, 0);
+	if (fields[2]) config->line_size = strtoimax(fields[2], NULL, 0);
+	if (fields[3]) {
+		unsigned int i;
+
+		for (i = 0; i < sizeof(policy_names) / sizeof(*policy_names); i++) {
+			if (strcmp(fields[3], policy_names[i]) == 0) break;
+		}
+		if (i == sizeof(policy_names) / sizeof(*policy_names)) return false;
+		config->policy = i;
+	}
+	if (fields[4]) config->cycles = strtoimax(fields[4], NULL, 0);
+
+	/* Lines are a power of two, and the sets should be filled by the ways */
+	if (!config->line_size || (config->line_size & (config->line_size - 1))) return false;
+	if (!config->ways || !config->size) return false;
+	if (config->size % (config->ways * config->line_size)) return false;
+
+	return true;
+}
+
+/**
+ * cache_parse(@spec, @configs, @nr_levels)
+ *
+ * DESCRIPTION
+ *   Parse the levels of the cache hierarchy from @spec, from L1 down to LLC
+ *   separated by commas. Each level is size:ways{:line{:policy{:cycles}}},
+ *   e.g., "32k:8,256k:8,2m:16:64:lru:40". The size may have a k or m
+ *   suffix. The line size defaults to CACHE_LINE_SIZE, the policy to lru,
+ *   and the hit cycles to the typical ones of the level.
+ *
+ * RETURN
+ *   @true if @spec is valid
+ */
+bool cache_parse(char *spec, struct cache_config *configs, unsigned int *nr_levels)
+{
+	*nr_levels = 0;
+
+	for (char *level = strsep(&spec, ","); level; level = strsep(&spec, ",")) {
+		struct cache_config *config = configs + *nr_levels;
+
+		if (*nr_levels == MAX_CACHE_LEVELS) return false;
+
+		config->line_size = CACHE_LINE_SIZE;
+		config->policy = CACHE_POLICY_LRU;
+		config->cycles = default_cycles[*nr_levels];
+
+		if (!__parse_level(level, config)) return false;
+		(*nr_levels)++;
+	}
+	return *nr_levels > 0;
+}
+
+/**
+ * cache_init(@c, @configs, @nr_levels)
+ *
+ * DESCRIPTION
+ *   Initialize @c with @nr_levels levels configured by @configs, all empty.
+ *
+ * RETURN
+ *   @true on success, @false if out of memory
+ */
+bool cache_init(struct cache *c, const struct cache_config *configs, unsigned int nr_levels)
+{
+	memset(c, 0x00, sizeof(*c));
+	c->nr_levels = nr_levels;
+
+	for (unsigned int i = 0; i < nr_levels; i++) {
+		struct cache_level *l = c->levels + i;
+
+		l->config = configs[i];
+		l->nr_sets = l->config.size / l->config.ways / l->config.line_size;
+		l->line_shift = __builtin_ctz(l->config.line_size);
+		l->lines = calloc(l->config.size / l->config.line_size, sizeof(*l->lines));
+		l->seed = 0x2545f491;
+		if (!l->lines) {
+			cache_exit(c);
+			return false;
+		}
+	}
+	return true;
+}
+
+void cache_exit(struct cache *c)
+{
+	for (unsigned int i = 0; i < c->nr_levels; i++) {
+		free(c->levels[i].lines);
+	}
+}
+
+/**
+ * __victim(@l, @set)
+ *
+ * RETURN
+ *   The line to fill in @set; an invalid one, or the one to replace
+ *   according to the replacement policy
+ */
+static struct cache_line *__victim(struct cache_level *l, struct cache_line *set)
+{
+	struct cache_line *victim = set;
+
+	for (unsigned int i = 0; i < l->config.ways; i++) {
+		if (!set[i].valid) return set + i;
+	}
+
+	if (l->config.policy == CACHE_POLICY_RANDOM) {
+		/* xorshift, so that runs are reproducible */
+		l->seed ^= l->seed << 13;
+		l->seed ^= l->seed >> 17;
+		l->seed ^= l->seed << 5;
+		return set + l->seed % l->config.ways;
+	}
+
+	/* Both LRU and FIFO evict the one with the oldest stamp */
+	for (unsigned int i = 1; i < l->config.ways; i++) {
+		if (set[i].stamp < victim->stamp) victim = set + i;
+	}
+	return victim;
+}
+
+/**
+ * __access_level(@l, @paddr, @walk)
+ *
+ * DESCRIPTION
+ *   Look up the line of @paddr in @l, and fill it on miss.
+ *
+ * RETURN
+ *   @true on hit
+ */
+static bool __access_level(struct cache_level *l, unsigned long paddr, bool walk)
+{
+	unsigned long tag = paddr >> l->line_shift;
+	struct cache_line *set = l->lines + (tag % l->nr_sets) * l->config.ways;
+	struct cache_line *line;
+
+	l->clock++;
+
+	for (unsigned int i = 0; i < l->config.ways; i++) {
+		line = set + i;
+
+		if (!line->valid || line->tag != tag) continue;
+
+		if (l->config.policy == CACHE_POLICY_LRU) line->stamp = l->clock;
+		l->nr_hits[walk]++;
+		return true;
+	}
+	l->nr_misses[walk]++;
+
+	line = __victim(l, set);
+	if (walk && line->valid && !line->walk) l->nr_polluted++;
+
+	line->valid = true;
+	line->walk = walk;
+	line->tag = tag;
+	line->stamp = l->clock;
+
+	return false;
+}
+
+/**
+ * cache_access(@c, @paddr, @walk)
+ *
+ * DESCRIPTION
+ *   Access the physical address @paddr through the levels of @c, on behalf
+ *   of a page table walk if @walk is set.
+ *
+ * RETURN
+ *   The level hit, or @c->nr_levels if it goes to the memory
+ */
+unsigned int cache_access(struct cache *c, unsigned long paddr, bool walk)
+{
+	unsigned int i;
+
+	for (i = 0; i < c->nr_levels; i++) {
+		if (__access_level(c->levels + i, paddr, walk)) break;
+	}
+	return i;
+}
+
+static double __hit_ratio(unsigned long nr_hits, unsigned long nr_misses)
+{
+	return nr_hits + nr_misses ? nr_hits * 100.0 / (nr_hits + nr_misses) : 0.0;
+}
+
+/**
+ * cache_show(@c, @out)
+ *
+ * DESCRIPTION
+ *   Report the hit ratios of the data and the walk accesses at each level,
+ *   and how much of the level the page tables are holding.
+ */
+void cache_show(struct cache *c, FILE *out)
+{
+	for (unsigned int i = 0; i < c->nr_levels; i++) {
+		struct cache_level *l = c->levels + i;
+		unsigned int nr_lines = l->config.size / l->config.line_size;
+		unsigned int nr_walk_lines = 0;
+
+		for (unsigned int j = 0; j < nr_lines; j++) {
+			if (l->lines[j].valid && l->lines[j].walk) nr_walk_lines++;
+		}
+
+		fprintf(out, "cache %-6s : %u KiB, %u ways, %u B lines, %s, %u cycles\n",
+				level_names[i], l->config.size >> 10, l->config.ways,
+				l->config.line_size, policy_names[l->config.policy], l->config.cycles);
+		fprintf(out, "  data       : %lu hits, %lu misses (%.2f%% hit)\n",
+				l->nr_hits[false], l->nr_misses[false],
+				__hit_ratio(l->nr_hits[false], l->nr_misses[false]));
+		fprintf(out, "  walk       : %lu hits, %lu misses (%.2f%% hit)\n",
+				l->nr_hits[true], l->nr_misses[true],
+				__hit_ratio(l->nr_hits[true], l->nr_misses[true]));
+		fprintf(out, "  pollution  : %lu data lines evicted by walks, %u of %u lines hold page tables\n",
+				l->nr_polluted, nr_walk_lines, nr_lines);
+	}
+}
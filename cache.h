@@ -0,0 +1,91 @@
+/**********************************************************************
+ * Copyright (c) 2019-2024
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include <stdio.h>
+#include <stdbool.h>
+
+/* Maximum number of cache levels; L1, L2, and LLC */
+#define MAX_CACHE_LEVELS	3
+
+/* Default line size and hit cycles of the levels */
+#define CACHE_LINE_SIZE		64
+#define CACHE_L1_CYCLES		4
+#define CACHE_L2_CYCLES		14
+#define CACHE_LLC_CYCLES	40
+
+/**
+ * Victim selection when a cache set is full
+ */
+enum cache_policy {
+	CACHE_POLICY_LRU,
+	CACHE_POLICY_FIFO,
+	CACHE_POLICY_RANDOM,
+};
+
+struct cache_config {
+	unsigned int size;		/* In bytes */
+	unsigned int ways;
+	unsigned int line_size;
+	enum cache_policy policy;
+	unsigned int cycles;	/* To hit in the level */
+};
+
+struct cache_line {
+	bool valid;
+	bool walk;				/* Filled by a page table walk */
+	unsigned long tag;
+	unsigned long stamp;	/* Time of the last use (LRU) or fill (FIFO) */
+};
+
+/**
+ * A set-associative cache level, indexed by the physical address
+ */
+struct cache_level {
+	struct cache_config config;
+	unsigned int nr_sets;
+	unsigned int line_shift;
+
+	struct cache_line *lines;
+	unsigned long clock;
+	unsigned int seed;		/* For the random replacement */
+
+	/* Indexed by whether the access is from a page table walk */
+	unsigned long nr_hits[2];
+	unsigned long nr_misses[2];
+
+	/* Data lines evicted by the lines filled by the walks */
+	unsigned long nr_polluted;
+};
+
+/**
+ * Hierarchy of the cache levels. An access looks up the levels in order,
+ * and fills the line into the levels it missed.
+ */
+struct cache {
+	unsigned int nr_levels;
+	struct cache_level levels[MAX_CACHE_LEVELS];
+};
+
+bool cache_parse(char *spec, struct cache_config *configs, unsigned int *nr_levels);
+
+bool cache_init(struct cache *c, const struct cache_config *configs, unsigned int nr_levels);
+void cache_exit(struct cache *c);
+
+unsigned int cache_access(struct cache *c, unsigned long paddr, bool walk);
+void cache_show(struct cache *c, FILE *out);
+
+#endif
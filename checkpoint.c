@@ -0,0 +1,582 @@
+/**********************************************************************
+ * Copyright (c) 2019-2024
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "list_head.h"
+#include "vm.h"
+#include "buddy.h"
+#include "checkpoint.h"
+
+/**
+ * A checkpoint is the image of the machine state laid out to be mapped and
+ * used in place on restore. The header is followed by the sections below,
+ * each aligned to CHECKPOINT_ALIGN bytes from the start of the file:
+ *
+ *   processes : struct checkpoint_process for each process, in the order
+ *               of next_process() from the current one
+ *   pds       : Page directories of the processes, in the order of the
+ *               processes and their slots
+ *   cpus      : struct checkpoint_cpu for each CPU
+ *   pwc       : Page walk cache entries of the CPUs
+ *   tlb       : TLB entries of the CPUs, and their tags and valid bits
+ *   mapcounts : Map count and the tier age of each frame
+ *   buddy     : Buddy allocator metadata of each frame
+ *
+ * The pointers to the page directories are saved as their indices plus 1 in
+ * @pds, or 0 for NULL, and turned back into the pointers into the mapping on
+ * restore. The other pointers, like the list heads, are rebuilt. The records
+ * are raw images of the structures, so a checkpoint is restored only by the
+ * build of the same structure sizes that are recorded in the header.
+ */
+#define CHECKPOINT_MAGIC	"VMCKPT\0"
+#define CHECKPOINT_VERSION	1
+#define CHECKPOINT_ALIGN	64
+
+struct checkpoint_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t header_size;
+	uint32_t process_size;
+	uint32_t pd_size;
+	uint32_t tlb_entry_size;
+	uint32_t pwc_entry_size;
+	uint32_t buddy_page_size;
+	uint32_t cpu;			/* Executing the commands */
+	uint64_t size;			/* Of the whole file */
+
+	struct vm_config config;
+	struct vm_stats stats;
+	uint64_t nr_commands;
+	uint64_t tlb_clock;
+	uint32_t tlb_seed;
+	uint32_t nr_free_min;
+	uint32_t nr_processes;
+	uint32_t nr_pds;
+
+	/* Offsets of the sections */
+	uint64_t processes;
+	uint64_t pds;
+	uint64_t cpus;
+	uint64_t pwc;
+	uint64_t tlb;
+	uint64_t tlb_tags;
+	uint64_t tlb_valid;
+	uint64_t mapcounts;
+	uint64_t tier_ages;
+	uint64_t buddy;
+};
+
+#define CHECKPOINT_INIT		0x1	/* The initial process of the machine */
+
+struct checkpoint_process {
+	uint32_t flags;
+	struct process process;
+};
+
+struct checkpoint_cpu {
+	uint32_t current;		/* Index of the process running on the CPU */
+	uint64_t nr_ipis;
+	uint64_t nr_refills;
+	uint64_t nr_drains;
+	uint64_t pwc_clock;
+};
+
+/* Place a section of @size bytes at @end, and advance @end past it */
+static uint64_t __layout(uint64_t *end, uint64_t size)
+{
+	uint64_t offset = *end;
+
+	*end = (offset + size + CHECKPOINT_ALIGN - 1) & ~(uint64_t)(CHECKPOINT_ALIGN - 1);
+	return offset;
+}
+
+static uint64_t __nr_tlb_entries(const struct vm_config *config)
+{
+	return (uint64_t)config->nr_cpus * config->nr_tlb_entries;
+}
+
+/* Lay out the sections of @h with the states counted into it */
+static void __layout_sections(struct checkpoint_header *h)
+{
+	const struct vm_config *config = &h->config;
+	uint64_t end = 0;
+
+	__layout(&end, sizeof(*h));
+	h->processes = __layout(&end, (uint64_t)h->nr_processes * sizeof(struct checkpoint_process));
+	h->pds = __layout(&end, (uint64_t)h->nr_pds * sizeof(struct pte_directory));
+	h->cpus = __layout(&end, config->nr_cpus * sizeof(struct checkpoint_cpu));
+	h->pwc = __layout(&end, (uint64_t)config->nr_cpus * config->nr_pwc_entries *
+			sizeof(struct pwc_entry));
+	h->tlb = __layout(&end, __nr_tlb_entries(config) * sizeof(struct tlb_entry));
+	h->tlb_tags = __layout(&end, __nr_tlb_entries(config) * sizeof(uint32_t));
+	h->tlb_valid = __layout(&end, (__nr_tlb_entries(config) + 63) / 64 * sizeof(uint64_t));
+	h->mapcounts = __layout(&end, (uint64_t)config->nr_pageframes * sizeof(unsigned int));
+	h->tier_ages = __layout(&end, config->nr_fast_frames ? config->nr_pageframes : 0);
+	h->buddy = __layout(&end, (uint64_t)config->nr_pageframes * sizeof(struct buddy_page));
+	h->size = end;
+}
+
+/* Write @size bytes of @data to @file at @offset, zero-filling the padding before it */
+static bool __write_at(FILE *file, uint64_t offset, const void *data, size_t size)
+{
+	static const char zeros[CHECKPOINT_ALIGN];
+	long pos = ftell(file);
+
+	if (pos < 0 || offset < (uint64_t)pos || offset - pos > CHECKPOINT_ALIGN) return false;
+	if (fwrite(zeros, 1, offset - pos, file) != offset - pos) return false;
+	return !size || fwrite(data, 1, size, file) == size;
+}
+
+/**
+ * checkpoint_save(@vm, @path)
+ *
+ * DESCRIPTION
+ *   Save the processes, the page tables, the frame metadata, the TLBs and
+ *   the page walk caches, and the counters of @vm into the file at @path.
+ *   The frames cached by the CPUs are drained first. The miss-ratio curve,
+ *   the caches, the inverted page table, and the guest are not saved, so
+ *   the machines with them are not checkpointed.
+ *
+ * RETURN
+ *   @true on success, @false otherwise
+ */
+bool checkpoint_save(struct vm_machine *vm, const char *path)
+{
+	struct checkpoint_header h = { .magic = CHECKPOINT_MAGIC };
+	struct process **processes = NULL;
+	struct pte_directory **pds = NULL;
+	unsigned long capacity = 0;
+	unsigned int nr_pds = 0;
+	bool saved = false;
+	FILE *file;
+
+	if (vm->config.mrc_rate || vm->config.nr_cache_levels ||
+			vm->config.use_ipt || vm->config.use_nested) {
+		fprintf(vm->con, "Unable to checkpoint with the miss-ratio curve, "
+				"the caches, the inverted page table, or the guest\n");
+		return false;
+	}
+
+	file = fopen(path, "w");
+	if (!file) {
+		fprintf(vm->con, "Unable to open %s\n", path);
+		return false;
+	}
+
+	drain_page_frames(vm);
+
+	for (struct process *p = vm->current; p; p = next_process(vm, p)) {
+		if (h.nr_processes == capacity) {
+			capacity = capacity ? capacity * 2 : 64;
+			processes = realloc(processes, sizeof(*processes) * capacity);
+		}
+		processes[h.nr_processes++] = p;
+
+		for (int i = 0; i < NR_PDES_PER_PAGE; i++) {
+			if (!p->pagetable.pdes[i]) continue;
+			if ((nr_pds & (nr_pds - 1)) == 0) {
+				pds = realloc(pds, sizeof(*pds) * (nr_pds ? nr_pds * 2 : 1));
+			}
+			pds[nr_pds++] = p->pagetable.pdes[i];
+		}
+	}
+
+	h.version = CHECKPOINT_VERSION;
+	h.header_size = sizeof(h);
+	h.process_size = sizeof(struct checkpoint_process);
+	h.pd_size = sizeof(struct pte_directory);
+	h.tlb_entry_size = sizeof(struct tlb_entry);
+	h.pwc_entry_size = sizeof(struct pwc_entry);
+	h.buddy_page_size = sizeof(struct buddy_page);
+	h.cpu = vm->cpu;
+	h.config = vm->config;
+	h.stats = vm->stats;
+	h.nr_commands = vm->nr_commands;
+	h.tlb_clock = vm->tlb_clock;
+	h.tlb_seed = vm->tlb_seed;
+	h.nr_free_min = vm->zone.nr_free_min;
+	h.nr_pds = nr_pds;
+	__layout_sections(&h);
+
+	if (!__write_at(file, 0, &h, sizeof(h))) goto out;
+
+	nr_pds = 0;
+	for (unsigned int i = 0; i < h.nr_processes; i++) {
+		struct checkpoint_process rec = { 0 };
+
+		rec.flags = processes[i] == &vm->init ? CHECKPOINT_INIT : 0;
+		rec.process.pid = processes[i]->pid;
+		rec.process.cpumask = processes[i]->cpumask;
+		rec.process.mempolicy = processes[i]->mempolicy;
+		rec.process.cycles = processes[i]->cycles;
+		rec.process.nr_accesses = processes[i]->nr_accesses;
+		memcpy(rec.process.pagetable.huge, processes[i]->pagetable.huge,
+				sizeof(rec.process.pagetable.huge));
+		for (int j = 0; j < NR_PDES_PER_PAGE; j++) {
+			if (!processes[i]->pagetable.pdes[j]) continue;
+			rec.process.pagetable.pdes[j] = (struct pte_directory *)(uintptr_t)++nr_pds;
+		}
+
+		if (!__write_at(file, h.processes + i * sizeof(rec), &rec, sizeof(rec))) goto out;
+	}
+	for (unsigned int i = 0; i < nr_pds; i++) {
+		if (!__write_at(file, h.pds + i * sizeof(*pds[i]), pds[i], sizeof(*pds[i]))) goto out;
+	}
+
+	for (unsigned int i = 0; i < vm->config.nr_cpus; i++) {
+		struct checkpoint_cpu rec = {
+			.nr_ipis = vm->cpus[i].nr_ipis,
+			.nr_refills = vm->cpus[i].pcp.nr_refills,
+			.nr_drains = vm->cpus[i].pcp.nr_drains,
+			.pwc_clock = vm->cpus[i].pwc_clock,
+		};
+		struct process *current = cpu_current(vm, i);
+
+		while (processes[rec.current] != current) rec.current++;
+		if (!__write_at(file, h.cpus + i * sizeof(rec), &rec, sizeof(rec))) goto out;
+	}
+
+	/* The directories cached in the page walk caches are saved as the indices */
+	for (unsigned int i = 0; i < vm->config.nr_cpus; i++) {
+		for (unsigned int j = 0; j < vm->config.nr_pwc_entries; j++) {
+			struct pwc_entry e = vm->cpus[i].pwc[j];
+			unsigned int index = 0;
+
+			while (e.valid && index < nr_pds && pds[index] != e.pd) index++;
+			if (index == nr_pds) e.valid = false;
+			e.pd = e.valid ? (struct pte_directory *)(uintptr_t)(index + 1) : NULL;
+
+			if (!__write_at(file, h.pwc + (i * vm->config.nr_pwc_entries + j) * sizeof(e),
+					&e, sizeof(e))) goto out;
+		}
+	}
+
+	if (!__write_at(file, h.tlb, vm->cpus[0].tlb,
+			__nr_tlb_entries(&vm->config) * sizeof(struct tlb_entry))) goto out;
+	if (!__write_at(file, h.tlb_tags, vm->tlb_tags,
+			__nr_tlb_entries(&vm->config) * sizeof(*vm->tlb_tags))) goto out;
+	if (!__write_at(file, h.tlb_valid, vm->tlb_valid,
+			(__nr_tlb_entries(&vm->config) + 63) / 64 * sizeof(*vm->tlb_valid))) goto out;
+	if (!__write_at(file, h.mapcounts, vm->mapcounts,
+			vm->config.nr_pageframes * sizeof(*vm->mapcounts))) goto out;
+	if (!__write_at(file, h.tier_ages, vm->tier_ages,
+			vm->config.nr_fast_frames ? vm->config.nr_pageframes : 0)) goto out;
+	if (!__write_at(file, h.buddy, vm->zone.pages,
+			vm->config.nr_pageframes * sizeof(*vm->zone.pages))) goto out;
+	if (!__write_at(file, h.size, NULL, 0)) goto out;
+
+	saved = true;
+	fprintf(vm->out, "checkpoint: %u processes, %u page directories, %lu bytes\n",
+			h.nr_processes, h.nr_pds, (unsigned long)h.size);
+
+out:
+	if (fclose(file)) saved = false;
+	if (!saved) fprintf(vm->con, "Unable to write %s\n", path);
+
+	free(processes);
+	free(pds);
+	return saved;
+}
+
+/**
+ * __check_header(@h, @size)
+ *
+ * DESCRIPTION
+ *   Check if @h heads a checkpoint of @size bytes saved by this build, with
+ *   a configuration the machine can be initialized with.
+ *
+ * RETURN
+ *   NULL if valid, or the reason why not
+ */
+static const char *__check_header(const struct checkpoint_header *h, uint64_t size)
+{
+	const struct vm_config *config = &h->config;
+	struct checkpoint_header layout = *h;
+
+	if (size < sizeof(*h) || memcmp(h->magic, CHECKPOINT_MAGIC, sizeof(h->magic))) {
+		return "not a checkpoint";
+	}
+	if (h->version != CHECKPOINT_VERSION) return "unsupported version";
+	if (h->header_size != sizeof(*h) ||
+			h->process_size != sizeof(struct checkpoint_process) ||
+			h->pd_size != sizeof(struct pte_directory) ||
+			h->tlb_entry_size != sizeof(struct tlb_entry) ||
+			h->pwc_entry_size != sizeof(struct pwc_entry) ||
+			h->buddy_page_size != sizeof(struct buddy_page)) {
+		return "saved by a different build";
+	}
+
+	if (!config->nr_cpus || config->nr_cpus > MAX_CPUS || h->cpu >= config->nr_cpus ||
+			!config->nr_nodes || config->nr_nodes > MAX_NODES ||
+			config->mempolicy.node >= (int)config->nr_nodes ||
+			!config->nr_tlb_entries || !config->tlb_ways ||
+			config->nr_tlb_entries % config->tlb_ways ||
+			!config->nr_pageframes || !config->pcp_batch ||
+			config->pcp_batch > config->pcp_high || config->pcp_low >= config->pcp_high ||
+			config->mrc_rate || config->nr_cache_levels ||
+			config->use_ipt || config->use_nested) {
+		return "invalid configuration";
+	}
+
+	/* The sections should be where this build lays them out, up to @size */
+	__layout_sections(&layout);
+	if (memcmp(&layout, h, sizeof(layout))) return "corrupted layout";
+	if (h->size != size) return "truncated";
+	return NULL;
+}
+
+/* Check if the directory index saved in place of @pd is valid on @h */
+static bool __valid_pd(const struct checkpoint_header *h, const struct pte_directory *pd)
+{
+	return (uintptr_t)pd <= h->nr_pds;
+}
+
+static struct pte_directory *__pd(struct pte_directory *pds, const struct pte_directory *pd)
+{
+	return pd ? pds + (uintptr_t)pd - 1 : NULL;
+}
+
+/**
+ * __check_records(@snapshot)
+ *
+ * RETURN
+ *   NULL if the indices in the records of @snapshot are valid, or the reason
+ *   why not
+ */
+static const char *__check_records(char *snapshot)
+{
+	const struct checkpoint_header *h = (void *)snapshot;
+	const struct checkpoint_process *records = (void *)(snapshot + h->processes);
+	const struct checkpoint_cpu *cpus = (void *)(snapshot + h->cpus);
+	const struct pwc_entry *pwc = (void *)(snapshot + h->pwc);
+
+	for (unsigned int i = 0; i < h->nr_processes; i++) {
+		for (int j = 0; j < NR_PDES_PER_PAGE; j++) {
+			if (!__valid_pd(h, records[i].process.pagetable.pdes[j])) {
+				return "invalid page directory";
+			}
+		}
+	}
+	for (unsigned int i = 0; i < h->config.nr_cpus; i++) {
+		if (cpus[i].current >= h->nr_processes) return "invalid process";
+	}
+	for (unsigned int i = 0; i < h->config.nr_cpus * h->config.nr_pwc_entries; i++) {
+		if (!__valid_pd(h, pwc[i].pd)) return "invalid page directory";
+	}
+	return NULL;
+}
+
+/**
+ * checkpoint_read_config(@path, @config)
+ *
+ * DESCRIPTION
+ *   Read the configuration of the machine saved in the checkpoint at @path
+ *   into @config.
+ *
+ * RETURN
+ *   @true on success, @false if @path is not a valid checkpoint
+ */
+bool checkpoint_read_config(const char *path, struct vm_config *config)
+{
+	struct checkpoint_header h;
+	FILE *file = fopen(path, "r");
+	struct stat st;
+	bool valid;
+
+	if (!file) return false;
+
+	valid = fstat(fileno(file), &st) == 0 && fread(&h, sizeof(h), 1, file) == 1 &&
+			!__check_header(&h, st.st_size);
+	if (valid) *config = h.config;
+
+	fclose(file);
+	return valid;
+}
+
+/**
+ * checkpoint_restore(@vm, @path)
+ *
+ * DESCRIPTION
+ *   Replace the state of @vm with the checkpoint at @path saved with the same
+ *   number of CPUs. @vm is initialized again with the configuration in the
+ *   checkpoint, keeping its streams and interactivity. The checkpoint is
+ *   mapped privately, and the processes and the page directories are used in
+ *   place after fixing up their pointers; only the per-frame and the per-CPU
+ *   states are copied out of it. So restoring takes time in proportion to
+ *   the number of processes and frames, not to the size of the page tables.
+ *   @vm is intact if the checkpoint is invalid. If the memory runs out on
+ *   initializing @vm again, @vm is initialized with its own configuration
+ *   instead, or left empty if that fails as well.
+ *
+ * RETURN
+ *   @true on success, @false otherwise
+ */
+bool checkpoint_restore(struct vm_machine *vm, const char *path)
+{
+	struct timespec start, end;
+	struct checkpoint_header *h;
+	struct checkpoint_process *records;
+	struct checkpoint_cpu *cpus;
+	struct pwc_entry *pwc;
+	struct pte_directory *pds;
+	struct process **processes;
+	struct vm_config config;
+	struct vm_config old = vm->config;
+	FILE *out = vm->out;
+	FILE *con = vm->con;
+	const char *reason;
+	char *snapshot;
+	struct stat st;
+	int fd;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(con, "No checkpoint %s\n", path);
+		return false;
+	}
+	if (fstat(fd, &st) || (size_t)st.st_size < sizeof(*h)) {
+		fprintf(con, "Invalid checkpoint %s: not a checkpoint\n", path);
+		close(fd);
+		return false;
+	}
+
+	/* Written in place on the fix-ups, but never back to the file */
+	snapshot = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (snapshot == MAP_FAILED) {
+		fprintf(con, "Unable to map %s\n", path);
+		return false;
+	}
+
+	h = (void *)snapshot;
+	if (!(reason = __check_header(h, st.st_size)) && !(reason = __check_records(snapshot)) &&
+			h->config.nr_cpus != vm->config.nr_cpus) {
+		reason = "different number of CPUs";
+	}
+	if (reason) {
+		fprintf(con, "Invalid checkpoint %s: %s\n", path, reason);
+		munmap(snapshot, st.st_size);
+		return false;
+	}
+
+	records = (void *)(snapshot + h->processes);
+	pds = (void *)(snapshot + h->pds);
+	cpus = (void *)(snapshot + h->cpus);
+	pwc = (void *)(snapshot + h->pwc);
+
+	processes = malloc(sizeof(*processes) * h->nr_processes);
+	if (!processes) {
+		fprintf(con, "Out of memory to restore %s\n", path);
+		munmap(snapshot, st.st_size);
+		return false;
+	}
+
+	config = h->config;
+	config.interactive = vm->config.interactive;
+	vm_machine_exit(vm);
+	if (vm_machine_init(vm, &config)) {
+		fprintf(con, "Out of memory to restore %s\n", path);
+		free(processes);
+		munmap(snapshot, st.st_size);
+		if (!vm_machine_init(vm, &old)) {
+			vm->out = out;
+			vm->con = con;
+		}
+		return false;
+	}
+	vm->out = out;
+	vm->con = con;
+	vm->snapshot = snapshot;
+	vm->snapshot_size = st.st_size;
+
+	vm->stats = h->stats;
+	vm->nr_commands = h->nr_commands;
+	vm->tlb_clock = h->tlb_clock;
+	vm->tlb_seed = h->tlb_seed;
+
+	/* The initial process comes back only if it has not exited */
+	vm->init.cpumask = 0;
+
+	for (unsigned int i = 0; i < h->nr_processes; i++) {
+		struct process *p = &records[i].process;
+
+		if (records[i].flags & CHECKPOINT_INIT) {
+			vm->init = *p;
+			p = &vm->init;
+		}
+		for (int j = 0; j < NR_PDES_PER_PAGE; j++) {
+			p->pagetable.pdes[j] = __pd(pds, p->pagetable.pdes[j]);
+			pthread_mutex_init(&p->pagetable.locks[j], NULL);
+		}
+		INIT_LIST_HEAD(&p->list);
+
+		/* Saved in the order of next_process(), so the ready queue is in order */
+		if (!p->cpumask) list_add_tail(&p->list, &vm->processes);
+		processes[i] = p;
+	}
+
+	for (unsigned int i = 0; i < vm->config.nr_cpus; i++) {
+		struct vm_cpu *cpu = vm->cpus + i;
+
+		cpu->current = processes[cpus[i].current];
+		cpu->ptbr = &cpu->current->pagetable;
+		cpu->nr_ipis = cpus[i].nr_ipis;
+		cpu->pcp.nr_refills = cpus[i].nr_refills;
+		cpu->pcp.nr_drains = cpus[i].nr_drains;
+		cpu->pwc_clock = cpus[i].pwc_clock;
+
+		for (unsigned int j = 0; j < vm->config.nr_pwc_entries; j++) {
+			cpu->pwc[j] = pwc[i * vm->config.nr_pwc_entries + j];
+			cpu->pwc[j].pd = __pd(pds, cpu->pwc[j].pd);
+		}
+	}
+	free(processes);
+
+	vm->cpu = h->cpu;
+	vm->current = vm->cpus[vm->cpu].current;
+	vm->ptbr = vm->cpus[vm->cpu].ptbr;
+	vm->tlb = vm->cpus[vm->cpu].tlb;
+
+	memcpy(vm->cpus[0].tlb, snapshot + h->tlb,
+			__nr_tlb_entries(&config) * sizeof(struct tlb_entry));
+	memcpy(vm->tlb_tags, snapshot + h->tlb_tags,
+			__nr_tlb_entries(&config) * sizeof(*vm->tlb_tags));
+	memcpy(vm->tlb_valid, snapshot + h->tlb_valid,
+			(__nr_tlb_entries(&config) + 63) / 64 * sizeof(*vm->tlb_valid));
+	memcpy(vm->mapcounts, snapshot + h->mapcounts,
+			config.nr_pageframes * sizeof(*vm->mapcounts));
+	if (config.nr_fast_frames) {
+		memcpy(vm->tier_ages, snapshot + h->tier_ages, config.nr_pageframes);
+	}
+	buddy_restore(&vm->zone, (void *)(snapshot + h->buddy), h->nr_free_min);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	fprintf(vm->out, "restore: %u processes, %u page directories in %lu ns\n",
+			h->nr_processes, h->nr_pds,
+			(end.tv_sec - start.tv_sec) * 1000000000UL + end.tv_nsec - start.tv_nsec);
+	return true;
+}
@@ -0,0 +1,27 @@
+/**********************************************************************
+ * Copyright (c) 2019-2024
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+#ifndef __CHECKPOINT_H__
+#define __CHECKPOINT_H__
+
+#include <stdbool.h>
+
+struct vm_machine;
+struct vm_config;
+
+bool checkpoint_save(struct vm_machine *vm, const char *path);
+bool checkpoint_read_config(const char *path, struct vm_config *config);
+bool checkpoint_restore(struct vm_machine *vm, const char *path);
+
+#endif
@@ -0,0 +1,157 @@
+/**********************************************************************
+ * Copyright (c) 2019-2024
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "list_head.h"
+#include "vm.h"
+#include "buddy.h"
+#include "compact.h"
+
+/**
+ * is_movable_page(@vm, @pfn)
+ *
+ * DESCRIPTION
+ *   Only the frames mapped to processes can be migrated. The zero page is
+ *   pinned, frames allocated with alloc-order have no mapping to fix up, and
+ *   moving a frame of a huge page would break its contiguity.
+ */
+bool is_movable_page(struct vm_machine *vm, unsigned int pfn)
+{
+	if (!vm->mapcounts[pfn]) return false;
+	if (vm->config.use_zero_page && pfn == ZERO_PFN) return false;
+
+	for (struct process *p = vm->current; p; p = next_process(vm, p)) {
+		for (int i = 0; i < NR_PDES_PER_PAGE; i++) {
+			struct pte *huge = &p->pagetable.huge[i];
+
+			if (pte_valid(huge) && pfn - pte_pfn(huge) < NR_PAGES_PER_HUGE) return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * migrate_page(@vm, @from, @to)
+ *
+ * DESCRIPTION
+ *   Move the contents of the frame @from to the free frame @to. Every PTE
+ *   mapping @from is updated to @to, and the stale TLB entries are shot down.
+ */
+void migrate_page(struct vm_machine *vm, unsigned int from, unsigned int to)
+{
+	for (struct process *p = vm->current; p; p = next_process(vm, p)) {
+		for (int i = 0; i < NR_PDES_PER_PAGE; i++) {
+			struct pte_directory *pd = p->pagetable.pdes[i];
+
+			if (!pd) continue;
+
+			for (int j = 0; j < NR_PTES_PER_PAGE; j++) {
+				struct pte *pte = &pd->ptes[j];
+
+				if (!pte_valid(pte) || pte_pfn(pte) != from) continue;
+
+				pte_set_pfn(pte, to);
+				flush_tlb_range(vm, p, i * NR_PTES_PER_PAGE + j, 1);
+			}
+		}
+	}
+
+	vm->mapcounts[to] = vm->mapcounts[from];
+	vm->mapcounts[from] = 0;
+	if (vm->tier_ages) vm->tier_ages[to] = vm->tier_ages[from];
+	buddy_free(&vm->zone, from);
+}
+
+/**
+ * compact_memory(@vm, @result)
+ *
+ * DESCRIPTION
+ *   Defragment the physical memory. The migration scanner walks up from the
+ *   lowest frame looking for movable frames, and the free scanner walks down
+ *   from the highest frame looking for free frames. Frames are migrated until
+ *   the scanners meet, gathering the frames in use at the top of the memory
+ *   and leaving the free frames contiguous at the bottom.
+ *   Report the outcome into @result if not NULL.
+ */
+void compact_memory(struct vm_machine *vm, struct compact_result *result)
+{
+	unsigned int migrate_pfn = 0;
+	unsigned int free_pfn = vm->config.nr_pageframes - 1;
+	unsigned int nr_migrated = 0;
+	struct timespec start, end;
+	unsigned long nsecs;
+
+	if (result) {
+		result->largest_order[0] = buddy_largest_order(&vm->zone);
+		result->unusable_index[0] = buddy_unusable_index(&vm->zone, HUGE_PAGE_ORDER);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while (true) {
+		while (migrate_pfn < free_pfn && !is_movable_page(vm, migrate_pfn)) {
+			migrate_pfn++;
+		}
+		while (free_pfn > migrate_pfn && !buddy_is_free(&vm->zone, free_pfn)) {
+			free_pfn--;
+		}
+		if (migrate_pfn >= free_pfn) break;
+
+		buddy_take(&vm->zone, free_pfn);
+		migrate_page(vm, migrate_pfn, free_pfn);
+		nr_migrated++;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	nsecs = (end.tv_sec - start.tv_sec) * 1000000000UL +
+			end.tv_nsec - start.tv_nsec;
+
+	vm->stats.nr_compactions++;
+	vm->stats.nr_pages_migrated += nr_migrated;
+	vm->stats.compact_nsecs += nsecs;
+
+	if (result) {
+		result->nr_migrated = nr_migrated;
+		result->nsecs = nsecs;
+		result->largest_order[1] = buddy_largest_order(&vm->zone);
+		result->unusable_index[1] = buddy_unusable_index(&vm->zone, HUGE_PAGE_ORDER);
+	}
+}
+
+/**
+ * compact_alloc(@vm, @order)
+ *
+ * DESCRIPTION
+ *   Allocate 2^@order contiguous frames from the buddy allocator. When there
+ *   are enough free frames but they are too fragmented to serve the request,
+ *   compact the memory and try once more.
+ *
+ * RETURN
+ *   The first pfn of the allocated block, or -1 on failure
+ */
+unsigned int compact_alloc(struct vm_machine *vm, unsigned int order)
+{
+	unsigned int pfn = buddy_alloc(&vm->zone, order);
+
+	if (pfn != -1 || !order) return pfn;
+	if (vm->zone.nr_free < (1 << order)) return -1;
+	if (buddy_unusable_index(&vm->zone, order) < vm->config.compaction_threshold) return -1;
+
+	compact_memory(vm, NULL);
+
+	return buddy_alloc(&vm->zone, order);
+}
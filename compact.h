@@ -0,0 +1,37 @@
+/**********************************************************************
+ * Copyright (c) 2019-2024
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+#ifndef __COMPACT_H__
+#define __COMPACT_H__
+
+/**
+ * Outcome of a compaction run
+ */
+struct compact_result {
+	unsigned int nr_migrated;
+	unsigned long nsecs;
+
+	/* Contiguity of the free memory before and after the compaction */
+	unsigned int largest_order[2];
+	unsigned int unusable_index[2];	/* For huge pages, in 1/1000 */
+};
+
+struct vm_machine;
+
+void compact_memory(struct vm_machine *vm, struct compact_result *result);
+unsigned int compact_alloc(struct vm_machine *vm, unsigned int order);
+bool is_movable_page(struct vm_machine *vm, unsigned int pfn);
+void migrate_page(struct vm_machine *vm, unsigned int from, unsigned int to);
+
+#endif
@@ -0,0 +1,237 @@
+/**********************************************************************
+ * Copyright (c) 2019-2024
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "parser.h"
+#include "vm.h"
+#include "ingest.h"
+
+/**
+ * Address traces of real programs, recorded by Valgrind Lackey
+ * (valgrind --tool=lackey --trace-mem=yes) as
+ *
+ *   I  0400d7d4,8
+ *    S 7ff000398,8
+ *    L 7ff0003a0,8
+ *    M 0421c7f0,4
+ *
+ * for the instruction fetches, stores, loads, and modifies (a load and then
+ * a store), or logged as a hex address per line optionally followed by r or
+ * w (a read by default). The lines Valgrind prints by itself (==pid== ...)
+ * and the comments (#) are skipped.
+ *
+ * The addresses are split into the pages of the given page size, and the
+ * pages are folded into the virtual address space of the machine by their
+ * numbers modulo the number of pages in it. So the neighbouring pages stay
+ * neighbours. The offsets in the pages are scaled to PAGE_SIZE.
+ */
+#define NR_VPNS		(NR_PDES_PER_PAGE * NR_PTES_PER_PAGE)
+
+struct ingest {
+	struct vm_machine *vm;
+	unsigned int page_shift;
+	bool alloc;
+
+	/* VPNs allocated or found mapped already, on @alloc */
+	uint64_t touched[(NR_VPNS + 63) / 64];
+
+	unsigned long nr_lines;
+	unsigned long nr_skipped;		/* Lines not in either format */
+	unsigned long nr_accesses;
+	unsigned long nr_loads;			/* Including the instruction fetches */
+	unsigned long nr_stores;
+	unsigned long nr_crossings;		/* Accesses spanning two pages */
+	unsigned long nr_allocs;
+	unsigned long nr_failures;
+};
+
+/**
+ * __access(@in, @addr, @rw)
+ *
+ * DESCRIPTION
+ *   Access @addr for @rw, allocating its page on the first touch if asked.
+ *
+ * RETURN
+ *   @false if the memory is full to allocate the page, @true otherwise
+ */
+static bool __access(struct ingest *in, uint64_t addr, unsigned int rw)
+{
+	struct vm_machine *vm = in->vm;
+	unsigned int vpn = (addr >> in->page_shift) % NR_VPNS;
+	unsigned int offset = addr & ((1UL << in->page_shift) - 1);
+	unsigned int pfn;
+
+	if (in->page_shift > PAGE_SHIFT) {
+		offset >>= in->page_shift - PAGE_SHIFT;
+	} else {
+		offset <<= PAGE_SHIFT - in->page_shift;
+	}
+
+	if (in->alloc && !(in->touched[vpn / 64] & (1UL << vpn % 64))) {
+		int ret = vm_alloc_page(vm, vpn, ACCESS_READ | ACCESS_WRITE, &pfn);
+
+		if (ret == -LIBVM_ENOMEM) return false;
+		if (ret == 0) in->nr_allocs++;
+		in->touched[vpn / 64] |= 1UL << vpn % 64;
+	}
+
+	if (vm_access(vm, vpn, rw, offset, &pfn)) in->nr_failures++;
+	vm_tick(vm);
+
+	in->nr_accesses++;
+	if (rw == ACCESS_READ) {
+		in->nr_loads++;
+	} else {
+		in->nr_stores++;
+	}
+	return true;
+}
+
+/* Access @size bytes from @addr, on the both pages if it spans two */
+static bool __access_range(struct ingest *in, uint64_t addr, unsigned int size, unsigned int rw)
+{
+	uint64_t last = addr + (size ? size - 1 : 0);
+
+	if (!__access(in, addr, rw)) return false;
+	if ((last >> in->page_shift) == (addr >> in->page_shift)) return true;
+
+	in->nr_crossings++;
+	return __access(in, last & ~((1UL << in->page_shift) - 1), rw);
+}
+
+/**
+ * __ingest_line(@in, @line)
+ *
+ * DESCRIPTION
+ *   Decode @line in either format, and access the addresses in it.
+ *
+ * RETURN
+ *   @false if the memory is full, @true otherwise
+ */
+static bool __ingest_line(struct ingest *in, char *line)
+{
+	char *p = line;
+	char *end;
+	uint64_t addr;
+	unsigned int size = 1;
+	char type;
+
+	while (isspace(*p)) p++;
+	if (*p == '\0' || *p == '#' || strncmp(p, "==", 2) == 0) return true;
+
+	/* Lackey, whose access type is followed by a space */
+	if (strchr("ILSM", *p) && isspace(p[1])) {
+		type = *p++;
+
+		addr = strtoull(p, &end, 16);
+		if (end == p || *end != ',') goto skip;
+		size = strtoul(end + 1, &p, 10);
+		if (p == end + 1) goto skip;
+
+		if (type == 'S') return __access_range(in, addr, size, ACCESS_WRITE);
+		if (type == 'M' && !__access_range(in, addr, size, ACCESS_READ)) return false;
+		return __access_range(in, addr, size, type == 'M' ? ACCESS_WRITE : ACCESS_READ);
+	}
+
+	/* Raw hex address, with or without the 0x prefix */
+	addr = strtoull(p, &end, 16);
+	if (end == p || (*end && !isspace(*end))) goto skip;
+
+	while (isspace(*end)) end++;
+	if (tolower(*end) == 'w') return __access(in, addr, ACCESS_WRITE);
+	if (*end == '\0' || tolower(*end) == 'r') return __access(in, addr, ACCESS_READ);
+
+skip:
+	in->nr_skipped++;
+	return true;
+}
+
+/**
+ * ingest_trace(@vm, @path, @page_size, @alloc)
+ *
+ * DESCRIPTION
+ *   Stream the address trace at @path, or stdin for "-", into @vm. The
+ *   trace may be compressed with gzip. Each address is translated and
+ *   accessed through vm_access() as the access commands are, but the results
+ *   of the accesses are not printed; the summary and the statistics are,
+ *   at the end. The pages are of @page_size bytes, a power of 2. The pages
+ *   are allocated on the first touch if @alloc. The trace is read a line at
+ *   a time, so any size of trace is ingested in a constant memory.
+ *
+ * RETURN
+ *   @true if @path is ingested, even when the memory gets full in the
+ *   middle. @false if it cannot be opened
+ */
+bool ingest_trace(struct vm_machine *vm, const char *path, unsigned long page_size, bool alloc)
+{
+	struct ingest in = { .vm = vm, .alloc = alloc };
+	char line[MAX_COMMAND_LEN];
+	struct timespec start, end;
+	FILE *out = vm->out;
+	FILE *null;
+	unsigned long nsecs;
+	gzFile input;
+
+	/* gzip reads the files not compressed as they are */
+	if (strcmp(path, "-") == 0) {
+		input = gzdopen(dup(STDIN_FILENO), "r");
+	} else {
+		input = gzopen(path, "r");
+	}
+	if (!input) return false;
+	gzbuffer(input, 1 << 17);
+
+	while ((1UL << in.page_shift) < page_size) in.page_shift++;
+
+	null = fopen("/dev/null", "w");
+	if (null) vm->out = null;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (gzgets(input, line, sizeof(line))) {
+		in.nr_lines++;
+		if (!__ingest_line(&in, line)) {
+			fprintf(vm->con, "Memory is full at line %lu\n", in.nr_lines);
+			break;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	if (null) fclose(null);
+	vm->out = out;
+	gzclose(input);
+
+	nsecs = (end.tv_sec - start.tv_sec) * 1000000000UL + end.tv_nsec - start.tv_nsec;
+	fprintf(vm->out, "ingest: %lu lines, %lu accesses (%lu loads, %lu stores, "
+			"%lu spanning pages), %lu skipped lines\n",
+			in.nr_lines, in.nr_accesses, in.nr_loads, in.nr_stores,
+			in.nr_crossings, in.nr_skipped);
+	fprintf(vm->out, "ingest: %lu pages allocated, %lu accesses failed, "
+			"%.3f ms (%.3f Maccesses/s)\n",
+			in.nr_allocs, in.nr_failures, nsecs / 1000000.0,
+			nsecs ? in.nr_accesses * 1000.0 / nsecs : 0.0);
+
+	vm_execute(vm, &(struct vm_op){ .cpu = -1, .type = VM_OP_STATS });
+	if (vm->config.mrc_rate) mrc_show(&vm->mrc, vm->out);
+
+	return true;
+}
@@ -0,0 +1,27 @@
+/**********************************************************************
+ * Copyright (c) 2019-2024
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+#ifndef __INGEST_H__
+#define __INGEST_H__
+
+#include <stdbool.h>
+
+struct vm_machine;
+
+/* Page size of the address traces by default */
+#define INGEST_PAGE_SIZE	4096
+
+bool ingest_trace(struct vm_machine *vm, const char *path, unsigned long page_size, bool alloc);
+
+#endif
@@ -0,0 +1,372 @@
+/**********************************************************************
+ * Copyright (c) 2019-2024
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "list_head.h"
+#include "vm.h"
+#include "ipt.h"
+
+static uint64_t __hash(unsigned int pid, unsigned int vpn)
+{
+	uint64_t key = (uint64_t)pid << 32 | vpn;
+
+	/* splitmix64 finalizer */
+	key ^= key >> 30;
+	key *= 0xbf58476d1ce4e5b9ULL;
+	key ^= key >> 27;
+	key *= 0x94d049bb133111ebULL;
+	key ^= key >> 31;
+	return key;
+}
+
+/**
+ * ipt_init(@ipt, @nr_frames)
+ *
+ * DESCRIPTION
+ *   Initialize @ipt with IPT_SLOTS_PER_FRAME slots for each of @nr_frames
+ *   frames, rounded up to a power of 2 groups.
+ *
+ * RETURN
+ *   @true on success, @false if out of memory
+ */
+bool ipt_init(struct ipt *ipt, unsigned int nr_frames)
+{
+	unsigned int nr_slots = nr_frames * IPT_SLOTS_PER_FRAME;
+
+	memset(ipt, 0x00, sizeof(*ipt));
+
+	ipt->nr_groups = 1;
+	while (ipt->nr_groups * IPT_GROUP_SIZE < nr_slots) ipt->nr_groups <<= 1;
+
+	ipt->slots = calloc(ipt->nr_groups * IPT_GROUP_SIZE, sizeof(*ipt->slots));
+	ipt->seed = 0x2545f491;
+	return ipt->slots != NULL;
+}
+
+void ipt_exit(struct ipt *ipt)
+{
+	free(ipt->slots);
+}
+
+/**
+ * ipt_group(@ipt, @pid, @vpn, @secondary)
+ *
+ * RETURN
+ *   The primary group of (@pid, @vpn), or the secondary one if @secondary
+ *   is set. The secondary hash is the complement of the primary one.
+ */
+unsigned int ipt_group(struct ipt *ipt, unsigned int pid, unsigned int vpn, bool secondary)
+{
+	uint64_t hash = __hash(pid, vpn);
+
+	return (secondary ? ~hash : hash) & (ipt->nr_groups - 1);
+}
+
+static struct ipt_entry *__find(struct ipt *ipt, unsigned int group, unsigned int pid, unsigned int vpn)
+{
+	struct ipt_entry *slots = ipt->slots + group * IPT_GROUP_SIZE;
+
+	for (int i = 0; i < IPT_GROUP_SIZE; i++) {
+		struct ipt_entry *e = slots + i;
+
+		if (e->valid && e->pid == pid && e->vpn == vpn) return e;
+	}
+	return NULL;
+}
+
+/**
+ * ipt_lookup(@ipt, @pid, @vpn)
+ *
+ * DESCRIPTION
+ *   Look up the translation of @vpn of process @pid in the primary group,
+ *   and then in the secondary group.
+ *
+ * RETURN
+ *   The entry, or NULL if not found
+ */
+struct ipt_entry *ipt_lookup(struct ipt *ipt, unsigned int pid, unsigned int vpn)
+{
+	struct ipt_entry *e;
+
+	ipt->nr_lookups++;
+	ipt->nr_probes++;
+
+	e = __find(ipt, ipt_group(ipt, pid, vpn, false), pid, vpn);
+	if (!e) {
+		ipt->nr_probes++;
+		e = __find(ipt, ipt_group(ipt, pid, vpn, true), pid, vpn);
+	}
+	if (e) ipt->nr_hits++;
+
+	return e;
+}
+
+static struct ipt_entry *__find_free(struct ipt *ipt, unsigned int group)
+{
+	struct ipt_entry *slots = ipt->slots + group * IPT_GROUP_SIZE;
+
+	for (int i = 0; i < IPT_GROUP_SIZE; i++) {
+		if (!slots[i].valid) return slots + i;
+	}
+	return NULL;
+}
+
+/**
+ * ipt_insert(@ipt, @pid, @vpn, @pfn, @rw)
+ *
+ * DESCRIPTION
+ *   Map @vpn of process @pid to @pfn for @rw, updating the entry in place
+ *   if there is one already. A free slot in the primary group is taken
+ *   first, and then in the secondary group. When both are full, a random
+ *   entry of the primary group is evicted.
+ */
+void ipt_insert(struct ipt *ipt, unsigned int pid, unsigned int vpn, unsigned int pfn, unsigned int rw)
+{
+	unsigned int primary = ipt_group(ipt, pid, vpn, false);
+	unsigned int secondary = ipt_group(ipt, pid, vpn, true);
+	struct ipt_entry *e = __find(ipt, primary, pid, vpn);
+
+	if (!e) e = __find(ipt, secondary, pid, vpn);
+	if (!e) e = __find_free(ipt, primary);
+	if (!e) e = __find_free(ipt, secondary);
+	if (!e) {
+		/* xorshift, so that runs are reproducible */
+		ipt->seed ^= ipt->seed << 13;
+		ipt->seed ^= ipt->seed >> 17;
+		ipt->seed ^= ipt->seed << 5;
+		e = ipt->slots + primary * IPT_GROUP_SIZE + ipt->seed % IPT_GROUP_SIZE;
+		ipt->nr_evictions++;
+	}
+
+	e->valid = true;
+	e->pid = pid;
+	e->vpn = vpn;
+	e->pfn = pfn;
+	e->rw = rw;
+	ipt->nr_inserts++;
+}
+
+/**
+ * ipt_invalidate(@ipt, @pid, @start, @nr_pages)
+ *
+ * DESCRIPTION
+ *   Drop the entries of the pages [@start, @start + @nr_pages) of process
+ *   @pid.
+ */
+void ipt_invalidate(struct ipt *ipt, unsigned int pid, unsigned int start, unsigned int nr_pages)
+{
+	for (unsigned int vpn = start; vpn < start + nr_pages; vpn++) {
+		struct ipt_entry *e = __find(ipt, ipt_group(ipt, pid, vpn, false), pid, vpn);
+
+		if (!e) e = __find(ipt, ipt_group(ipt, pid, vpn, true), pid, vpn);
+		if (!e) continue;
+
+		e->valid = false;
+		ipt->nr_invalidations++;
+	}
+}
+
+/**
+ * ipt_bytes(@ipt)
+ *
+ * RETURN
+ *   The memory footprint of @ipt, as IPT_ENTRY_SIZE bytes per slot
+ */
+unsigned long ipt_bytes(struct ipt *ipt)
+{
+	return (unsigned long)ipt->nr_groups * IPT_GROUP_SIZE * IPT_ENTRY_SIZE;
+}
+
+void ipt_show(struct ipt *ipt, FILE *out)
+{
+	unsigned int nr_used = 0;
+
+	for (unsigned int i = 0; i < ipt->nr_groups * IPT_GROUP_SIZE; i++) {
+		if (ipt->slots[i].valid) nr_used++;
+	}
+
+	fprintf(out, "ipt          : %lu lookups, %lu hits (%.2f%% hit), %.2f groups probed per lookup\n",
+			ipt->nr_lookups, ipt->nr_hits,
+			ipt->nr_lookups ? ipt->nr_hits * 100.0 / ipt->nr_lookups : 0.0,
+			ipt->nr_lookups ? (double)ipt->nr_probes / ipt->nr_lookups : 0.0);
+	fprintf(out, "  entries    : %u of %u slots used (%lu bytes), %lu inserted, %lu evicted, %lu invalidated\n",
+			nr_used, ipt->nr_groups * IPT_GROUP_SIZE, ipt_bytes(ipt),
+			ipt->nr_inserts, ipt->nr_evictions, ipt->nr_invalidations);
+}
+
+/**
+ * __radix_bytes(@pts, @nr_processes)
+ *
+ * RETURN
+ *   The memory footprint of the radix page tables, as a page directory of
+ *   NR_PDES_PER_PAGE entries for each process and NR_PTES_PER_PAGE entries
+ *   for each pte_directory, PTE_SIZE bytes each
+ */
+static unsigned long __radix_bytes(struct pagetable *pts, unsigned int nr_processes)
+{
+	unsigned long bytes = 0;
+
+	for (unsigned int p = 0; p < nr_processes; p++) {
+		bytes += NR_PDES_PER_PAGE * PTE_SIZE;
+
+		for (int i = 0; i < NR_PDES_PER_PAGE; i++) {
+			if (pts[p].pdes[i]) bytes += NR_PTES_PER_PAGE * PTE_SIZE;
+		}
+	}
+	return bytes;
+}
+
+static unsigned long __nsecs_since(struct timespec *start)
+{
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_sec - start->tv_sec) * 1000000000UL + end.tv_nsec - start->tv_nsec;
+}
+
+/**
+ * ipt_bench(@nr_processes, @nr_lookups, @out)
+ *
+ * DESCRIPTION
+ *   Compare the radix page tables and the hashed inverted page table with
+ *   @nr_processes processes, each mapping 1, 4, 16, and all of its pages
+ *   at random, to private frames. A row of the memory footprint and the
+ *   cost of @nr_lookups random translations of the mapped pages is reported
+ *   to @out for each structure and density.
+ *
+ * RETURN
+ *   0 on success
+ *   -LIBVM_ENOMEM if out of memory
+ *   -LIBVM_EFAULT if the two translated differently
+ */
+int ipt_bench(unsigned int nr_processes, unsigned long nr_lookups, FILE *out)
+{
+	const unsigned int nr_pages = NR_PDES_PER_PAGE * NR_PTES_PER_PAGE;
+	unsigned int *keys = malloc(nr_lookups * sizeof(*keys) * 2);
+	unsigned int seed = 0x2545f491;
+	int ret = 0;
+
+	if (!keys) return -LIBVM_ENOMEM;
+
+	fprintf(out, "%-6s | %9s | %10s | %9s | %12s | %14s | %9s | %11s\n", "table",
+			"processes", "pages/proc", "mappings", "bytes", "bytes/mapping",
+			"ns/lookup", "refs/lookup");
+
+	for (unsigned int density = 1; !ret && density <= nr_pages; density *= 4) {
+		struct pagetable *pts = calloc(nr_processes, sizeof(*pts));
+		unsigned int *vpns = malloc(nr_processes * density * sizeof(*vpns));
+		unsigned long nr_mappings = (unsigned long)nr_processes * density;
+		unsigned long sum = 0, nr_refs = 0, nsecs;
+		struct timespec start;
+		struct ipt ipt = { 0 };
+
+		if (!pts || !vpns || !ipt_init(&ipt, nr_mappings)) {
+			ret = -LIBVM_ENOMEM;
+			goto next;
+		}
+
+		/* Map @density distinct random pages of each process, by partial shuffle */
+		for (unsigned int p = 0; p < nr_processes; p++) {
+			unsigned int order[NR_PDES_PER_PAGE * NR_PTES_PER_PAGE];
+
+			for (unsigned int i = 0; i < nr_pages; i++) order[i] = i;
+
+			for (unsigned int i = 0; i < density; i++) {
+				unsigned int pfn = p * density + i;
+				unsigned int j, vpn;
+				struct pte *pte;
+
+				seed ^= seed << 13;
+				seed ^= seed >> 17;
+				seed ^= seed << 5;
+				j = i + seed % (nr_pages - i);
+				vpn = order[j];
+				order[j] = order[i];
+				order[i] = vpn;
+
+				if (!pts[p].pdes[vpn / NR_PTES_PER_PAGE]) {
+					pts[p].pdes[vpn / NR_PTES_PER_PAGE] = calloc(1, sizeof(struct pte_directory));
+					if (!pts[p].pdes[vpn / NR_PTES_PER_PAGE]) {
+						ret = -LIBVM_ENOMEM;
+						goto next;
+					}
+				}
+				pte = &pts[p].pdes[vpn / NR_PTES_PER_PAGE]->ptes[vpn % NR_PTES_PER_PAGE];
+				pte_set(pte, pfn, ACCESS_READ | ACCESS_WRITE);
+
+				ipt_insert(&ipt, p, vpn, pfn, pte_rw(pte));
+				vpns[pfn] = vpn;
+			}
+		}
+
+		for (unsigned long i = 0; i < nr_lookups; i++) {
+			seed ^= seed << 13;
+			seed ^= seed >> 17;
+			seed ^= seed << 5;
+			keys[i * 2] = seed % nr_processes;
+			keys[i * 2 + 1] = vpns[keys[i * 2] * density + seed / nr_processes % density];
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (unsigned long i = 0; i < nr_lookups; i++) {
+			struct pagetable *pt = pts + keys[i * 2];
+			unsigned int vpn = keys[i * 2 + 1];
+			struct pte_directory *pd = pt->pdes[vpn / NR_PTES_PER_PAGE];
+
+			nr_refs++;
+			if (!pd) continue;
+
+			nr_refs++;
+			if (pte_valid(&pd->ptes[vpn % NR_PTES_PER_PAGE])) sum += pte_pfn(&pd->ptes[vpn % NR_PTES_PER_PAGE]);
+		}
+		nsecs = __nsecs_since(&start);
+
+		fprintf(out, "%-6s | %9u | %10u | %9lu | %12lu | %14.2f | %9.2f | %11.2f\n", "radix",
+				nr_processes, density, nr_mappings, __radix_bytes(pts, nr_processes),
+				(double)__radix_bytes(pts, nr_processes) / nr_mappings,
+				(double)nsecs / nr_lookups, (double)nr_refs / nr_lookups);
+
+		ipt.nr_lookups = ipt.nr_probes = ipt.nr_hits = 0;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (unsigned long i = 0; i < nr_lookups; i++) {
+			struct ipt_entry *e = ipt_lookup(&ipt, keys[i * 2], keys[i * 2 + 1]);
+
+			if (e) sum -= e->pfn;
+		}
+		nsecs = __nsecs_since(&start);
+
+		fprintf(out, "%-6s | %9u | %10u | %9lu | %12lu | %14.2f | %9.2f | %11.2f\n", "ipt",
+				nr_processes, density, nr_mappings, ipt_bytes(&ipt),
+				(double)ipt_bytes(&ipt) / nr_mappings,
+				(double)nsecs / nr_lookups, (double)ipt.nr_probes / nr_lookups);
+
+		/* Both should have translated the same, unless the ipt evicted some */
+		if (sum && !ipt.nr_evictions) ret = -LIBVM_EFAULT;
+next:
+		ipt_exit(&ipt);
+		for (unsigned int p = 0; pts && p < nr_processes; p++) {
+			for (int i = 0; i < NR_PDES_PER_PAGE; i++) free(pts[p].pdes[i]);
+		}
+		free(pts);
+		free(vpns);
+	}
+	free(keys);
+	return ret;
+}
@@ -0,0 +1,74 @@
+/**********************************************************************
+ * Copyright (c) 2019-2024
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+#ifndef __IPT_H__
+#define __IPT_H__
+
+#include <stdio.h>
+#include <stdbool.h>
+
+/**
+ * Slots in a hash group. A key hashes to a primary and a secondary group,
+ * and may sit in any slot of them.
+ */
+#define IPT_GROUP_SIZE	8
+
+/* Size of a slot in the memory, for the cache model and the footprint */
+#define IPT_ENTRY_SIZE	16
+
+/* Slots of the table per physical frame */
+#define IPT_SLOTS_PER_FRAME	2
+
+struct ipt_entry {
+	bool valid;
+	unsigned int pid;
+	unsigned int vpn;
+	unsigned int pfn;
+	unsigned int rw;
+};
+
+/**
+ * Hashed inverted page table, shared by all processes and keyed by
+ * (pid, vpn). Its size follows the physical memory rather than the address
+ * spaces. It caches the translations of the radix page tables, which the
+ * OS keeps as the source of truth, so an entry may be evicted when both of
+ * its groups are full.
+ */
+struct ipt {
+	struct ipt_entry *slots;
+	unsigned int nr_groups;		/* Power of 2 */
+	unsigned int seed;			/* For the victim selection */
+
+	unsigned long nr_lookups;
+	unsigned long nr_probes;	/* Groups read by the lookups */
+	unsigned long nr_hits;
+	unsigned long nr_inserts;
+	unsigned long nr_evictions;
+	unsigned long nr_invalidations;
+};
+
+bool ipt_init(struct ipt *ipt, unsigned int nr_frames);
+void ipt_exit(struct ipt *ipt);
+
+unsigned int ipt_group(struct ipt *ipt, unsigned int pid, unsigned int vpn, bool secondary);
+struct ipt_entry *ipt_lookup(struct ipt *ipt, unsigned int pid, unsigned int vpn);
+void ipt_insert(struct ipt *ipt, unsigned int pid, unsigned int vpn, unsigned int pfn, unsigned int rw);
+void ipt_invalidate(struct ipt *ipt, unsigned int pid, unsigned int start, unsigned int nr_pages);
+
+unsigned long ipt_bytes(struct ipt *ipt);
+void ipt_show(struct ipt *ipt, FILE *out);
+
+int ipt_bench(unsigned int nr_processes, unsigned long nr_lookups, FILE *out);
+
+#endif
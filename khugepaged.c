@@ -0,0 +1,134 @@
+/**********************************************************************
+ * Copyright (c) 2019-2024
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "list_head.h"
+#include "vm.h"
+#include "buddy.h"
+#include "compact.h"
+#include "khugepaged.h"
+
+/**
+ * __collapsible(@vm, @pd, @in_place)
+ *
+ * DESCRIPTION
+ *   A page directory can be collapsed into a huge page when all of its PTEs
+ *   are valid with the same permission, and none of the frames is shared
+ *   with others (including the zero page).
+ *
+ * RETURN
+ *   @true if @pd can be collapsed. @in_place is set if its frames are
+ *   contiguous and aligned already, so no copy is required.
+ */
+static bool __collapsible(struct vm_machine *vm, struct pte_directory *pd, bool *in_place)
+{
+	struct pte *first = &pd->ptes[0];
+
+	*in_place = pte_pfn(first) % NR_PAGES_PER_HUGE == 0;
+
+	for (int i = 0; i < NR_PTES_PER_PAGE; i++) {
+		struct pte *pte = &pd->ptes[i];
+
+		if (!pte_valid(pte)) return false;
+		if (pte_rw(pte) != pte_rw(first) || pte_cow(pte) != pte_cow(first)) return false;
+		if (vm->mapcounts[pte_pfn(pte)] != 1) return false;
+		if (vm->config.use_zero_page && pte_pfn(pte) == ZERO_PFN) return false;
+
+		if (pte_pfn(pte) != pte_pfn(first) + i) *in_place = false;
+	}
+	return true;
+}
+
+/**
+ * __collapse_huge_page(@vm, @pt, @pd_index)
+ *
+ * DESCRIPTION
+ *   Replace the page directory at @pd_index of @pt with a huge mapping.
+ *   The pages are copied into newly allocated contiguous frames unless they
+ *   are contiguous already.
+ *
+ * RETURN
+ *   @true if collapsed
+ */
+static bool __collapse_huge_page(struct vm_machine *vm, struct pagetable *pt, int pd_index)
+{
+	struct pte_directory *pd = pt->pdes[pd_index];
+	struct pte *huge = &pt->huge[pd_index];
+	bool in_place;
+	unsigned int pfn;
+
+	if (!__collapsible(vm, pd, &in_place)) return false;
+
+	if (in_place) {
+		pfn = pte_pfn(&pd->ptes[0]);
+	} else {
+		pfn = compact_alloc(vm, HUGE_PAGE_ORDER);
+		if (pfn == -1) return false;
+
+		/**
+		 * The compaction may have moved the pages around. They are still
+		 * collapsible since migration keeps the mapcounts.
+		 */
+		buddy_split(&vm->zone, pfn);
+		for (int i = 0; i < NR_PTES_PER_PAGE; i++) {
+			unsigned int old = pte_pfn(&pd->ptes[i]);
+
+			vm->mapcounts[pfn + i] = 1;
+			if (--vm->mapcounts[old] == 0) buddy_free(&vm->zone, old);
+		}
+		vm->stats.nr_huge_collapse_copies++;
+	}
+
+	pte_set(huge, pfn, pte_rw(&pd->ptes[0]));
+	pte_set_flag(huge, PTE_COW, pte_cow(&pd->ptes[0]));
+
+	flush_pwc(vm, container_of(pt, struct process, pagetable), pd_index);
+	pt->pdes[pd_index] = NULL;
+	vm_free(vm, pd);
+
+	/* Drop the small-page translations replaced by the huge mapping */
+	flush_tlb_range(vm, container_of(pt, struct process, pagetable),
+			pd_index * NR_PTES_PER_PAGE, NR_PAGES_PER_HUGE);
+	vm->stats.nr_huge_collapses++;
+
+	return true;
+}
+
+/**
+ * khugepaged_scan(@vm)
+ *
+ * DESCRIPTION
+ *   Scan the page directories of every process on the system, and collapse
+ *   the fully populated ones into huge pages. Write faults on the collapsed
+ *   huge pages that are shared split them back in handle_page_fault().
+ *
+ * RETURN
+ *   The number of page directories collapsed
+ */
+unsigned int khugepaged_scan(struct vm_machine *vm)
+{
+	unsigned int nr_collapsed = 0;
+
+	for (struct process *p = vm->current; p; p = next_process(vm, p)) {
+		for (int i = 0; i < NR_PDES_PER_PAGE; i++) {
+			if (!p->pagetable.pdes[i]) continue;
+
+			if (__collapse_huge_page(vm, &p->pagetable, i)) nr_collapsed++;
+		}
+	}
+	return nr_collapsed;
+}
@@ -0,0 +1,348 @@
+/**********************************************************************
+ * Copyright (c) 2019-2024
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "vm.h"
+#include "libvm.h"
+
+#define NR_VPNS	(NR_PDES_PER_PAGE * NR_PTES_PER_PAGE)
+
+struct libvm {
+	struct vm_machine machine;
+
+	/* Discards the results printed by the commands, unless set otherwise */
+	FILE *null;
+};
+
+static const char * const errors[] = {
+	[0] = "Success",
+	[LIBVM_EINVAL] = "Invalid argument",
+	[LIBVM_ENOMEM] = "Out of memory",
+	[LIBVM_EEXIST] = "Already exists",
+	[LIBVM_ENOENT] = "No such page or process",
+	[LIBVM_EFAULT] = "Unable to access",
+	[LIBVM_EBUSY] = "Running on other CPUs",
+};
+
+unsigned int libvm_version(void)
+{
+	return LIBVM_VERSION;
+}
+
+const char *libvm_strerror(int error)
+{
+	if (error > 0 || -error >= sizeof(errors) / sizeof(*errors)) return "Unknown error";
+
+	return errors[-error];
+}
+
+/**
+ * __parse_options(@options, @config)
+ *
+ * DESCRIPTION
+ *   Apply the command line options of the machine in @options, separated by
+ *   spaces like "-t -p 4 -C 32k:8", to @config.
+ *
+ * RETURN
+ *   0 on success, -LIBVM_EINVAL otherwise
+ */
+static int __parse_options(const char *options, struct vm_config *config)
+{
+	char *str = strdup(options);
+	char *saveptr;
+	int ret = 0;
+
+	if (!str) return -LIBVM_ENOMEM;
+
+	for (char *tok = strtok_r(str, " \t\n", &saveptr); tok && !ret;
+			tok = strtok_r(NULL, " \t\n", &saveptr)) {
+		const char *opt;
+		char *arg = NULL;
+
+		if (tok[0] != '-' || !tok[1] || tok[1] == ':' ||
+				!(opt = strchr(VM_CONFIG_OPTIONS, tok[1]))) {
+			ret = -LIBVM_EINVAL;
+			break;
+		}
+		if (opt[1] == ':') {
+			arg = tok[2] ? tok + 2 : strtok_r(NULL, " \t\n", &saveptr);
+			if (!arg) {
+				ret = -LIBVM_EINVAL;
+				break;
+			}
+		} else if (tok[2]) {
+			ret = -LIBVM_EINVAL;
+			break;
+		}
+		ret = vm_config_option(config, tok[1], arg);
+	}
+	free(str);
+
+	return ret;
+}
+
+/**
+ * libvm_create(@options, @vm)
+ *
+ * DESCRIPTION
+ *   Create a machine configured by the command line @options of the
+ *   simulator, e.g., "-t -z -C 32k:8,256k:8", and put it in @vm. NULL or ""
+ *   creates the default one.
+ *
+ * RETURN
+ *   0 on success, -LIBVM_EINVAL on invalid options, or -LIBVM_ENOMEM
+ */
+int libvm_create(const char *options, struct libvm **vm)
+{
+	struct vm_config config;
+	struct libvm *v;
+	int ret;
+
+	vm_config_init(&config);
+	if (options && (ret = __parse_options(options, &config))) return ret;
+	if (vm_config_check(&config)) return -LIBVM_EINVAL;
+
+	v = malloc(sizeof(*v));
+	if (!v) return -LIBVM_ENOMEM;
+
+	v->null = fopen("/dev/null", "w");
+	if (!v->null) {
+		free(v);
+		return -LIBVM_ENOMEM;
+	}
+
+	ret = vm_machine_init(&v->machine, &config);
+	if (ret) {
+		fclose(v->null);
+		free(v);
+		return ret;
+	}
+	v->machine.out = v->null;
+	v->machine.con = v->null;
+
+	*vm = v;
+	return 0;
+}
+
+void libvm_destroy(struct libvm *vm)
+{
+	vm_machine_exit(&vm->machine);
+	fclose(vm->null);
+	free(vm);
+}
+
+/**
+ * libvm_set_output(@vm, @out)
+ *
+ * DESCRIPTION
+ *   Print the results of the calls on @vm to @out in the format of the
+ *   simulator, or discard them if @out is NULL.
+ */
+int libvm_set_output(struct libvm *vm, FILE *out)
+{
+	vm->machine.out = out ? out : vm->null;
+	vm->machine.con = out ? out : vm->null;
+
+	return 0;
+}
+
+int libvm_alloc(struct libvm *vm, unsigned int vpn, unsigned int rw, unsigned int *pfn)
+{
+	int ret;
+
+	if (vpn >= NR_VPNS || !(rw & LIBVM_READ) || (rw & ~(LIBVM_READ | LIBVM_WRITE))) {
+		return -LIBVM_EINVAL;
+	}
+	ret = vm_alloc_page(&vm->machine, vpn, rw, pfn);
+	vm_tick(&vm->machine);
+
+	return ret;
+}
+
+int libvm_alloc_huge(struct libvm *vm, unsigned int vpn, unsigned int rw, unsigned int *pfn)
+{
+	int ret;
+
+	if (vpn >= NR_VPNS || !(rw & LIBVM_READ) || (rw & ~(LIBVM_READ | LIBVM_WRITE))) {
+		return -LIBVM_EINVAL;
+	}
+	ret = vm_alloc_huge_page(&vm->machine, vpn, rw, pfn);
+	vm_tick(&vm->machine);
+
+	return ret;
+}
+
+int libvm_free(struct libvm *vm, unsigned int vpn)
+{
+	int ret;
+
+	if (vpn >= NR_VPNS) return -LIBVM_EINVAL;
+
+	ret = vm_free_page(&vm->machine, vpn);
+	vm_tick(&vm->machine);
+
+	return ret;
+}
+
+int libvm_access(struct libvm *vm, unsigned int vpn, unsigned int rw, unsigned int offset, unsigned int *pfn)
+{
+	int ret;
+
+	if (vpn >= NR_VPNS || (rw != LIBVM_READ && rw != LIBVM_WRITE) || offset >= PAGE_SIZE) {
+		return -LIBVM_EINVAL;
+	}
+	ret = vm_access(&vm->machine, vpn, rw, offset, pfn);
+	vm_tick(&vm->machine);
+
+	return ret;
+}
+
+/**
+ * libvm_access_batch(@vm, @accesses, @nr, @pfns, @results)
+ *
+ * DESCRIPTION
+ *   Access the @nr pages in @accesses, translated in a batch. The frames
+ *   are put in @pfns and the results, 0 or -LIBVM_EFAULT, in @results, in
+ *   the order of @accesses. The batch counts as a single command.
+ *
+ * RETURN
+ *   The number of pages accessed, or -LIBVM_EINVAL if any of @accesses is
+ *   invalid. Nothing is accessed then.
+ */
+int libvm_access_batch(struct libvm *vm, const struct libvm_access *accesses, unsigned int nr, unsigned int *pfns, int *results)
+{
+	struct vm_xlate *xlates;
+	enum vm_xlate_status *status;
+	unsigned int nr_accessed;
+
+	if (!nr) return 0;
+
+	for (unsigned int i = 0; i < nr; i++) {
+		if (accesses[i].vpn >= NR_VPNS ||
+				(accesses[i].rw != LIBVM_READ && accesses[i].rw != LIBVM_WRITE)) {
+			return -LIBVM_EINVAL;
+		}
+	}
+
+	xlates = malloc(sizeof(*xlates) * nr);
+	status = malloc(sizeof(*status) * nr);
+	if (!xlates || !status) {
+		free(xlates);
+		free(status);
+		return -LIBVM_ENOMEM;
+	}
+	for (unsigned int i = 0; i < nr; i++) {
+		xlates[i].vpn = accesses[i].vpn;
+		xlates[i].rw = accesses[i].rw;
+	}
+
+	nr_accessed = vm_access_batch(&vm->machine, xlates, nr, pfns, status);
+	vm_tick(&vm->machine);
+
+	for (unsigned int i = 0; i < nr; i++) {
+		results[i] = status[i] == VM_XLATE_FAIL ? -LIBVM_EFAULT : 0;
+	}
+	free(xlates);
+	free(status);
+
+	return nr_accessed;
+}
+
+unsigned int libvm_current(struct libvm *vm)
+{
+	return vm->machine.current->pid;
+}
+
+/**
+ * libvm_fork(@vm, @pid)
+ *
+ * DESCRIPTION
+ *   Fork the process @pid from the current one, and switch to it.
+ *
+ * RETURN
+ *   0 on success, or -LIBVM_EEXIST if there is a process with @pid
+ */
+int libvm_fork(struct libvm *vm, unsigned int pid)
+{
+	if (vm_find_process(&vm->machine, pid)) return -LIBVM_EEXIST;
+
+	vm_switch(&vm->machine, pid);
+	vm_tick(&vm->machine);
+
+	return 0;
+}
+
+int libvm_switch(struct libvm *vm, unsigned int pid)
+{
+	if (!vm_find_process(&vm->machine, pid)) return -LIBVM_ENOENT;
+
+	vm_switch(&vm->machine, pid);
+	vm_tick(&vm->machine);
+
+	return 0;
+}
+
+/**
+ * libvm_exit(@vm, @next)
+ *
+ * DESCRIPTION
+ *   Exit the current process, releasing all its pages, and switch to the
+ *   process @next. @next is created with nothing mapped if it does not exist.
+ *
+ * RETURN
+ *   0 on success, -LIBVM_EINVAL if @next is the current process, or
+ *   -LIBVM_EBUSY if the current process is running on other CPUs
+ */
+int libvm_exit(struct libvm *vm, unsigned int next)
+{
+	int ret = vm_exit_process(&vm->machine, next);
+
+	if (!ret) vm_tick(&vm->machine);
+
+	return ret;
+}
+
+/**
+ * libvm_get_stats(@vm, @stats, @size)
+ *
+ * DESCRIPTION
+ *   Take a snapshot of the statistics of @vm into @stats of @size bytes.
+ *   The fields beyond @size, added after the caller is built, are left out.
+ */
+int libvm_get_stats(struct libvm *vm, struct libvm_stats *stats, size_t size)
+{
+	const struct vm_stats *s = &vm->machine.stats;
+	struct libvm_stats snapshot = {
+		.nr_translations = s->nr_translations,
+		.nr_tlb_hits = s->nr_tlb_hits,
+		.nr_tlb_misses = s->nr_tlb_misses,
+		.nr_walks = s->nr_walks,
+		.nr_walk_refs = s->nr_walk_refs,
+		.nr_faults = s->nr_faults,
+		.nr_accesses = s->nr_accesses,
+		.nr_free_frames = vm->machine.zone.nr_free,
+		.access_cycles = s->access_cycles,
+	};
+
+	for (int i = 0; i < NR_COSTS; i++) snapshot.cycles += s->cycles[i];
+
+	memcpy(stats, &snapshot, size < sizeof(snapshot) ? size : sizeof(snapshot));
+
+	return 0;
+}
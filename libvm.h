@@ -0,0 +1,92 @@
+/**********************************************************************
+ * Copyright (c) 2019-2024
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+#ifndef __LIBVM_H__
+#define __LIBVM_H__
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Embedding interface of the simulator, built into libvm.so and libvm.a.
+ *
+ * A machine is created from the command line options of the simulator, and
+ * driven by the calls below in place of the commands of the workload. The
+ * machines share nothing, so each can be driven by its own thread. The calls
+ * return 0 or the number of pages on success, and a negative LIBVM_E* code
+ * on failure. Nothing is printed unless libvm_set_output() asks for it.
+ *
+ * Fields are only ever appended to the structures below, and the existing
+ * calls and codes are kept across the versions.
+ */
+#define LIBVM_VERSION	1
+
+#if defined(__GNUC__)
+#define LIBVM_API	__attribute__((visibility("default")))
+#else
+#define LIBVM_API
+#endif
+
+#define LIBVM_EINVAL	1	/* Invalid argument or combination of options */
+#define LIBVM_ENOMEM	2	/* Out of page frames, or of the host memory */
+#define LIBVM_EEXIST	3	/* The page or the process already exists */
+#define LIBVM_ENOENT	4	/* No such page or process */
+#define LIBVM_EFAULT	5	/* Unable to access the page */
+#define LIBVM_EBUSY		6	/* The process is running on other CPUs */
+
+#define LIBVM_READ		0x01
+#define LIBVM_WRITE		0x02
+
+struct libvm;
+
+struct libvm_access {
+	unsigned int vpn;
+	unsigned int rw;	/* Either LIBVM_READ or LIBVM_WRITE */
+};
+
+struct libvm_stats {
+	uint64_t nr_translations;
+	uint64_t nr_tlb_hits;
+	uint64_t nr_tlb_misses;
+	uint64_t nr_walks;
+	uint64_t nr_walk_refs;		/* Page table entries read by the walks */
+	uint64_t nr_faults;
+	uint64_t nr_accesses;
+	uint64_t nr_free_frames;
+	uint64_t cycles;			/* Cycles charged to the machine */
+	uint64_t access_cycles;		/* Cycles spent in the accesses */
+};
+
+LIBVM_API unsigned int libvm_version(void);
+LIBVM_API const char *libvm_strerror(int error);
+
+LIBVM_API int libvm_create(const char *options, struct libvm **vm);
+LIBVM_API void libvm_destroy(struct libvm *vm);
+LIBVM_API int libvm_set_output(struct libvm *vm, FILE *out);
+
+LIBVM_API int libvm_alloc(struct libvm *vm, unsigned int vpn, unsigned int rw, unsigned int *pfn);
+LIBVM_API int libvm_alloc_huge(struct libvm *vm, unsigned int vpn, unsigned int rw, unsigned int *pfn);
+LIBVM_API int libvm_free(struct libvm *vm, unsigned int vpn);
+LIBVM_API int libvm_access(struct libvm *vm, unsigned int vpn, unsigned int rw, unsigned int offset, unsigned int *pfn);
+LIBVM_API int libvm_access_batch(struct libvm *vm, const struct libvm_access *accesses, unsigned int nr, unsigned int *pfns, int *results);
+
+LIBVM_API unsigned int libvm_current(struct libvm *vm);
+LIBVM_API int libvm_fork(struct libvm *vm, unsigned int pid);
+LIBVM_API int libvm_switch(struct libvm *vm, unsigned int pid);
+LIBVM_API int libvm_exit(struct libvm *vm, unsigned int next);
+
+LIBVM_API int libvm_get_stats(struct libvm *vm, struct libvm_stats *stats, size_t size);
+
+#endif
@@ -0,0 +1,404 @@
+/**********************************************************************
+ * Copyright (c) 2020-2024
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <getopt.h>
+#include <sys/stat.h>
+
+#include "vm.h"
+#include "replay.h"
+#include "sweep.h"
+#include "smp.h"
+#include "tier.h"
+#include "ipt.h"
+#include "checkpoint.h"
+#include "ingest.h"
+
+static bool verbose = true;
+
+/**
+ * The machine simulated by the command line interface
+ */
+static struct vm_machine machine;
+
+static void __print_usage(const char * name)
+{
+	printf("Usage: %s {-q} {-t} {-z} {-c [threshold]} {-k [interval]} {-m [rate]} {-p [cpus] {-P} {-w [high,low,batch]}} {-n [nodes,policy,node]} {-T [fast,interval,fast_cycles,slow_cycles]} {-L [component=cycles,...]} {-C [caches]} {-d [entries]} {-I} {-G {-H}} {-r [checkpoint]} {-f [workload file]}\n", name);
+	printf("       %s {-t} {-w [high,low,batch]} -b [cpus]\n", name);
+	printf("       %s -B [processes]\n", name);
+	printf("       %s -M\n", name);
+	printf("       %s {-t} {-d [entries]} {-I} {-G {-H}} -X\n", name);
+	printf("       %s {-t} {-z} {-k [interval]} {-p [cpus]} {-C [caches]} {-r [checkpoint]} -l [page size] {-F} {address trace}\n", name);
+	printf("       %s {-t} {-z} {-c [threshold]} {-k [interval]} {-j [workers]} {-o [outdir]} [workload file | dir] ...\n", name);
+	printf("       %s {-z} {-c [threshold]} {-k [interval]} {-j [workers]} -s [spec] [workload file]\n", name);
+	printf("\n");
+	printf("  -t: Show TLB result\n");
+	printf("  -z: Back untouched pages with the shared zero page\n");
+	printf("  -c: Compact memory on high-order allocation failures when\n");
+	printf("      the fragmentation is over @threshold (0-1000, default 500)\n");
+	printf("  -k: Run khugepaged every @interval commands\n");
+	printf("  -p: Simulate @cpus CPUs with their own TLBs (default 1)\n");
+	printf("  -P: Execute the CPUs concurrently on their own threads\n");
+	printf("  -w: Watermarks of the per-CPU frame caches on -P as high,low,batch\n");
+	printf("      (default: a quarter of the frames per CPU, 0, and half of it)\n");
+	printf("  -b: Benchmark the page allocation on 1, 2, 4, ... @cpus concurrent CPUs\n");
+	printf("  -n: Split the frames into @nodes memory nodes, placing the pages\n");
+	printf("      by @policy (default first-touch) preferring @node (default the\n");
+	printf("      node of the allocating CPU)\n");
+	printf("  -T: Put the first @fast frames in the fast tier and the rest in the\n");
+	printf("      slow tier, rebalanced every @interval commands (default 64),\n");
+	printf("      costing @fast_cycles,@slow_cycles per access (default %d,%d)\n",
+			TIER_FAST_CYCLES, TIER_SLOW_CYCLES);
+	printf("  -L: Set the cycles of the cost components, e.g., \"walk=30,fault=1000\"\n");
+	printf("  -C: Access the data through the caches, given from L1 down to LLC as\n");
+	printf("      size:ways{:line{:policy{:cycles}}},..., e.g., \"32k:8,256k:8,2m:16\"\n");
+	printf("  -d: Cache @entries page directory pointers per CPU to shortcut the walks\n");
+	printf("  -I: Look up the translations in a hashed inverted page table before\n");
+	printf("      walking the page tables\n");
+	printf("  -G: Run the workload in a guest, walking the guest and the host page\n");
+	printf("      tables in two dimensions on the TLB misses\n");
+	printf("  -H: Back the guest memory with huge pages in the host on -G\n");
+	printf("  -l: Stream the address trace of Valgrind Lackey or of hex addresses,\n");
+	printf("      gzipped or not, from the file or stdin in @page_size-byte pages\n");
+	printf("      (%d by default) folded into the address space of the machine\n",
+			INGEST_PAGE_SIZE);
+	printf("  -F: Allocate the pages of the address trace on their first touch\n");
+	printf("  -r: Start from @checkpoint saved by the checkpoint command, in its\n");
+	printf("      configuration instead of the one given by the options\n");
+	printf("  -B: Benchmark the radix and the inverted page tables with @processes\n");
+	printf("  -M: Benchmark the TLB search over 16 - 4096 entries\n");
+	printf("  -X: Benchmark the translations one by one and in batches\n");
+	printf("  -m: Build the TLB miss-ratio curve of all sizes, sampling the\n");
+	printf("      pages at @rate (0.0-1.0, 1 for the exact curve)\n");
+	printf("  -j: Replay the workloads in parallel with @workers threads\n");
+	printf("      (0 for the number of processors). Implied by multiple\n");
+	printf("      workload files or a directory\n");
+	printf("  -o: Put the outputs of the parallel replay in @outdir instead of\n");
+	printf("      next to the workload files\n");
+	printf("  -s: Replay the workload on every configuration in @spec at once,\n");
+	printf("      e.g., \"tlb=16,64 ways=1,4,full policy=lru,fifo,random frames=64,128\"\n");
+	printf("  -q: Run quietly\n\n");
+}
+
+static void __print_option_error(int opt)
+{
+	switch (opt) {
+	case 'm':
+		fprintf(stderr, "Sampling rate should be in (0.0, 1.0]\n");
+		break;
+	case 'p':
+		fprintf(stderr, "The number of CPUs should be 1 - %lu\n", MAX_CPUS);
+		break;
+	case 'w':
+		fprintf(stderr, "Frame cache watermarks should be high{,low{,batch}} "
+				"with low < high and batch <= high\n");
+		break;
+	case 'n':
+		fprintf(stderr, "Nodes should be nodes{,policy{,node}} with 1 - %d nodes, "
+				"policy of first-touch, interleave, bind, or preferred, "
+				"and node < nodes\n", MAX_NODES);
+		break;
+	case 'T':
+		fprintf(stderr, "Tiers should be fast{,interval{,fast_cycles,slow_cycles}} "
+				"with at least one fast frame\n");
+		break;
+	case 'L':
+		fprintf(stderr, "Latencies should be component=cycles,... with components of");
+		for (int i = 0; i < NR_COSTS; i++) fprintf(stderr, " %s", vm_cost_names[i]);
+		fprintf(stderr, "\n");
+		break;
+	case 'C':
+		fprintf(stderr, "Caches should be size:ways{:line{:policy{:cycles}}},... "
+				"from L1 down to up to %d levels\n", MAX_CACHE_LEVELS);
+		break;
+	}
+}
+
+int main(int argc, char * argv[])
+{
+	int opt;
+	int ret;
+	FILE *input = stdin;
+	struct vm_config config;
+	bool replay = false;
+	unsigned int nr_workers = 0;
+	const char *outdir = NULL;
+	const char *spec = NULL;
+	const char *restore = NULL;
+	unsigned long page_size = 0;
+	bool first_touch = false;
+	bool concurrent = false;
+	unsigned int bench_cpus = 0;
+	unsigned int bench_processes = 0;
+	bool bench_tlb = false;
+	bool bench_translate = false;
+	const char *reason;
+	struct stat st;
+
+	vm_config_init(&config);
+
+	while ((opt = getopt(argc, argv, "qhPb:B:MXj:o:s:r:l:F" VM_CONFIG_OPTIONS)) != -1) {
+		switch (opt) {
+		case 'q':
+			verbose = false;
+			break;
+		case 'P':
+			concurrent = true;
+			break;
+		case 'b':
+			bench_cpus = strtoimax(optarg, NULL, 0);
+			if (!bench_cpus || bench_cpus > MAX_CPUS) {
+				fprintf(stderr, "The number of CPUs should be 1 - %lu\n", MAX_CPUS);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'B':
+			bench_processes = strtoimax(optarg, NULL, 0);
+			if (!bench_processes) {
+				fprintf(stderr, "The number of processes should be at least 1\n");
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'M':
+			bench_tlb = true;
+			break;
+		case 'X':
+			bench_translate = true;
+			break;
+		case 'j':
+			replay = true;
+			nr_workers = strtoimax(optarg, NULL, 0);
+			break;
+		case 'o':
+			outdir = optarg;
+			break;
+		case 's':
+			spec = optarg;
+			break;
+		case 'r':
+			restore = optarg;
+			break;
+		case 'l':
+			page_size = strtoul(optarg, NULL, 0);
+			if (!page_size || (page_size & (page_size - 1))) {
+				fprintf(stderr, "The page size should be a power of 2\n");
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'F':
+			first_touch = true;
+			break;
+		case 'h':
+		case '?':
+			__print_usage(argv[0]);
+			return EXIT_FAILURE;
+		default:
+			if (vm_config_option(&config, opt, optarg)) {
+				__print_option_error(opt);
+				return EXIT_FAILURE;
+			}
+			break;
+		}
+	}
+
+	if (restore && !checkpoint_read_config(restore, &config)) {
+		fprintf(stderr, "Invalid checkpoint %s\n", restore);
+		return EXIT_FAILURE;
+	}
+
+	if (concurrent && config.mrc_rate) {
+		fprintf(stderr, "The miss-ratio curve is not built on concurrent CPUs\n");
+		return EXIT_FAILURE;
+	}
+
+	if (concurrent && config.nr_cache_levels) {
+		fprintf(stderr, "The caches are not modeled on concurrent CPUs\n");
+		return EXIT_FAILURE;
+	}
+
+	if (config.use_nested && concurrent) {
+		fprintf(stderr, "The guest is modeled on serial CPUs, without the inverted "
+				"page table, the nodes, and the tiers\n");
+		return EXIT_FAILURE;
+	}
+
+	if (page_size && concurrent) {
+		fprintf(stderr, "The address traces are streamed on serial CPUs\n");
+		return EXIT_FAILURE;
+	}
+
+	if (first_touch && !page_size) {
+		fprintf(stderr, "The pages are allocated on the first touch of the address traces "
+				"given with -l\n");
+		return EXIT_FAILURE;
+	}
+
+	if ((reason = vm_config_check(&config))) {
+		fprintf(stderr, "%s\n", reason);
+		return EXIT_FAILURE;
+	}
+
+	if (bench_cpus) {
+		if ((ret = smp_bench_alloc(&config, bench_cpus, 1 << 18, stdout))) {
+			fprintf(stderr, "%s\n", libvm_strerror(ret));
+			return EXIT_FAILURE;
+		}
+		return EXIT_SUCCESS;
+	}
+
+	if (bench_tlb) {
+		if ((ret = tlb_bench(1 << 20, stdout))) {
+			fprintf(stderr, "%s\n", libvm_strerror(ret));
+			return EXIT_FAILURE;
+		}
+		return EXIT_SUCCESS;
+	}
+
+	if (bench_translate) {
+		if (vm_translate_bench(&config, 1 << 20, stdout)) {
+			fprintf(stderr, "Not enough memory to map the address space\n");
+			return EXIT_FAILURE;
+		}
+		return EXIT_SUCCESS;
+	}
+
+	if (bench_processes) {
+		if ((ret = ipt_bench(bench_processes, 1 << 22, stdout))) {
+			fprintf(stderr, "%s\n", ret == -LIBVM_EFAULT ?
+					"Translations mismatch" : libvm_strerror(ret));
+			return EXIT_FAILURE;
+		}
+		return EXIT_SUCCESS;
+	}
+
+	if (spec) {
+		if (argc - optind != 1) {
+			__print_usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+		verbose = false;
+
+		ret = sweep_trace(&config, spec, argv[optind], nr_workers, stdout);
+		if (ret == -LIBVM_EINVAL) {
+			fprintf(stderr, "Invalid sweep specification \"%s\"\n", spec);
+		} else if (ret == -LIBVM_ENOENT) {
+			fprintf(stderr, "No input file %s\n", argv[optind]);
+		} else if (ret) {
+			fprintf(stderr, "%s\n", libvm_strerror(ret));
+		}
+		if (ret) return EXIT_FAILURE;
+		return EXIT_SUCCESS;
+	}
+
+	if (page_size) {
+		const char *path = argv[optind] ? argv[optind] : "-";
+
+		if (argc - optind > 1) {
+			__print_usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+
+		config.interactive = false;
+		if (vm_machine_init(&machine, &config)) {
+			fprintf(stderr, "Out of memory\n");
+			return EXIT_FAILURE;
+		}
+
+		if (restore && !checkpoint_restore(&machine, restore)) {
+			vm_machine_exit(&machine);
+			return EXIT_FAILURE;
+		}
+		if (!ingest_trace(&machine, path, page_size, first_touch)) {
+			fprintf(stderr, "No input file %s\n", path);
+			vm_machine_exit(&machine);
+			return EXIT_FAILURE;
+		}
+
+		vm_machine_exit(&machine);
+		return EXIT_SUCCESS;
+	}
+
+	if (argc - optind > 1 ||
+			(argv[optind] && stat(argv[optind], &st) == 0 && S_ISDIR(st.st_mode))) {
+		replay = true;
+	}
+
+	if (replay) {
+		if (optind == argc) {
+			__print_usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+		verbose = false;
+
+		ret = replay_traces(&config, argv + optind, argc - optind, nr_workers, outdir, stdout);
+		if (ret == -LIBVM_ENOENT) fprintf(stderr, "No trace to replay\n");
+		if (ret) return EXIT_FAILURE;
+		return EXIT_SUCCESS;
+	}
+
+	if (verbose && !argv[optind]) {
+		printf("*******************************************************\n");
+		printf("            V M     S I M U L A T O R\n");
+		printf("\n");
+		printf("                                   >> 2024 Spring <<\n");
+		printf("\n");
+		printf("********************************************************\n");
+	}
+
+	if (argv[optind]) {
+		if (verbose) printf("Use file \"%s\" for input.\n", argv[optind]);
+
+		input = fopen(argv[optind], "r");
+		if (!input) {
+			fprintf(stderr, "No input file %s\n", argv[optind]);
+			return EXIT_FAILURE;
+		}
+		verbose = false;
+	} else {
+		if (verbose) printf("Use stdin for input.\n");
+	}
+
+	config.interactive = verbose;
+	if (vm_machine_init(&machine, &config)) {
+		fprintf(stderr, "Out of memory\n");
+		if (input != stdin) fclose(input);
+		return EXIT_FAILURE;
+	}
+
+	if (restore && !checkpoint_restore(&machine, restore)) {
+		vm_machine_exit(&machine);
+		return EXIT_FAILURE;
+	}
+
+	if (verbose) {
+		printf("Type 'help' or '?' for help.\n\n");
+		printf("%d >> ", machine.current->pid);
+	}
+
+	if (concurrent) {
+		smp_simulate(&machine, input);
+	} else {
+		vm_simulate(&machine, input);
+	}
+
+	vm_machine_exit(&machine);
+
+	if (input != stdin) fclose(input);
+
+	return EXIT_SUCCESS;
+}
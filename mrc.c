@@ -0,0 +1,271 @@
+/**********************************************************************
+ * Copyright (c) 2019-2024
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "mrc.h"
+
+#define MRC_HASH_BITS	24
+#define MRC_INIT_TIMES	1024
+#define MRC_INIT_SLOTS	256
+
+static uint64_t __hash(uint64_t key)
+{
+	/* splitmix64 finalizer */
+	key ^= key >> 30;
+	key *= 0xbf58476d1ce4e5b9ULL;
+	key ^= key >> 27;
+	key *= 0x94d049bb133111ebULL;
+	key ^= key >> 31;
+	return key;
+}
+
+static void __tree_add(struct mrc *m, unsigned long time, int value)
+{
+	for (; time <= m->nr_times; time += time & -time) {
+		m->tree[time] += value;
+	}
+}
+
+/* Sum over [1, @time] */
+static unsigned long __tree_sum(struct mrc *m, unsigned long time)
+{
+	unsigned long sum = 0;
+
+	for (; time; time -= time & -time) {
+		sum += m->tree[time];
+	}
+	return sum;
+}
+
+static struct mrc_slot *__lookup_slot(struct mrc *m, uint64_t key)
+{
+	unsigned long i = __hash(key) & (m->nr_slots - 1);
+
+	while (m->slots[i].time && m->slots[i].key != key) {
+		i = (i + 1) & (m->nr_slots - 1);
+	}
+	return m->slots + i;
+}
+
+static void __grow_slots(struct mrc *m)
+{
+	struct mrc_slot *old = m->slots;
+	unsigned long nr_old = m->nr_slots;
+
+	m->nr_slots *= 2;
+	m->slots = calloc(m->nr_slots, sizeof(*m->slots));
+
+	for (unsigned long i = 0; i < nr_old; i++) {
+		if (old[i].time) *__lookup_slot(m, old[i].key) = old[i];
+	}
+	free(old);
+}
+
+static int __compare_time(const void *a, const void *b)
+{
+	const struct mrc_slot *x = *(const struct mrc_slot **)a;
+	const struct mrc_slot *y = *(const struct mrc_slot **)b;
+
+	return (x->time > y->time) - (x->time < y->time);
+}
+
+/**
+ * __renumber_times(@m)
+ *
+ * DESCRIPTION
+ *   The access times run out. Only the order of the last access times
+ *   matters, so renumber them to 1, 2, ... in the order, and rebuild the tree
+ *   with room for as many accesses again. This keeps the tree proportional to
+ *   the number of distinct pages rather than to the length of the trace.
+ */
+static void __renumber_times(struct mrc *m)
+{
+	struct mrc_slot **live = malloc(sizeof(*live) * (m->nr_pages + 1));
+	unsigned long nr_live = 0;
+
+	for (unsigned long i = 0; i < m->nr_slots; i++) {
+		if (m->slots[i].time) live[nr_live++] = m->slots + i;
+	}
+	qsort(live, nr_live, sizeof(*live), __compare_time);
+
+	m->nr_times = nr_live * 2 > MRC_INIT_TIMES ? nr_live * 2 : MRC_INIT_TIMES;
+	free(m->tree);
+	m->tree = calloc(m->nr_times + 1, sizeof(*m->tree));
+
+	for (unsigned long i = 0; i < nr_live; i++) {
+		live[i]->time = i + 1;
+		__tree_add(m, i + 1, 1);
+	}
+	m->clock = nr_live;
+
+	free(live);
+}
+
+static void __record_distance(struct mrc *m, unsigned long distance)
+{
+	if (distance >= m->nr_distances) {
+		unsigned long nr = m->nr_distances;
+
+		while (nr <= distance) nr *= 2;
+		m->histogram = realloc(m->histogram, sizeof(*m->histogram) * nr);
+		memset(m->histogram + m->nr_distances, 0x00,
+				sizeof(*m->histogram) * (nr - m->nr_distances));
+		m->nr_distances = nr;
+	}
+	m->histogram[distance]++;
+}
+
+/**
+ * mrc_init(@m, @rate)
+ *
+ * DESCRIPTION
+ *   Initialize the analyzer @m to sample the pages at @rate (0.0 - 1.0].
+ *   Pages are sampled by the hash of their keys as in SHARDS, so a sampled
+ *   page is sampled on every access, and the stack distances observed among
+ *   them are scaled by 1 / @rate.
+ *
+ * RETURN
+ *   @true on success, @false if out of memory
+ */
+bool mrc_init(struct mrc *m, double rate)
+{
+	memset(m, 0x00, sizeof(*m));
+
+	assert(rate > 0.0 && rate <= 1.0);
+
+	m->rate = rate;
+	m->threshold = (uint64_t)(rate * (1ULL << MRC_HASH_BITS));
+
+	m->nr_times = MRC_INIT_TIMES;
+	m->tree = calloc(m->nr_times + 1, sizeof(*m->tree));
+
+	m->nr_distances = 64;
+	m->histogram = calloc(m->nr_distances, sizeof(*m->histogram));
+
+	m->nr_slots = MRC_INIT_SLOTS;
+	m->slots = calloc(m->nr_slots, sizeof(*m->slots));
+
+	if (!m->tree || !m->histogram || !m->slots) {
+		mrc_exit(m);
+		return false;
+	}
+	return true;
+}
+
+void mrc_exit(struct mrc *m)
+{
+	free(m->tree);
+	free(m->histogram);
+	free(m->slots);
+	memset(m, 0x00, sizeof(*m));
+}
+
+/**
+ * mrc_access(@m, @asid, @tag)
+ *
+ * DESCRIPTION
+ *   Account an access to the page @tag of the address space @asid. The TLB
+ *   is assumed to be tagged with @asid, so the pages of different address
+ *   spaces are distinct. It takes O(log n) for n distinct pages sampled.
+ */
+void mrc_access(struct mrc *m, unsigned int asid, unsigned int tag)
+{
+	uint64_t key = ((uint64_t)asid << 32) | tag;
+	struct mrc_slot *slot;
+
+	m->nr_accesses++;
+
+	if ((__hash(key) >> (64 - MRC_HASH_BITS)) >= m->threshold) return;
+
+	m->nr_sampled++;
+
+	if (m->clock == m->nr_times) __renumber_times(m);
+
+	slot = __lookup_slot(m, key);
+	if (slot->time) {
+		/* Distinct pages accessed since the last access to this page */
+		unsigned long distance = __tree_sum(m, m->clock) - __tree_sum(m, slot->time);
+
+		__record_distance(m, distance / m->rate);
+		__tree_add(m, slot->time, -1);
+	} else {
+		m->nr_cold++;
+		m->nr_pages++;
+		slot->key = key;
+	}
+
+	slot->time = ++m->clock;
+	__tree_add(m, slot->time, 1);
+
+	if (m->nr_pages * 2 > m->nr_slots) __grow_slots(m);
+}
+
+/**
+ * mrc_miss_ratio(@m, @nr_entries)
+ *
+ * RETURN
+ *   The miss ratio of a fully associative LRU TLB with @nr_entries entries.
+ *   An access with the stack distance d hits when d < @nr_entries.
+ */
+double mrc_miss_ratio(struct mrc *m, unsigned long nr_entries)
+{
+	unsigned long nr_misses = m->nr_cold;
+
+	if (!m->nr_sampled) return 0.0;
+
+	for (unsigned long d = nr_entries; d < m->nr_distances; d++) {
+		nr_misses += m->histogram[d];
+	}
+	return (double)nr_misses / m->nr_sampled;
+}
+
+/**
+ * mrc_show(@m, @out)
+ *
+ * DESCRIPTION
+ *   Print the miss-ratio curve, one TLB size per line, from 1 entry up to
+ *   the size from which only the cold misses remain. Lines start with '#'
+ *   are comments, so the output can be fed to plotting tools as it is.
+ */
+void mrc_show(struct mrc *m, FILE *out)
+{
+	unsigned long max = 0;
+	unsigned long nr_misses = m->nr_cold;
+	unsigned long last;
+
+	for (unsigned long d = 0; d < m->nr_distances; d++) {
+		if (m->histogram[d]) max = d + 1;
+		nr_misses += m->histogram[d];
+	}
+
+	fprintf(out, "# TLB miss-ratio curve (fully associative, LRU, ASID-tagged)\n");
+	fprintf(out, "# %lu accesses, %lu sampled at %.3f, %lu pages, %lu cold misses\n",
+			m->nr_accesses, m->nr_sampled, m->rate,
+			(unsigned long)(m->nr_pages / m->rate), (unsigned long)(m->nr_cold / m->rate));
+	fprintf(out, "# entries  miss-ratio\n");
+
+	/* Accumulate from the small sizes, instead of calling mrc_miss_ratio() */
+	last = max ? max : 1;
+	for (unsigned long entries = 1; entries <= last; entries++) {
+		nr_misses -= m->histogram[entries - 1];
+		fprintf(out, "%9lu  %.4f\n", entries,
+				m->nr_sampled ? (double)nr_misses / m->nr_sampled : 0.0);
+	}
+	fprintf(out, "\n");
+}
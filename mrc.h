@@ -0,0 +1,69 @@
+/**********************************************************************
+ * Copyright (c) 2019-2024
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+#ifndef __MRC_H__
+#define __MRC_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Last access time of a page, keyed by its ASID and tag
+ */
+struct mrc_slot {
+	uint64_t key;
+	unsigned long time;		/* 0 if the slot is empty */
+};
+
+/**
+ * Stack distance analyzer to build the miss-ratio curve of a fully
+ * associative LRU TLB for all sizes at once.
+ */
+struct mrc {
+	/* Sample pages whose hash is below @threshold out of 2^MRC_HASH_BITS */
+	double rate;
+	uint64_t threshold;
+
+	unsigned long nr_accesses;		/* Accesses seen */
+	unsigned long nr_sampled;		/* Accesses to the sampled pages */
+	unsigned long nr_cold;			/* Sampled first accesses */
+
+	/**
+	 * Fenwick tree over the access times, holding 1 at the last access time
+	 * of each page. The number of distinct pages accessed after time t is
+	 * then a range sum over (t, @clock].
+	 */
+	unsigned int *tree;
+	unsigned long nr_times;
+	unsigned long clock;
+
+	/* Histogram of the (scaled) stack distances */
+	unsigned long *histogram;
+	unsigned long nr_distances;
+
+	/* Open addressing hash table of the pages seen */
+	struct mrc_slot *slots;
+	unsigned long nr_slots;
+	unsigned long nr_pages;
+};
+
+bool mrc_init(struct mrc *m, double rate);
+void mrc_exit(struct mrc *m);
+
+void mrc_access(struct mrc *m, unsigned int asid, unsigned int tag);
+double mrc_miss_ratio(struct mrc *m, unsigned long nr_entries);
+void mrc_show(struct mrc *m, FILE *out);
+
+#endif
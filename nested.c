@@ -0,0 +1,164 @@
+/**********************************************************************
+ * Copyright (c) 2019-2024
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "list_head.h"
+#include "vm.h"
+#include "nested.h"
+
+void nested_init(struct nested *nested)
+{
+	memset(nested, 0x00, sizeof(*nested));
+
+	/* Keep the zero frame off the allocation */
+	nested->nr_frames = NESTED_ZERO_PFN + 1;
+}
+
+void nested_exit(struct nested *nested)
+{
+	for (unsigned int i = 0; i < nested->nr_pdes; i++) {
+		free(nested->pdes[i]);
+	}
+	free(nested->pdes);
+	free(nested->huge);
+}
+
+/**
+ * __grow(@nested, @pd_index)
+ *
+ * DESCRIPTION
+ *   Extend the host page directory to cover the slot @pd_index.
+ */
+static void __grow(struct nested *nested, unsigned int pd_index)
+{
+	unsigned int nr_pdes = nested->nr_pdes ? nested->nr_pdes : NR_PDES_PER_PAGE;
+
+	if (pd_index < nested->nr_pdes) return;
+
+	while (nr_pdes <= pd_index) nr_pdes <<= 1;
+
+	nested->pdes = realloc(nested->pdes, nr_pdes * sizeof(*nested->pdes));
+	nested->huge = realloc(nested->huge, nr_pdes * sizeof(*nested->huge));
+	memset(nested->pdes + nested->nr_pdes, 0x00,
+			(nr_pdes - nested->nr_pdes) * sizeof(*nested->pdes));
+	memset(nested->huge + nested->nr_pdes, 0x00,
+			(nr_pdes - nested->nr_pdes) * sizeof(*nested->huge));
+	nested->nr_pdes = nr_pdes;
+}
+
+/**
+ * __flush_zero(@vm)
+ *
+ * DESCRIPTION
+ *   Invalidate the TLB entries translating to the host zero frame on all the
+ *   CPUs, as the host does not track which guest pages they were cached for.
+ */
+static void __flush_zero(struct vm_machine *vm)
+{
+	for (unsigned int i = 0; i < vm->config.nr_cpus; i++) {
+		for (unsigned int j = 0; j < vm->config.nr_tlb_entries; j++) {
+			struct tlb_entry *t = vm->cpus[i].tlb + j;
+
+			if (!t->valid || t->huge || t->pfn != NESTED_ZERO_PFN) continue;
+
+			vm_tlb_invalidate(vm, t);
+		}
+	}
+}
+
+/**
+ * nested_handle_fault(@vm, @gpfn, @rw)
+ *
+ * DESCRIPTION
+ *   Handle the exit of the guest on a host translation fault on the guest
+ *   frame @gpfn for @rw. With the host huge pages, the aligned guest frames
+ *   around @gpfn are backed by contiguous host frames at once. Otherwise, a
+ *   read maps the host zero frame read-only, and a write maps a zero-filled
+ *   host frame, breaking the copy-on-write of the zero frame if mapped. The
+ *   guest frames holding the guest page tables are always backed writable,
+ *   as the guest has written them on building the tables.
+ */
+void nested_handle_fault(struct vm_machine *vm, unsigned int gpfn, unsigned int rw)
+{
+	struct nested *nested = &vm->nested;
+	unsigned int pd_index = gpfn / NR_PTES_PER_PAGE;
+	struct pte *pte;
+
+	vm->stats.nr_host_faults++;
+	vm_charge(vm, COST_FAULT, 1);
+
+	__grow(nested, pd_index);
+
+	if (vm->config.use_nested_huge) {
+		pte = &nested->huge[pd_index];
+		assert(!pte_valid(pte));
+
+		/* Align up the host frames as well */
+		nested->nr_frames = (nested->nr_frames + NR_PAGES_PER_HUGE - 1) &
+				~(NR_PAGES_PER_HUGE - 1);
+		pte_set(pte, nested->nr_frames, ACCESS_READ | ACCESS_WRITE);
+		nested->nr_frames += NR_PAGES_PER_HUGE;
+		vm_charge(vm, COST_ZERO, NR_PAGES_PER_HUGE);
+		return;
+	}
+
+	if (!nested->pdes[pd_index]) {
+		nested->pdes[pd_index] = calloc(1, sizeof(struct pte_directory));
+	}
+	pte = &nested->pdes[pd_index]->ptes[gpfn % NR_PTES_PER_PAGE];
+
+	if (!(rw & ACCESS_WRITE) && gpfn < vm->config.nr_pageframes) {
+		assert(!pte_valid(pte));
+
+		pte_set(pte, NESTED_ZERO_PFN, ACCESS_READ);
+		return;
+	}
+
+	if (pte_valid(pte)) {
+		assert(pte_pfn(pte) == NESTED_ZERO_PFN);
+		vm->stats.nr_host_cows++;
+		__flush_zero(vm);
+	}
+	pte_set(pte, nested->nr_frames++, ACCESS_READ | ACCESS_WRITE);
+	vm_charge(vm, COST_ZERO, 1);
+}
+
+/**
+ * nested_show(@vm, @out)
+ *
+ * DESCRIPTION
+ *   Report the cost of the two-dimensional walks; the guest and the host
+ *   page table entries read per walk and per TLB miss, and the host faults.
+ */
+void nested_show(struct vm_machine *vm, FILE *out)
+{
+	unsigned long nr_refs = vm->stats.nr_walk_refs + vm->stats.nr_host_walk_refs;
+
+	fprintf(out, "nested       : %lu guest + %lu host entries read, %.2f per walk",
+			vm->stats.nr_walk_refs, vm->stats.nr_host_walk_refs,
+			vm->stats.nr_walks ? (double)nr_refs / vm->stats.nr_walks : 0.0);
+	if (vm->config.use_tlb) {
+		fprintf(out, ", %.2f per tlb miss",
+				vm->stats.nr_tlb_misses ? (double)nr_refs / vm->stats.nr_tlb_misses : 0.0);
+	}
+	fprintf(out, "\n");
+	fprintf(out, "  host       : %lu faults (%lu copied on write), %u frames, %s pages\n",
+			vm->stats.nr_host_faults, vm->stats.nr_host_cows, vm->nested.nr_frames,
+			vm->config.use_nested_huge ? "huge" : "base");
+}
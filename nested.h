@@ -0,0 +1,62 @@
+/**********************************************************************
+ * Copyright (c) 2019-2024
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+#ifndef __NESTED_H__
+#define __NESTED_H__
+
+#include <stdio.h>
+#include <stdbool.h>
+
+struct vm_machine;
+struct pte;
+struct pte_directory;
+
+/* Host frame backing the guest frames that have been read but not written */
+#define NESTED_ZERO_PFN		0
+
+/**
+ * Host physical addresses of the host page directory and the host
+ * pte_directories, for the cache model. Far past the host frames.
+ */
+#define NESTED_PD_PADDR		(1UL << 41)
+#define NESTED_PTE_PADDR	(1UL << 42)
+
+/**
+ * Host side of a virtualized system. The guest runs the processes on the
+ * guest frames as usual, and the host maps the guest frames to the host
+ * frames with its own 2-level page table, indexed by the guest pfn. The
+ * guest page tables themselves sit in the guest frames past the data
+ * frames, so the MMU walks the host page table for them as well.
+ */
+struct nested {
+	/**
+	 * Host page directory, grown on demand to cover the guest frames
+	 * touched. When huge[i] is valid, it maps NR_PAGES_PER_HUGE guest frames
+	 * from huge[i].pfn, and pdes[i] must be NULL.
+	 */
+	struct pte_directory **pdes;
+	struct pte *huge;
+	unsigned int nr_pdes;
+
+	/* Host frames handed out so far. The host memory is not bounded */
+	unsigned int nr_frames;
+};
+
+void nested_init(struct nested *nested);
+void nested_exit(struct nested *nested);
+
+void nested_handle_fault(struct vm_machine *vm, unsigned int gpfn, unsigned int rw);
+void nested_show(struct vm_machine *vm, FILE *out);
+
+#endif
@@ -0,0 +1,205 @@
+/**********************************************************************
+ * Copyright (c) 2019-2024
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "list_head.h"
+#include "vm.h"
+#include "buddy.h"
+#include "compact.h"
+#include "numa.h"
+
+static const char * const policy_names[] = {
+	[NUMA_FIRST_TOUCH] = "first-touch",
+	[NUMA_INTERLEAVE] = "interleave",
+	[NUMA_BIND] = "bind",
+	[NUMA_PREFERRED] = "preferred",
+};
+
+bool numa_parse_policy(const char *str, enum numa_policy *policy)
+{
+	for (unsigned int i = 0; i < sizeof(policy_names) / sizeof(*policy_names); i++) {
+		if (strcmp(str, policy_names[i]) == 0) {
+			*policy = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+const char *numa_policy_name(enum numa_policy policy)
+{
+	return policy_names[policy];
+}
+
+/**
+ * numa_node_start(@vm, @node)
+ *
+ * DESCRIPTION
+ *   The frames are split into @vm->config.nr_nodes contiguous ranges of
+ *   (almost) the same size, one for each node. Node @node has the frames
+ *   [numa_node_start(@node), numa_node_start(@node + 1)).
+ */
+unsigned int numa_node_start(struct vm_machine *vm, unsigned int node)
+{
+	return node * vm->config.nr_pageframes / vm->config.nr_nodes;
+}
+
+/**
+ * numa_node_of(@vm, @pfn)
+ *
+ * RETURN
+ *   The node having the frame @pfn
+ */
+unsigned int numa_node_of(struct vm_machine *vm, unsigned int pfn)
+{
+	return ((pfn + 1) * vm->config.nr_nodes - 1) / vm->config.nr_pageframes;
+}
+
+/**
+ * numa_cpu_node(@vm, @cpu)
+ *
+ * DESCRIPTION
+ *   The CPUs are spread over the nodes in contiguous groups, like the
+ *   sockets of a multi-socket machine.
+ *
+ * RETURN
+ *   The home node of @cpu
+ */
+unsigned int numa_cpu_node(struct vm_machine *vm, unsigned int cpu)
+{
+	return cpu * vm->config.nr_nodes / vm->config.nr_cpus;
+}
+
+static unsigned int __alloc_on(struct vm_machine *vm, struct buddy *zone, unsigned int node)
+{
+	return buddy_alloc_range(zone, numa_node_start(vm, node), numa_node_start(vm, node + 1));
+}
+
+/**
+ * numa_alloc(@vm, @zone)
+ *
+ * DESCRIPTION
+ *   Allocate a free frame from @zone for the @current process, on the node
+ *   chosen by its memory policy. The frame with the smallest pfn on the node
+ *   is taken. The first-touch, interleave, and preferred policies fall back
+ *   to the next nodes in turn when the node is full, while bind does not.
+ *
+ * RETURN
+ *   The pfn of the frame, or -1 if no frame is available under the policy
+ */
+unsigned int numa_alloc(struct vm_machine *vm, struct buddy *zone)
+{
+	struct mempolicy *pol = &vm->current->mempolicy;
+	unsigned int node = pol->node >= 0 ? pol->node : numa_cpu_node(vm, vm->cpu);
+	unsigned int pfn = -1;
+
+	switch (pol->mode) {
+	case NUMA_FIRST_TOUCH:
+		node = numa_cpu_node(vm, vm->cpu);
+		break;
+	case NUMA_INTERLEAVE:
+		/* Threads of the process may be allocating concurrently */
+		node = __atomic_fetch_add(&pol->next, 1, __ATOMIC_RELAXED) % vm->config.nr_nodes;
+		break;
+	case NUMA_BIND:
+		return __alloc_on(vm, zone, node);
+	case NUMA_PREFERRED:
+		break;
+	}
+
+	for (unsigned int i = 0; i < vm->config.nr_nodes && pfn == -1; i++) {
+		pfn = __alloc_on(vm, zone, (node + i) % vm->config.nr_nodes);
+	}
+	return pfn;
+}
+
+/**
+ * numa_migrate(@vm, @vpn, @node)
+ *
+ * DESCRIPTION
+ *   Move the page at @vpn of the @current process to a free frame on @node.
+ *   The frame is remapped in every process sharing it. The zero page and
+ *   the frames of huge pages are not migrated.
+ *
+ * RETURN
+ *   @true if the page is on @node now
+ */
+bool numa_migrate(struct vm_machine *vm, unsigned int vpn, unsigned int node)
+{
+	struct pagetable *pt = &vm->current->pagetable;
+	struct pte_directory *pd = pt->pdes[vpn / NR_PTES_PER_PAGE];
+	struct pte *pte = pd ? &pd->ptes[vpn % NR_PTES_PER_PAGE] : NULL;
+	unsigned int from, to;
+
+	if (node >= vm->config.nr_nodes) {
+		fprintf(vm->out, "No node %u\n", node);
+		return false;
+	}
+	if (pte_valid(&pt->huge[vpn / NR_PTES_PER_PAGE])) {
+		fprintf(vm->out, "%u is in a huge page\n", vpn);
+		return false;
+	}
+	if (!pte || !pte_valid(pte)) {
+		fprintf(vm->out, "%u is not allocated\n", vpn);
+		return false;
+	}
+
+	from = pte_pfn(pte);
+	if (numa_node_of(vm, from) == node) return true;
+	if (!is_movable_page(vm, from)) {
+		fprintf(vm->out, "%u cannot be migrated\n", vpn);
+		return false;
+	}
+
+	to = __alloc_on(vm, &vm->zone, node);
+	if (to == -1) {
+		fprintf(vm->out, "node %u is full\n", node);
+		return false;
+	}
+
+	migrate_page(vm, from, to);
+	vm->stats.nr_numa_migrations++;
+
+	fprintf(vm->out, "migrate %u: %u (node %u) --> %u (node %u)\n",
+			vpn, from, numa_node_of(vm, from), to, node);
+	return true;
+}
+
+/**
+ * numa_show(@vm, @out)
+ *
+ * DESCRIPTION
+ *   Report the local and remote accesses, and the frames of each node.
+ */
+void numa_show(struct vm_machine *vm, FILE *out)
+{
+	unsigned long nr_accesses = vm->stats.nr_numa_local + vm->stats.nr_numa_remote;
+
+	fprintf(out, "numa         : %lu local, %lu remote (%.2f%% remote), %lu migrated\n",
+			vm->stats.nr_numa_local, vm->stats.nr_numa_remote,
+			nr_accesses ? vm->stats.nr_numa_remote * 100.0 / nr_accesses : 0.0,
+			vm->stats.nr_numa_migrations);
+
+	for (unsigned int i = 0; i < vm->config.nr_nodes; i++) {
+		unsigned int start = numa_node_start(vm, i);
+		unsigned int end = numa_node_start(vm, i + 1);
+
+		fprintf(out, "  node %-3u   : frames %u - %u, %u free\n", i, start, end - 1,
+				buddy_nr_free_range(&vm->zone, start, end));
+	}
+}
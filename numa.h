@@ -0,0 +1,54 @@
+/**********************************************************************
+ * Copyright (c) 2019-2024
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+#ifndef __NUMA_H__
+#define __NUMA_H__
+
+#include <stdio.h>
+#include <stdbool.h>
+
+/* Maximum number of memory nodes */
+#define MAX_NODES	16
+
+/**
+ * Placement policies for the page frames of a process
+ */
+enum numa_policy {
+	NUMA_FIRST_TOUCH,	/* On the node of the CPU allocating the page */
+	NUMA_INTERLEAVE,	/* Round-robin over the nodes */
+	NUMA_BIND,			/* Only on the node */
+	NUMA_PREFERRED,		/* On the node if possible, elsewhere otherwise */
+};
+
+struct mempolicy {
+	enum numa_policy mode;
+	int node;			/* For bind and preferred. -1 for the node of the CPU */
+	unsigned int next;	/* Next node to interleave */
+};
+
+struct vm_machine;
+struct buddy;
+
+bool numa_parse_policy(const char *str, enum numa_policy *policy);
+const char *numa_policy_name(enum numa_policy policy);
+
+unsigned int numa_node_start(struct vm_machine *vm, unsigned int node);
+unsigned int numa_node_of(struct vm_machine *vm, unsigned int pfn);
+unsigned int numa_cpu_node(struct vm_machine *vm, unsigned int cpu);
+
+unsigned int numa_alloc(struct vm_machine *vm, struct buddy *zone);
+bool numa_migrate(struct vm_machine *vm, unsigned int vpn, unsigned int node);
+void numa_show(struct vm_machine *vm, FILE *out);
+
+#endif
@@ -18,117 +18,305 @@
 
 #include "list_head.h"
 #include "vm.h"
+#include "buddy.h"
+#include "compact.h"
 
 /**
- * Ready queue of the system
+ * __tlb_set(@vm, @vpn, @huge)
+ *
+ * DESCRIPTION
+ *   Huge entries are indexed by the huge page number so that all the pages
+ *   covered by a huge entry map to the same set.
+ *
+ * RETURN
+ *   The first entry of the TLB set for @vpn
  */
-extern struct list_head processes;
+static struct tlb_entry *__tlb_set(struct vm_machine *vm, unsigned int vpn, bool huge)
+{
+	unsigned int index = huge ? vpn / NR_PAGES_PER_HUGE : vpn;
 
-/**
- * Currently running process
- */
-extern struct process *current;
+	return vm->tlb + (index % vm->nr_tlb_sets) * vm->config.tlb_ways;
+}
 
 /**
- * Page Table Base Register that MMU will walk through for address translation
+ * __tlb_tag(@vm, @vpn, @huge)
+ *
+ * RETURN
+ *   The tag of the TLB entry for @vpn of the current process, or for the
+ *   huge page covering it if @huge is set. The pid is the address space ID.
  */
-extern struct pagetable *ptbr; // 밖에서 관리하는 놈
+static uint32_t __tlb_tag(struct vm_machine *vm, unsigned int vpn, bool huge)
+{
+	uint32_t asid = vm->current->pid << TLB_TAG_ASID_SHIFT;
 
-/**
- * TLB of the system.
- */
-extern struct tlb_entry tlb[];
+	return huge ? asid | TLB_TAG_HUGE | vpn / NR_PAGES_PER_HUGE : asid | vpn;
+}
 
-/**
- * The number of mappings for each page frame. Can be used to determine how
- * many processes are using the page frames.
- */
-extern unsigned int mapcounts[];
-// Switch_count
-static int a = 0;
-int switch_cnt()
+static bool __lookup_tlb_set(struct vm_machine *vm, struct tlb_entry *set, unsigned int vpn, unsigned int rw, unsigned int *pfn, bool huge)
 {
-	a++;
-	return a;
+	struct tlb_entry *t;
+	int i;
+
+	/* Compare the tags of all the ways at once */
+	i = tlb_search(vm->tlb_tags, vm->tlb_valid, vm_tlb_index(vm, set),
+			vm->config.tlb_ways, __tlb_tag(vm, vpn, huge));
+	if (i < 0)
+	{
+		return false;
+	}
+	t = set + i;
+
+	/**
+	 * Write to a read-only (or copy-on-write) entry should miss so that
+	 * the MMU walks the page table and raises the fault.
+	 */
+	if ((rw & ACCESS_WRITE) && !(t->rw & ACCESS_WRITE))
+	{
+		return false;
+	}
+	*pfn = t->pfn + (vpn - t->vpn);
+
+	/* The first hit on each page of a huge entry is a miss saved */
+	if (t->huge && !(t->touched & (1 << (vpn - t->vpn))))
+	{
+		t->touched |= 1 << (vpn - t->vpn);
+		vm->stats.nr_huge_tlb_saves++;
+	}
+	if (vm->config.tlb_policy == TLB_POLICY_LRU)
+	{
+		t->stamp = vm->tlb_clock;
+	}
+	return true;
 }
 
 /**
- * lookup_tlb(@vpn, @rw, @pfn)
+ * lookup_tlb(@vm, @vpn, @rw, @pfn)
  *
  * DESCRIPTION
  *   Translate @vpn of the current process through TLB. DO NOT make your own
  *   data structure for TLB, but should use the defined @tlb data structure
  *   to translate. If the requested VPN exists in the TLB and it has the same
  *   rw flag, return true with @pfn is set to its PFN. Otherwise, return false.
- *   The framework calls this function when needed, so do not call
+ *   Both the set for @vpn and the set for the huge page covering it are
+ *   looked up. The framework calls this function when needed, so do not call
  *   this function manually.
  *
  * RETURN
  *   Return true if the translation is cached in the TLB.
  *   Return false otherwise
  */
-bool lookup_tlb(unsigned int vpn, unsigned int rw, unsigned int *pfn)
+bool lookup_tlb(struct vm_machine *vm, unsigned int vpn, unsigned int rw, unsigned int *pfn)
 {
-	for (int i = 0; i < NR_TLB_ENTRIES; i++)
-	{
-		struct tlb_entry *t = tlb + i; // tlb_entrt의 i번째
+	struct tlb_entry *set = __tlb_set(vm, vpn, false);
+	struct tlb_entry *huge_set = __tlb_set(vm, vpn, true);
 
-		if (!t->valid || t->vpn != vpn) //1. cold miss 2. 히트 or miss
-		{	
-			
-			continue;
-		}
+	vm->tlb_clock++;
 
-		else // hit가 되면 정보를 바꾼다 x -> o 로 
-		{	
+	if (__lookup_tlb_set(vm, set, vpn, rw, pfn, false)) return true;
 
-			if (rw == ACCESS_WRITE)
-			{
-				rw += 0x01;
-			}
-			t->rw = rw;
-			*pfn = t->pfn;
-			return true;
-		}
+	return __lookup_tlb_set(vm, huge_set, vpn, rw, pfn, true);
+}
+
+/**
+ * __tlb_victim(@vm, @set)
+ *
+ * RETURN
+ *   The entry in the full @set to replace according to the replacement policy
+ */
+static struct tlb_entry *__tlb_victim(struct vm_machine *vm, struct tlb_entry *set)
+{
+	struct tlb_entry *victim = set;
 
+	if (vm->config.tlb_policy == TLB_POLICY_RANDOM)
+	{
+		/* xorshift, so that runs are reproducible */
+		vm->tlb_seed ^= vm->tlb_seed << 13;
+		vm->tlb_seed ^= vm->tlb_seed >> 17;
+		vm->tlb_seed ^= vm->tlb_seed << 5;
+		return set + vm->tlb_seed % vm->config.tlb_ways;
 	}
-	
 
-	return false;
+	/**
+	 * Both LRU and FIFO evict the one with the oldest stamp. The stamps
+	 * wrap around, so compare their ages from the clock.
+	 */
+	for (int i = 1; i < vm->config.tlb_ways; i++)
+	{
+		if ((uint32_t)(vm->tlb_clock - set[i].stamp) >
+				(uint32_t)(vm->tlb_clock - victim->stamp)) victim = set + i;
+	}
+	return victim;
 }
 
 /**
- * insert_tlb(@vpn, @rw, @pfn)
+ * insert_tlb(@vm, @vpn, @rw, @pfn, @huge)
  *
  * DESCRIPTION
  *   Insert the mapping from @vpn to @pfn for @rw into the TLB. The framework will
  *   call this function when required, so no need to call this function manually.
  *   Note that if there exists an entry for @vpn already, just update it accordingly
  *   rather than removing it or creating a new entry.
- *   Also, in the current simulator, TLB is big enough to cache all the entries of
- *   the current page table, so don't worry about TLB entry eviction. ;-)
+ *   When @huge is set, the entry maps the whole huge page containing @vpn to
+ *   the contiguous frames around @pfn.
+ *   When the set for @vpn is full, an entry in the set is evicted according
+ *   to @vm->config.tlb_policy.
  */
-void insert_tlb(unsigned int vpn, unsigned int rw, unsigned int pfn)
+void insert_tlb(struct vm_machine *vm, unsigned int vpn, unsigned int rw, unsigned int pfn, bool huge)
 {
-	// 이미 tlb는 존재하니깐 까불지 말고 제데로 update만 시키켜라
-	// tlb는 굳이 pagetable까지 안가고 그냥 tlb를 통해서 해결하는 것이다.
-	for (int i = 0; i < NR_TLB_ENTRIES; i++)
+	struct tlb_entry *set;
+	struct tlb_entry *slot = NULL;
+	unsigned int touched = 0;
+	bool replaced = false;
+	uint32_t tag = __tlb_tag(vm, vpn, huge);
+	int i;
+
+	if (huge)
 	{
-		struct tlb_entry *t = tlb + i; // tlb[i]
+		unsigned int offset = vpn % NR_PAGES_PER_HUGE;
+
+		vpn -= offset;
+		pfn -= offset;
+		touched = 1 << offset;
+	}
+	set = __tlb_set(vm, vpn, huge);
 
-		if (t->valid == 0)// tlb공간에 사용되는 vpn, pfn을 넣어 놓는다.(hit,miss날지는 모름)
+	// 이미 tlb는 존재하니깐 까불지 말고 제데로 update만 시키켜라
+	i = tlb_search(vm->tlb_tags, vm->tlb_valid, vm_tlb_index(vm, set), vm->config.tlb_ways, tag);
+	if (i >= 0)
+	{
+		slot = set + i;
+	}
+	else
+	{
+		i = tlb_search_invalid(vm->tlb_valid, vm_tlb_index(vm, set), vm->config.tlb_ways);
+		if (i >= 0)
 		{
-			t->valid = 1;
-			t->vpn = vpn;
-			t->pfn = pfn;
-			t->rw = rw; //이놈을 안썻다
-			break;
+			slot = set + i;
+			slot->touched = 0;
+			replaced = true;
 		}
 	}
+	if (!slot)
+	{
+		slot = __tlb_victim(vm, set);
+		slot->touched = 0;
+		replaced = true;
+		vm->stats.nr_tlb_evictions++;
+	}
+	if (replaced || vm->config.tlb_policy == TLB_POLICY_LRU)
+	{
+		slot->stamp = ++vm->tlb_clock;
+	}
+
+	slot->valid = 1;
+	slot->huge = huge;
+	slot->touched |= touched;
+	slot->vpn = vpn;
+	slot->pfn = pfn;
+	slot->rw = rw;
+	tlb_index_set(vm->tlb_tags, vm->tlb_valid, vm_tlb_index(vm, slot), tag);
+}
+
+/**
+ * __get_free_pfn(@vm)
+ *
+ * DESCRIPTION
+ *   Allocate the free page frame with the smallest pfn and take a reference
+ *   on it. CPUs executing concurrently take one from their frame caches.
+ *
+ * RETURN
+ *   Return the pfn of the frame, or -1 if all page frames are in use.
+ */
+static unsigned int __get_free_pfn(struct vm_machine *vm)
+{
+	unsigned int pfn = get_page_frame(vm);
+
+	if (pfn == -1) return -1;
+
+	vm->mapcounts[pfn] = 1;
+	return pfn;
+}
+
+/**
+ * __get_free_huge_pfn(@vm)
+ *
+ * DESCRIPTION
+ *   Allocate NR_PAGES_PER_HUGE free page frames that are contiguous and
+ *   aligned to the huge page size, and take a reference on each of them.
+ *   The memory may get compacted to make room for them. The frames may be freed one by one after the huge page is split.
+ *
+ * RETURN
+ *   Return the first pfn of the frames, or -1 if no such frames are available.
+ */
+static unsigned int __get_free_huge_pfn(struct vm_machine *vm)
+{
+	unsigned int pfn = compact_alloc(vm, HUGE_PAGE_ORDER);
+
+	if (pfn == -1) return -1;
+
+	buddy_split(&vm->zone, pfn);
+	for (unsigned int i = 0; i < NR_PAGES_PER_HUGE; i++)
+	{
+		vm->mapcounts[pfn + i] = 1;
+	}
+	return pfn;
+}
+
+/**
+ * __put_pfn(@vm, @pfn)
+ *
+ * DESCRIPTION
+ *   Drop a mapping to @pfn, and free the frame when no mapping is left. The
+ *   frame may be shared with processes running on other CPUs concurrently,
+ *   so the mapcount is dropped atomically.
+ */
+static void __put_pfn(struct vm_machine *vm, unsigned int pfn)
+{
+	if (__atomic_sub_fetch(&vm->mapcounts[pfn], 1, __ATOMIC_ACQ_REL) == 0)
+	{
+		put_page_frame(vm, pfn);
+	}
+}
+
+static unsigned int __mapcount(struct vm_machine *vm, unsigned int pfn)
+{
+	return __atomic_load_n(&vm->mapcounts[pfn], __ATOMIC_ACQUIRE);
 }
 
 /**
- * alloc_page(@vpn, @rw)
+ * __split_huge_page(@vm, @pt, @pd_index)
+ *
+ * DESCRIPTION
+ *   Replace the huge mapping at @pd_index of @pt with a page directory whose
+ *   PTEs map the same frames with the same permission. The mapcounts are per
+ *   frame already, so they are not changed.
+ *
+ * RETURN
+ *   Return the new page directory
+ */
+static struct pte_directory *__split_huge_page(struct vm_machine *vm, struct pagetable *pt, int pd_index)
+{
+	struct pte *huge = &pt->huge[pd_index];
+	struct pte_directory *pd = calloc(1, sizeof(*pd));
+
+	for (int i = 0; i < NR_PTES_PER_PAGE; i++)
+	{
+		pte_set(&pd->ptes[i], pte_pfn(huge) + i, pte_rw(huge));
+		pte_set_flag(&pd->ptes[i], PTE_COW, pte_cow(huge));
+	}
+	pt->pdes[pd_index] = pd;
+
+	pte_clear(huge);
+
+	flush_tlb_range(vm, container_of(pt, struct process, pagetable),
+			pd_index * NR_PTES_PER_PAGE, NR_PAGES_PER_HUGE);
+	vm->stats.nr_huge_splits++;
+
+	return pd;
+}
+
+/**
+ * alloc_page(@vm, @vpn, @rw)
  *
  * DESCRIPTION
  *   Allocate a page frame that is not allocated to any process, and map it
@@ -138,91 +326,130 @@ void insert_tlb(unsigned int vpn, unsigned int rw, unsigned int pfn)
  *   is allocated with ACCESS_WRITE flag, the page may be later accessed for writes.
  *   However, the pages populated with ACCESS_READ should not be accessible with
  *   ACCESS_WRITE accesses.
+ *   Other threads of the process may map @vpn first while the CPUs are
+ *   executing concurrently. Then the page is left as they mapped.
  *
  * RETURN
  *   Return allocated page frame number.
  *   Return -1 if all page frames are allocated.
  */
-unsigned int alloc_page(unsigned int vpn, unsigned int rw)
+unsigned int alloc_page(struct vm_machine *vm, unsigned int vpn, unsigned int rw)
 {
-
-	// vpn은 내가 입력하는 숫자
-	// pfn 2-levelv
-	//  어떤 곳에서도 할당되지 않은 pageframe을 가지는 process -> vpn이랑 mapping
 	struct pte *current_pte;					// page table entry -> 16개
-	struct pd *current_pd;						// page directory -> 4개
-	struct pagetable *current_pagetable = ptbr; // page table bases - resgisters
+	struct pagetable *current_pagetable = vm->ptbr; // page table bases - resgisters
 	int pd_index = vpn / NR_PTES_PER_PAGE;		// page를 모아놓은 것들 index ,an index into the page table = vpn
 	int pte_index = vpn % NR_PTES_PER_PAGE;		// page table entry index
-	static int cnt = 0;
+	unsigned int pfn;
 
-	// pd_index를 일단 먼저 alloc시켜준다. 1. pd_index가 비어있다면(?)
-	if (current_pagetable->pdes[pd_index] == NULL)
+	vm_lock(vm, &current_pagetable->locks[pd_index]);
+
+	if (current_pagetable->pdes[pd_index] &&
+			pte_valid(&current_pagetable->pdes[pd_index]->ptes[pte_index]))
 	{
-		// 16개의 pagetable entry를 malloc해줘야된다.
-		current_pagetable->pdes[pd_index] = malloc(sizeof(struct pagetable) * NR_PTES_PER_PAGE); // 1개당 총 16개의 pde생성
+		pfn = pte_pfn(&current_pagetable->pdes[pd_index]->ptes[pte_index]);
+		goto out;
 	}
 
-	/*여기까지가 1번째줄 */
-	// page table enrty setting
-	current_pte = &current_pagetable->pdes[pd_index]->ptes[pte_index]; // 현재 pte는 pde -> pte[pte_index에 정의]
-	// vaild bit도 바꿔줘야된다. 1 = vaild 0 = invalid
-	current_pte->valid = 1;
-	current_pte->rw = rw;
-	current_pte->private = rw; // read-write fork를 위해서 생성 -> 애를 어떻게 넘겨주지?
-	// rw도 바꿔준다. rw가 write -> write
-	// rw -> 3 ,w -> 3 , r -> 1
-
-	/*여기까지가 2번째 문단.*/
-
-	// 가장 작은 pfn을 찾아야 된다. pfn은 아직 안건드렸다. 가장 작은 pfn을 찾는방법은?
-	// NR_PAGEFRAMES -> 이중에서 찾으면 된다 만약 이 값을 넘는다면? return -1?
-	// 16개당 page128개의 frame? -> 실제 frame갯수가 128개 이것 보다 넘어가면 당연히 return -1;
-	for (int i = 0; i < NR_PAGEFRAMES; i++) // 실제 frame과 mapping시켜주는 과정.
+	/**
+	 * Zero-filled pages are backed by the shared zero page until they get
+	 * written. Map it read-only and mark it copy-on-write if requested for
+	 * write so that the first write goes through copy-on-write.
+	 */
+	if (vm->config.use_zero_page)
 	{
-		if (mapcounts[i] == '\0')
-		{
-			current_pte->pfn = i;
-			// printf("mapcounts[i]1 :%d\n",mapcounts[i]);
-			mapcounts[i]++;
-			// printf("i : %d\n",i);
-			// printf("mapcounts[i]: %d\n",mapcounts[i]);
-			cnt = i;
-			break;
-		}
+		pfn = ZERO_PFN;
+		__atomic_add_fetch(&vm->mapcounts[pfn], 1, __ATOMIC_RELAXED);
+	}
+	else
+	{
+		pfn = __get_free_pfn(vm);
+		if (pfn == -1) goto out;
+		vm_charge(vm, COST_ZERO, 1);
 	}
 
-	if (cnt >= NR_PAGEFRAMES)
+	// pd_index를 일단 먼저 alloc시켜준다. 1. pd_index가 비어있다면(?)
+	if (current_pagetable->pdes[pd_index] == NULL)
 	{
-		return -1;
+		current_pagetable->pdes[pd_index] = calloc(1, sizeof(struct pte_directory));
 	}
 
-	return cnt;
+	// page table enrty setting
+	current_pte = &current_pagetable->pdes[pd_index]->ptes[pte_index]; // 현재 pte는 pde -> pte[pte_index에 정의]
+	pte_set(current_pte, pfn, vm->config.use_zero_page ? ACCESS_READ : rw);
+	pte_set_flag(current_pte, PTE_COW, vm->config.use_zero_page && (rw & ACCESS_WRITE));
+
+out:
+	vm_unlock(vm, &current_pagetable->locks[pd_index]);
+	return pfn;
+}
+
+/**
+ * alloc_huge_page(@vm, @vpn, @rw)
+ *
+ * DESCRIPTION
+ *   Allocate NR_PAGES_PER_HUGE contiguous page frames and map them to
+ *   @vpn, which is aligned to the huge page size, with a single huge mapping
+ *   in the page directory. The framework ensures that no page is mapped in
+ *   the range.
+ *
+ * RETURN
+ *   Return the first page frame number of the huge page.
+ *   Return -1 if no contiguous page frames are available.
+ */
+unsigned int alloc_huge_page(struct vm_machine *vm, unsigned int vpn, unsigned int rw)
+{
+	int pd_index = vpn / NR_PTES_PER_PAGE;
+	struct pte *huge = &vm->ptbr->huge[pd_index];
+	unsigned int pfn;
+
+	pfn = __get_free_huge_pfn(vm);
+	if (pfn == -1) return -1;
+	vm_charge(vm, COST_ZERO, NR_PAGES_PER_HUGE);
+
+	/* Release the page directory left empty by free */
+	flush_pwc(vm, vm->current, pd_index);
+	vm_free(vm, vm->ptbr->pdes[pd_index]);
+	vm->ptbr->pdes[pd_index] = NULL;
+
+	pte_set(huge, pfn, rw);
+
+	return pfn;
 }
 
 /**
- * free_page(@vpn)
+ * free_page(@vm, @vpn)
  *
  * DESCRIPTION
  *   Deallocate the page from the current processor. Make sure that the fields
- *   for the corresponding PTE (valid, rw, pfn) is set @false or 0.
+ *   for the corresponding PTE (valid, rw, pfn) is cleared.
  *   Also, consider the case when a page is shared by two processes,
  *   and one process is about to free the page. Also, think about TLB as well ;-)
  */
 
-void free_page(unsigned int vpn)
+void free_page(struct vm_machine *vm, unsigned int vpn)
 {
 	struct pte *current_pte; // page table entry
-	struct pagetable *current_pagetable = ptbr;
+	struct pagetable *current_pagetable = vm->ptbr;
 	int pd_index = vpn / NR_PTES_PER_PAGE;	// page를 모아놓은 것들 index ,an index into the page table = vpn
 	int pte_index = vpn % NR_PTES_PER_PAGE; // page table entry index
 
+	vm_lock(vm, &current_pagetable->locks[pd_index]);
+
+	/* Freeing a part of the huge page. Split it and free the page only */
+	if (pte_valid(&current_pagetable->huge[pd_index]))
+	{
+		__split_huge_page(vm, current_pagetable, pd_index);
+	}
+	if (!current_pagetable->pdes[pd_index]) goto out;
+
 	// 반대로 이게 일단 하나만 pagetable을 해제한다.;
 	current_pte = &current_pagetable->pdes[pd_index]->ptes[pte_index];
-	mapcounts[current_pte->pfn]--;
-	current_pte->rw = ACCESS_NONE;
-	current_pte->valid = 0;
-	current_pte->pfn = 0;
+
+	/* Freed by another thread of the process in the meantime */
+	if (!pte_valid(current_pte)) goto out;
+
+	__put_pfn(vm, pte_pfn(current_pte));
+	pte_clear(current_pte);
 
 	// free 0를 하면 mapping된 모든 pfn을 해제해야 된다?
 	//'free' 명령은 VPN에 매핑된 페이지의 할당을 해제하는 것입니다.
@@ -231,23 +458,14 @@ void free_page(unsigned int vpn)
 
 	// fork하고 나서 문제가 된다. -> process 1이 새로 쓰고 싶으면
 
-	for (int i = 0; i < NR_TLB_ENTRIES; i++) //해제를 해준다.
-	{
-		struct tlb_entry *t = tlb + i;
+	flush_tlb_range(vm, vm->current, vpn, 1); //해제를 해준다.
 
-		if (t->vpn == vpn)
-		{
-			t->valid = 0;
-			t->pfn = 0;
-			t->vpn = 0;
-			t->rw = 0;
-			break;
-		}
-	}
+out:
+	vm_unlock(vm, &current_pagetable->locks[pd_index]);
 }
 
 /**
- * handle_page_fault()
+ * handle_page_fault(@vm, @vpn, @rw)
  *
  * DESCRIPTION
  *   Handle the page fault for accessing @vpn for @rw. This function is called
@@ -256,53 +474,104 @@ void free_page(unsigned int vpn)
  *   1. pte is invalid
  *   2. pte is not writable but @rw is for write
  *   This function should identify the situation, and do the copy-on-write if
- *   necessary.
+ *   necessary. The fault is handled under the lock for the page directory
+ *   slot of @vpn, as other threads of the process may fault on it as well.
  *
  * RETURN
  *   @true on successful fault handling
  *   @false otherwise
  */
-bool handle_page_fault(unsigned int vpn, unsigned int rw)
+static bool __handle_page_fault(struct vm_machine *vm, unsigned int vpn, unsigned int rw);
+
+bool handle_page_fault(struct vm_machine *vm, unsigned int vpn, unsigned int rw)
+{
+	pthread_mutex_t *lock = &vm->current->pagetable.locks[vpn / NR_PTES_PER_PAGE];
+	bool handled;
+
+	vm_lock(vm, lock);
+	handled = __handle_page_fault(vm, vpn, rw);
+	vm_unlock(vm, lock);
+
+	return handled;
+}
+
+static bool __handle_page_fault(struct vm_machine *vm, unsigned int vpn, unsigned int rw)
 {
 	struct pte *current_pte; // page table entry
 	struct pte_directory *current_pte_directory;
 	int pd_index = vpn / NR_PTES_PER_PAGE; // page를 모아놓은 것들 index ,an index into the page table = vpn
 	int pte_index = vpn % NR_PTES_PER_PAGE;
-	unsigned int new_pfn = 0;
-	current_pte_directory = current->pagetable.pdes[pd_index]; // 현재 process의 pagetqble의 page directory
-	current_pte = &current->pagetable.pdes[pd_index]->ptes[pte_index];
-	// if(!current_pd) return true; //fault 발생 0
-	// if(current_pte->valid == 0) return true; //fault발생 1
-	// pd가 invaild면....
+	unsigned int new_pfn;
+	struct pte *huge = &vm->current->pagetable.huge[pd_index];
+
+	if (pte_valid(huge))
+	{
+		/* Resolved by another thread of the process in the meantime */
+		if ((pte_rw(huge) & rw) == rw) return true;
+		if (!(rw & ACCESS_WRITE) || !pte_cow(huge)) return false;
+
+		/**
+		 * Write to the copy-on-write huge page. Take over the whole huge page if
+		 * nobody else maps it. Otherwise, split it so that only the written page
+		 * gets copied.
+		 */
+		for (new_pfn = pte_pfn(huge); new_pfn < pte_pfn(huge) + NR_PAGES_PER_HUGE; new_pfn++)
+		{
+			if (__mapcount(vm, new_pfn) > 1) break;
+		}
+		if (new_pfn == pte_pfn(huge) + NR_PAGES_PER_HUGE)
+		{
+			pte_set_rw(huge, pte_rw(huge) | ACCESS_WRITE);
+			pte_set_flag(huge, PTE_COW, false);
+			return true;
+		}
+		__split_huge_page(vm, &vm->current->pagetable, pd_index);
+	}
+
+	current_pte_directory = vm->current->pagetable.pdes[pd_index]; // 현재 process의 pagetqble의 page directory
 	if (current_pte_directory == NULL)
 	{
 		return false;
 	}
-	// pte가 invaild이면 ?
-	if (current_pte->valid == 0)
+	current_pte = &current_pte_directory->ptes[pte_index];
+
+	/* Freed or never allocated. Subsequent accesses should be denied */
+	if (!pte_valid(current_pte))
 	{
-		current_pte->valid = 1; // vaild로 바꾸고
-		return true;
+		return false;
 	}
+	if ((pte_rw(current_pte) & rw) == rw) return true;
+
 	// pte에서 wirte x rw는 가능할때 -> write가능하게해라
-	if (current_pte->rw != current_pte->private)
+	if ((rw & ACCESS_WRITE) && pte_cow(current_pte))
 	{
-
-		if (rw == ACCESS_WRITE || rw == ACCESS_WRITE + 0x01) // 0x02가 들어오면 rw로 바꿔주고
+		/**
+		 * Still shared with others (or backed by the zero page, which is
+		 * pinned so its mapcount never drops to 1). Break the sharing by
+		 * copying into a private frame.
+		 */
+		if (__mapcount(vm, pte_pfn(current_pte)) > 1)
 		{
-			current_pte->rw = ACCESS_WRITE + 0x01;
-			current_pte->private = ACCESS_WRITE + 0x01;
-			rw = ACCESS_WRITE + 0x01;
-		}
+			new_pfn = __get_free_pfn(vm);
+			if (new_pfn == -1) return false;
 
-		// 	// 나는 이제부터 write를 할거에요 부모님이 주신 write에다가 새로운 write를 할ㄱ거에요
-		// 	// // 나 새로운 pfn내놔!!!!!!!!!! -> 젤 작은 pfn 할당 새로 alloc하면 link가 이상해짐
+			/* Nothing to copy from the zero page */
+			if (vm->config.use_zero_page && pte_pfn(current_pte) == ZERO_PFN)
+			{
+				vm_charge(vm, COST_ZERO, 1);
+			}
+			else
+			{
+				vm_charge(vm, COST_COW, 1);
+			}
+			__put_pfn(vm, pte_pfn(current_pte));
+			pte_set_pfn(current_pte, new_pfn);
 
-		if (mapcounts[current_pte->pfn] > 1) // mapping cnt를 하나죽인다 write를 하면 자기 자신만의 새로운 것들이 생기기 대문에
-		{
-			mapcounts[current_pte->pfn]--;
-			new_pfn = alloc_page(vpn, rw); // ->apgetable 업데이트
+			/* Other threads may still translate to the old frame */
+			flush_tlb_range(vm, vm->current, vpn, 1);
 		}
+		pte_set_rw(current_pte, pte_rw(current_pte) | ACCESS_WRITE);
+		pte_set_flag(current_pte, PTE_COW, false);
 
 		return true;
 	}
@@ -313,7 +582,7 @@ bool handle_page_fault(unsigned int vpn, unsigned int rw)
 }
 
 /**
- * switch_process()
+ * switch_process(@vm, @pid)
  *
  * DESCRIPTION
  *   If there is a process with @pid in @processes, switch to the process.
@@ -327,20 +596,26 @@ bool handle_page_fault(unsigned int vpn, unsigned int rw)
  *   the identical page table entry 'values' to its parent's (i.e., @current)
  *   page table.
  *   To implement the copy-on-write feature, you should manipulate the writable
- *   bit in PTE and mapcounts for shared pages. You may use pte->private for
- *   storing some useful information :-)
+ *   bit in PTE and mapcounts for shared pages. The pages write-protected
+ *   for copy-on-write are marked with PTE_COW.
+ *
+ *   With multiple CPUs, the process with @pid may be running on other CPUs.
+ *   Then the executing CPU joins them as another thread of the process, and
+ *   the @current goes to the @processes only when no other CPU runs it.
  */
 
-void switch_process(unsigned int pid)
+void switch_process(struct vm_machine *vm, unsigned int pid)
 {
 	struct process *new = NULL;
 	struct process *tmp = NULL;
-	struct pagetable *current_pagetable = ptbr;
+	struct pagetable *current_pagetable = vm->ptbr;
 	struct pagetable *new_pagetable;
 	struct pte *new_pte;
 	struct pte *current_pte;
-	int cnt = 0;
-	int flag_process = 0;
+
+	/* Already running */
+	if (pid == vm->current->pid) return;
+
 	// pte사용은 어떻게?
 	//  processes들의 모임을 만들어야 된다.
 	//   list head는 -> current(?) -> new로 process를 만들어 주고
@@ -353,70 +628,72 @@ void switch_process(unsigned int pid)
 	// switch 2일 때 안된다. -> list
 
 	// Note that TLB should be flushed during the context switch.
-	for (int i = 0; i < NR_TLB_ENTRIES; i++) // flush를 해준다.
+	for (int i = 0; i < vm->config.nr_tlb_entries; i++) // flush를 해준다.
 	{
-		struct tlb_entry *t = tlb + i;
-		t->valid = 0;
-		t->rw = 0;
-		t->pfn = 0;
-		t->vpn = 0;
+		vm_tlb_invalidate(vm, vm->tlb + i);
 	}
-	if (!list_empty(&processes))
-	{ // ->list가 비어있지 않는다면 2개 이상의 process가 존재할 때 만들어지지않음 goto문을 통해서 해결
 
-		new = list_first_entry(&processes, struct process, list);
-		list_for_each_entry(tmp, &processes, list)
+	/* Other threads of the process may be running on other CPUs. Join them */
+	for (unsigned int cpu = 0; cpu < vm->config.nr_cpus; cpu++)
+	{
+		if (cpu_current(vm, cpu)->pid == pid)
+		{
+			new = cpu_current(vm, cpu);
+			break;
+		}
+	}
+	if (!new && !list_empty(&vm->processes))
+	{ // ->list가 비어있지 않는다면 2개 이상의 process가 존재할 때 만들어지지않음
+
+		list_for_each_entry(tmp, &vm->processes, list)
 		{
 			if (pid == tmp->pid)
 			{
 				// new가 안들어간다;; -> 해결.
 				new = tmp;
-				current = tmp;
-				ptbr = &current->pagetable;
-				list_add_tail(&current->list, &processes);
-				list_del_init(&current->list);
-				flag_process = 1;
+				list_del_init(&new->list);
 				break;
 			}
 		}
-		// goto pick_next; //만약 break가 걸리지 않는다면 goto문으로 이동
-		if (flag_process == 0)
-		{
-			goto pick_next; // 만약 break가 걸리지 않는다면 goto문으로 이동
-		} // 18,19가 alloc되지 않음? cow-1 -> handle에서 문제
 	}
 
-	else
+	if (!new)
 	{
-	pick_next:
 		new = (struct process *)malloc(sizeof(struct process)); // new process의 공간을 확보하고 새로 잡고
 		new->pid = pid;
-		for (int i = 0; i < NR_PTES_PER_PAGE; i++)
+		new->cpumask = 0;
+		new->mempolicy = vm->current->mempolicy;
+		new->cycles = 0;
+		new->nr_accesses = 0;
+		INIT_LIST_HEAD(&new->list);
+		for (int i = 0; i < NR_PDES_PER_PAGE; i++)
+		{
+			pthread_mutex_init(&new->pagetable.locks[i], NULL);
+		}
+		for (int i = 0; i < NR_PDES_PER_PAGE; i++)
 		{
-			if (current->pagetable.pdes[i] == NULL) // 현재 current.pagetable pde[i]가 없으면 멈춘다. 왜냐하면 fork할게 없기 때문이다.
+			if (vm->current->pagetable.pdes[i] == NULL) // 현재 current.pagetable pde[i]가 없으면 fork할게 없다.
 			{
 				new->pagetable.pdes[i] = NULL;
-
-				break;
+				continue;
 			}
 			else
 			{
-				new->pagetable.pdes[i] = malloc(sizeof(struct pagetable) * NR_PTES_PER_PAGE);
+				new->pagetable.pdes[i] = calloc(1, sizeof(struct pte_directory));
 				for (int j = 0; j < NR_PTES_PER_PAGE; j++) // pte의 개수만큼 돌린다.
 				{
 
 					current_pte = &current_pagetable->pdes[i]->ptes[j];
 					new_pte = current_pte;
 					// // write가 되면 write가 되고 read, write가 되면 write가 안된다?
-					if (current_pte->valid == 1)
+					if (pte_valid(current_pte))
 					{
-						new_pte->valid = 1;
-						mapcounts[new_pte->pfn]++;
+						vm->mapcounts[pte_pfn(new_pte)]++;
 					}
-					if (current_pte->rw == ACCESS_READ || current_pte->rw == ACCESS_WRITE + 0x01)
+					if (pte_rw(current_pte) == ACCESS_READ || pte_rw(current_pte) == ACCESS_WRITE + 0x01)
 					{
-						new_pte->rw = ACCESS_READ;
-						current_pte->rw = ACCESS_READ;
+						if (pte_rw(current_pte) & ACCESS_WRITE) pte_set_flag(current_pte, PTE_COW, true);
+						pte_set_rw(current_pte, ACCESS_READ);
 					}
 
 					// rw는 read만 가능 , write기능은 사용 안됨, read -> read
@@ -425,10 +702,38 @@ void switch_process(unsigned int pid)
 				}
 			}
 		}
-		list_add_tail(&current->list, &processes); // 현재 processes에 들어 있는 process를 넣어야된다.
-		current = new;
-		ptbr = &new->pagetable;
+
+		/* Share the huge pages as well, and write-protect them for copy-on-write */
+		for (int i = 0; i < NR_PDES_PER_PAGE; i++)
+		{
+			struct pte *huge = &vm->current->pagetable.huge[i];
+
+			if (pte_valid(huge))
+			{
+				if (pte_rw(huge) & ACCESS_WRITE) pte_set_flag(huge, PTE_COW, true);
+				pte_set_rw(huge, ACCESS_READ);
+				for (int j = 0; j < NR_PAGES_PER_HUGE; j++)
+				{
+					vm->mapcounts[pte_pfn(huge) + j]++;
+				}
+			}
+			new->pagetable.huge[i] = *huge;
+		}
+
+		/* Write-protected for copy-on-write. Shoot down the other threads' */
+		flush_tlb_range(vm, vm->current, 0, NR_PDES_PER_PAGE * NR_PTES_PER_PAGE);
+	}
+
+	/* Back to the ready queue unless other threads are still running it */
+	vm->current->cpumask &= ~(1UL << vm->cpu);
+	if (!vm->current->cpumask)
+	{
+		list_add_tail(&vm->current->list, &vm->processes); // 현재 processes에 들어 있는 process를 넣어야된다.
 	}
+
+	new->cpumask |= 1UL << vm->cpu;
+	vm->current = new;
+	vm->ptbr = &new->pagetable;
 	// swtich가 되면 이전에 있었떤 tlb들을 다 끊어야 되는데 -> Note that TLB should be flushed during the context switch.
 
 	// mapcount를 조정해야되는데 switch 1번될때마다 다 1씩 올려줘야 되는거 아닌가?
@@ -0,0 +1,155 @@
+/**********************************************************************
+ * Copyright (c) 2019-2024
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "buddy.h"
+#include "pcp.h"
+
+/**
+ * pcp_init(@p, @high, @low, @batch)
+ *
+ * DESCRIPTION
+ *   Initialize @p to cache up to @high frames. @low should be less than
+ *   @high, and @batch should be 1 to @high.
+ *
+ * RETURN
+ *   @true on success, @false if out of memory
+ */
+bool pcp_init(struct pcp *p, unsigned int high, unsigned int low, unsigned int batch)
+{
+	memset(p, 0x00, sizeof(*p));
+
+	p->high = high;
+	p->low = low;
+	p->batch = batch;
+
+	/* Up to @high + 1 frames on free, and @low + @batch frames on refill */
+	p->frames = malloc(sizeof(*p->frames) *
+			(high + 1 > low + batch ? high + 1 : low + batch));
+	if (!p->frames) return false;
+
+	pthread_mutex_init(&p->lock, NULL);
+	return true;
+}
+
+void pcp_exit(struct pcp *p)
+{
+	free(p->frames);
+	pthread_mutex_destroy(&p->lock);
+}
+
+static void __pcp_insert(struct pcp *p, unsigned int pfn)
+{
+	unsigned int i = p->nr_frames;
+
+	for (; i > 0 && p->frames[i - 1] < pfn; i--) {
+		p->frames[i] = p->frames[i - 1];
+	}
+	p->frames[i] = pfn;
+	p->nr_frames++;
+}
+
+/**
+ * __pcp_drain(@p, @zone, @zone_lock, @nr)
+ *
+ * DESCRIPTION
+ *   Give @nr frames with the largest pfns in @p back to @zone, keeping the
+ *   small ones cached. Called with @p->lock held.
+ */
+static void __pcp_drain(struct pcp *p, struct buddy *zone, pthread_mutex_t *zone_lock, unsigned int nr)
+{
+	if (!nr) return;
+
+	pthread_mutex_lock(zone_lock);
+	for (unsigned int i = 0; i < nr; i++) {
+		buddy_free(zone, p->frames[i]);
+	}
+	pthread_mutex_unlock(zone_lock);
+
+	p->nr_frames -= nr;
+	memmove(p->frames, p->frames + nr, sizeof(*p->frames) * p->nr_frames);
+	p->nr_drains++;
+}
+
+/**
+ * pcp_alloc(@p, @zone, @zone_lock)
+ *
+ * DESCRIPTION
+ *   Take the frame with the smallest pfn in @p. @batch frames are taken from
+ *   @zone under @zone_lock first when @low frames or less are cached.
+ *
+ * RETURN
+ *   The pfn of the frame, or -1 if both @p and @zone are out of frames
+ */
+unsigned int pcp_alloc(struct pcp *p, struct buddy *zone, pthread_mutex_t *zone_lock)
+{
+	unsigned int pfn = -1;
+
+	pthread_mutex_lock(&p->lock);
+
+	if (p->nr_frames <= p->low) {
+		unsigned int nr_frames = p->nr_frames;
+
+		pthread_mutex_lock(zone_lock);
+		for (unsigned int i = 0; i < p->batch; i++) {
+			unsigned int new = buddy_alloc(zone, 0);
+
+			if (new == -1) break;
+			__pcp_insert(p, new);
+		}
+		pthread_mutex_unlock(zone_lock);
+
+		if (p->nr_frames > nr_frames) p->nr_refills++;
+	}
+	if (p->nr_frames) pfn = p->frames[--p->nr_frames];
+
+	pthread_mutex_unlock(&p->lock);
+
+	return pfn;
+}
+
+/**
+ * pcp_free(@p, @zone, @zone_lock, @pfn)
+ *
+ * DESCRIPTION
+ *   Cache the free frame @pfn in @p. When more than @high frames are cached,
+ *   @batch of them are given back to @zone under @zone_lock.
+ */
+void pcp_free(struct pcp *p, struct buddy *zone, pthread_mutex_t *zone_lock, unsigned int pfn)
+{
+	pthread_mutex_lock(&p->lock);
+
+	__pcp_insert(p, pfn);
+	if (p->nr_frames > p->high) __pcp_drain(p, zone, zone_lock, p->batch);
+
+	pthread_mutex_unlock(&p->lock);
+}
+
+/**
+ * pcp_drain(@p, @zone, @zone_lock)
+ *
+ * DESCRIPTION
+ *   Give all the frames cached in @p back to @zone.
+ */
+void pcp_drain(struct pcp *p, struct buddy *zone, pthread_mutex_t *zone_lock)
+{
+	pthread_mutex_lock(&p->lock);
+	__pcp_drain(p, zone, zone_lock, p->nr_frames);
+	pthread_mutex_unlock(&p->lock);
+}
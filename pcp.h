@@ -0,0 +1,49 @@
+/**********************************************************************
+ * Copyright (c) 2019-2024
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+#ifndef __PCP_H__
+#define __PCP_H__
+
+#include <pthread.h>
+
+#include "buddy.h"
+
+/**
+ * Per-CPU cache of free page frames in front of the buddy allocator. The
+ * frames move between the cache and the buddy allocator in batches, so the
+ * CPUs take the lock for the buddy allocator once per @batch frames.
+ */
+struct pcp {
+	unsigned int high;	/* Give @batch frames back when more are cached */
+	unsigned int low;	/* Take @batch frames when this or less are cached */
+	unsigned int batch;
+
+	/* In the descending order of pfn, so that the smallest one is at the tail */
+	unsigned int *frames;
+	unsigned int nr_frames;
+
+	pthread_mutex_t lock;
+
+	unsigned long nr_refills;	/* Batches taken from the buddy allocator */
+	unsigned long nr_drains;	/* Batches given back */
+};
+
+bool pcp_init(struct pcp *p, unsigned int high, unsigned int low, unsigned int batch);
+void pcp_exit(struct pcp *p);
+
+unsigned int pcp_alloc(struct pcp *p, struct buddy *zone, pthread_mutex_t *zone_lock);
+void pcp_free(struct pcp *p, struct buddy *zone, pthread_mutex_t *zone_lock, unsigned int pfn);
+void pcp_drain(struct pcp *p, struct buddy *zone, pthread_mutex_t *zone_lock);
+
+#endif
@@ -0,0 +1,399 @@
+/**********************************************************************
+ * Copyright (c) 2019-2024
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "list_head.h"
+#include "vm.h"
+#include "replay.h"
+
+/**
+ * A trace to replay and its outcome
+ */
+struct replay_trace {
+	char *path;
+	char *outpath;
+
+	bool done;
+	unsigned int worker;
+	unsigned long nr_commands;
+	unsigned long nsecs;
+	struct vm_stats stats;
+};
+
+/**
+ * Traces assigned to a worker. The owner takes traces from the tail,
+ * and idle workers steal them from the head.
+ */
+struct replay_queue {
+	pthread_mutex_t lock;
+	unsigned int *traces;
+	unsigned int head;
+	unsigned int tail;
+};
+
+struct replay;
+
+struct replay_worker {
+	unsigned int id;
+	pthread_t thread;
+	struct replay *replay;
+	struct replay_queue queue;
+
+	unsigned long nr_traces;
+	unsigned long nr_steals;
+	unsigned long busy_nsecs;
+};
+
+struct replay {
+	const struct vm_config *config;
+	FILE *out;		/* Where the unreadable directories and the summary go */
+
+	struct replay_trace *traces;
+	unsigned int nr_traces;
+
+	struct replay_worker *workers;
+	unsigned int nr_workers;
+};
+
+static unsigned long __nsecs_between(struct timespec *start, struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1000000000UL +
+			end->tv_nsec - start->tv_nsec;
+}
+
+static bool __is_directory(const char *path)
+{
+	struct stat st;
+
+	return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+static bool __ends_with(const char *str, const char *suffix)
+{
+	size_t len = strlen(str);
+	size_t slen = strlen(suffix);
+
+	return len >= slen && strcmp(str + len - slen, suffix) == 0;
+}
+
+static void __add_trace(struct replay *r, const char *path, const char *outdir)
+{
+	struct replay_trace *t;
+	const char *name;
+
+	if (r->nr_traces % 64 == 0) {
+		r->traces = realloc(r->traces, sizeof(*t) * (r->nr_traces + 64));
+	}
+	t = r->traces + r->nr_traces++;
+	memset(t, 0x00, sizeof(*t));
+
+	t->path = strdup(path);
+
+	/* Put the output next to the trace unless @outdir is given */
+	if (outdir) {
+		name = strrchr(path, '/');
+		name = name ? name + 1 : path;
+		t->outpath = malloc(strlen(outdir) + strlen(name) + sizeof("/.out"));
+		sprintf(t->outpath, "%s/%s.out", outdir, name);
+	} else {
+		t->outpath = malloc(strlen(path) + sizeof(".out"));
+		sprintf(t->outpath, "%s.out", path);
+	}
+}
+
+/**
+ * __collect_traces(@r, @path, @outdir)
+ *
+ * DESCRIPTION
+ *   Add @path to the traces to replay. For a directory, add the regular files
+ *   in it in the alphabetical order. Hidden files and the outputs of the
+ *   previous runs (*.out) are skipped.
+ */
+static void __collect_traces(struct replay *r, const char *path, const char *outdir)
+{
+	struct dirent **entries;
+	int nr_entries;
+
+	if (!__is_directory(path)) {
+		__add_trace(r, path, outdir);
+		return;
+	}
+
+	nr_entries = scandir(path, &entries, NULL, alphasort);
+	if (nr_entries < 0) {
+		fprintf(r->out, "Unable to read directory %s\n", path);
+		return;
+	}
+
+	for (int i = 0; i < nr_entries; i++) {
+		const char *name = entries[i]->d_name;
+		char *file;
+
+		if (name[0] != '.' && !__ends_with(name, ".out")) {
+			file = malloc(strlen(path) + strlen(name) + 2);
+			sprintf(file, "%s/%s", path, name);
+			if (!__is_directory(file)) __add_trace(r, file, outdir);
+			free(file);
+		}
+		free(entries[i]);
+	}
+	free(entries);
+}
+
+/**
+ * __replay_trace(@r, @t, @w)
+ *
+ * DESCRIPTION
+ *   Replay the trace @t on a fresh machine. Everything the machine prints,
+ *   including the console messages, goes to the output file of @t.
+ */
+static void __replay_trace(struct replay *r, struct replay_trace *t, struct replay_worker *w)
+{
+	struct vm_machine *vm;
+	FILE *input, *output;
+	struct timespec start, end;
+
+	t->worker = w->id;
+
+	input = fopen(t->path, "r");
+	if (!input) return;
+
+	output = fopen(t->outpath, "w");
+	if (!output) {
+		fclose(input);
+		return;
+	}
+
+	vm = malloc(sizeof(*vm));
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	if (!vm || vm_machine_init(vm, r->config)) {
+		free(vm);
+		fclose(output);
+		fclose(input);
+		return;
+	}
+	vm->out = output;
+	vm->con = output;
+
+	t->nr_commands = vm_simulate(vm, input);
+	t->stats = vm->stats;
+
+	vm_machine_exit(vm);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	t->nsecs = __nsecs_between(&start, &end);
+	t->done = true;
+
+	w->nr_traces++;
+	w->busy_nsecs += t->nsecs;
+
+	free(vm);
+	fclose(output);
+	fclose(input);
+}
+
+/**
+ * __take_trace(@q, @steal, @index)
+ *
+ * RETURN
+ *   @true if a trace is taken from @q; from the head if @steal, or from the
+ *   tail otherwise. Its index is stored in @index.
+ *   @false if @q is empty
+ */
+static bool __take_trace(struct replay_queue *q, bool steal, unsigned int *index)
+{
+	bool taken = false;
+
+	pthread_mutex_lock(&q->lock);
+	if (q->head != q->tail) {
+		*index = steal ? q->traces[q->head++] : q->traces[--q->tail];
+		taken = true;
+	}
+	pthread_mutex_unlock(&q->lock);
+
+	return taken;
+}
+
+static void *__replay_worker(void *arg)
+{
+	struct replay_worker *w = arg;
+	struct replay *r = w->replay;
+	unsigned int index;
+
+	while (true) {
+		bool stolen = false;
+
+		if (__take_trace(&w->queue, false, &index)) {
+			__replay_trace(r, r->traces + index, w);
+			continue;
+		}
+
+		/**
+		 * Our queue is drained. Steal from the others, starting from the
+		 * next worker. No trace is added once started, so we are done
+		 * when all queues are found empty.
+		 */
+		for (unsigned int i = 1; i < r->nr_workers && !stolen; i++) {
+			struct replay_worker *victim = r->workers + (w->id + i) % r->nr_workers;
+
+			stolen = __take_trace(&victim->queue, true, &index);
+		}
+		if (!stolen) break;
+
+		w->nr_steals++;
+		__replay_trace(r, r->traces + index, w);
+	}
+
+	return NULL;
+}
+
+static void __show_summary(struct replay *r, unsigned long wall_nsecs)
+{
+	unsigned long busy_nsecs = 0;
+	unsigned long nr_steals = 0;
+	unsigned int nr_failed = 0;
+
+	fprintf(r->out, "%-32s | %8s | %10s | %10s | %8s | %10s | %s\n", "trace",
+			"commands", "translate", "tlb hits", "faults", "time (us)", "worker");
+
+	for (unsigned int i = 0; i < r->nr_traces; i++) {
+		struct replay_trace *t = r->traces + i;
+
+		if (!t->done) {
+			fprintf(r->out, "%-32s | failed\n", t->path);
+			nr_failed++;
+			continue;
+		}
+		fprintf(r->out, "%-32s | %8lu | %10lu | %10lu | %8lu | %10.1f | %u\n", t->path,
+				t->nr_commands, t->stats.nr_translations, t->stats.nr_tlb_hits,
+				t->stats.nr_faults, t->nsecs / 1000.0, t->worker);
+	}
+	fprintf(r->out, "\n");
+
+	for (unsigned int i = 0; i < r->nr_workers; i++) {
+		struct replay_worker *w = r->workers + i;
+
+		fprintf(r->out, "worker %-3u : %lu traces, %lu stolen, busy %.3f ms\n", i,
+				w->nr_traces, w->nr_steals, w->busy_nsecs / 1000000.0);
+		busy_nsecs += w->busy_nsecs;
+		nr_steals += w->nr_steals;
+	}
+	fprintf(r->out, "\n");
+
+	fprintf(r->out, "traces     : %u (%u failed)\n", r->nr_traces, nr_failed);
+	fprintf(r->out, "workers    : %u (%lu steals)\n", r->nr_workers, nr_steals);
+	fprintf(r->out, "wall clock : %.3f ms\n", wall_nsecs / 1000000.0);
+	fprintf(r->out, "busy time  : %.3f ms (%.2fx parallelism)\n", busy_nsecs / 1000000.0,
+			wall_nsecs ? (double)busy_nsecs / wall_nsecs : 0.0);
+}
+
+/**
+ * replay_traces(@config, @paths, @nr_paths, @nr_workers, @outdir, @out)
+ *
+ * DESCRIPTION
+ *   Replay the traces in @paths in parallel with @nr_workers threads.
+ *   Directories in @paths are expanded to the files in them. Each trace runs
+ *   on its own machine configured with @config, and its output is written
+ *   to @outdir/<trace>.out, or <trace path>.out if @outdir is NULL.
+ *   The traces are distributed to the workers in the round-robin manner,
+ *   and idle workers steal the remaining ones from busy workers. Then the
+ *   per-trace results and the aggregated times are reported to @out.
+ *   @nr_workers 0 means as many workers as the online processors.
+ *
+ * RETURN
+ *   The number of traces that could not be replayed, or -LIBVM_ENOENT if
+ *   there is no trace to replay
+ */
+int replay_traces(const struct vm_config *config,
+		char * const paths[], unsigned int nr_paths,
+		unsigned int nr_workers, const char *outdir, FILE *out)
+{
+	struct replay r = {
+		.config = config,
+		.out = out,
+	};
+	struct timespec start, end;
+	int nr_failed = 0;
+
+	for (unsigned int i = 0; i < nr_paths; i++) {
+		__collect_traces(&r, paths[i], outdir);
+	}
+	if (!r.nr_traces) return -LIBVM_ENOENT;
+
+	if (outdir && !__is_directory(outdir)) mkdir(outdir, 0755);
+
+	if (!nr_workers) {
+		long nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+		nr_workers = nr_cpus > 0 ? nr_cpus : 1;
+	}
+	if (nr_workers > r.nr_traces) nr_workers = r.nr_traces;
+
+	r.nr_workers = nr_workers;
+	r.workers = calloc(nr_workers, sizeof(*r.workers));
+
+	for (unsigned int i = 0; i < nr_workers; i++) {
+		struct replay_worker *w = r.workers + i;
+
+		w->id = i;
+		w->replay = &r;
+		pthread_mutex_init(&w->queue.lock, NULL);
+		w->queue.traces = malloc(sizeof(unsigned int) * (r.nr_traces / nr_workers + 1));
+	}
+	for (unsigned int i = 0; i < r.nr_traces; i++) {
+		struct replay_queue *q = &r.workers[i % nr_workers].queue;
+
+		q->traces[q->tail++] = i;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (unsigned int i = 0; i < nr_workers; i++) {
+		pthread_create(&r.workers[i].thread, NULL, __replay_worker, r.workers + i);
+	}
+	for (unsigned int i = 0; i < nr_workers; i++) {
+		pthread_join(r.workers[i].thread, NULL);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	__show_summary(&r, __nsecs_between(&start, &end));
+
+	for (unsigned int i = 0; i < nr_workers; i++) {
+		pthread_mutex_destroy(&r.workers[i].queue.lock);
+		free(r.workers[i].queue.traces);
+	}
+	free(r.workers);
+
+	for (unsigned int i = 0; i < r.nr_traces; i++) {
+		if (!r.traces[i].done) nr_failed++;
+		free(r.traces[i].path);
+		free(r.traces[i].outpath);
+	}
+	free(r.traces);
+
+	return nr_failed;
+}
@@ -0,0 +1,26 @@
+/**********************************************************************
+ * Copyright (c) 2019-2024
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+#ifndef __REPLAY_H__
+#define __REPLAY_H__
+
+#include <stdio.h>
+
+struct vm_config;
+
+int replay_traces(const struct vm_config *config,
+		char * const paths[], unsigned int nr_paths,
+		unsigned int nr_workers, const char *outdir, FILE *out);
+
+#endif
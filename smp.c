@@ -0,0 +1,406 @@
+/**********************************************************************
+ * Copyright (c) 2019-2024
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "parser.h"
+
+#include "list_head.h"
+#include "vm.h"
+#include "smp.h"
+
+/**
+ * A simulated CPU executed by a host thread. It executes the page operations
+ * tagged to it on @view, which shares the processes, page tables, TLBs, and
+ * the mapcounts with the simulated machine.
+ */
+struct smp_cpu {
+	pthread_t thread;
+
+	struct vm_machine view;
+
+	/* Indices of the operations for this CPU, and the next one to execute */
+	unsigned long *ops;
+	unsigned long nr_ops;
+	unsigned long next;
+
+	/* Results of the epoch, written to the machine at the end of it */
+	char *buffer;
+	size_t size;
+
+	bool stopped;	/* Ran out of memory */
+
+	struct smp *smp;
+};
+
+struct smp {
+	struct vm_machine *vm;
+
+	struct vm_op *ops;
+	unsigned long nr_ops;
+	unsigned long capacity;
+
+	struct smp_cpu *cpus;
+
+	/* The CPUs execute their operations before this one in the epoch */
+	unsigned long end;
+	bool done;
+
+	unsigned long nr_epochs;
+	unsigned long nr_concurrent;	/* Commands executed in the epochs */
+
+	pthread_barrier_t start;
+	pthread_barrier_t finish;
+};
+
+static unsigned long __nsecs_between(struct timespec *start, struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1000000000UL +
+			end->tv_nsec - start->tv_nsec;
+}
+
+/**
+ * __is_concurrent(@vm, @op)
+ *
+ * RETURN
+ *   @true if @op only touches the page table of the process running on its
+ *   CPU, so that the CPUs can execute such operations concurrently. The
+ *   others are executed by the machine alone, between the epochs.
+ */
+static bool __is_concurrent(struct vm_machine *vm, const struct vm_op *op)
+{
+	if (op->cpu >= vm->config.nr_cpus) return false;
+
+	return op->type == VM_OP_ACCESS || op->type == VM_OP_BATCH ||
+			op->type == VM_OP_ALLOC || op->type == VM_OP_FREE;
+}
+
+static void __add_op(struct smp *s, const struct vm_op *op)
+{
+	if (s->nr_ops == s->capacity) {
+		s->capacity = s->capacity ? s->capacity * 2 : 1024;
+		s->ops = realloc(s->ops, sizeof(*s->ops) * s->capacity);
+	}
+	s->ops[s->nr_ops] = *op;
+
+	if (__is_concurrent(s->vm, op)) {
+		struct smp_cpu *c = s->cpus + op->cpu;
+
+		if ((c->nr_ops & (c->nr_ops - 1)) == 0) {
+			c->ops = realloc(c->ops, sizeof(*c->ops) * (c->nr_ops ? c->nr_ops * 2 : 1));
+		}
+		c->ops[c->nr_ops++] = s->nr_ops;
+	}
+	s->nr_ops++;
+}
+
+/**
+ * __decode_trace(@s, @input)
+ *
+ * DESCRIPTION
+ *   Decode the commands from @input into @s->ops up to the first exit, and
+ *   tag each of them with the CPU executing it. The concurrent operations are
+ *   distributed to the CPUs as well.
+ */
+static void __decode_trace(struct smp *s, FILE *input)
+{
+	char command[MAX_COMMAND_LEN] = { 0 };
+	int cpu = s->vm->cpu;
+
+	while (fgets(command, sizeof(command), input)) {
+		struct vm_op op;
+
+		vm_decode(command, &op, s->vm->con);
+		if (op.type == VM_OP_NONE) continue;
+
+		if (op.type == VM_OP_CPU) {
+			if (op.arg < s->vm->config.nr_cpus) cpu = op.arg;
+		} else if (op.cpu < 0) {
+			op.cpu = cpu;
+		} else if (op.cpu < s->vm->config.nr_cpus) {
+			cpu = op.cpu;
+		}
+
+		__add_op(s, &op);
+
+		if (op.type == VM_OP_EXIT) break;
+	}
+}
+
+static void *__smp_cpu(void *arg)
+{
+	struct smp_cpu *c = arg;
+	struct smp *s = c->smp;
+
+	while (true) {
+		pthread_barrier_wait(&s->start);
+		if (s->done) break;
+
+		for (; c->next < c->nr_ops && c->ops[c->next] < s->end; c->next++) {
+			if (c->stopped) continue;
+
+			c->stopped = !vm_execute(&c->view, s->ops + c->ops[c->next]);
+		}
+		pthread_barrier_wait(&s->finish);
+	}
+	return NULL;
+}
+
+/**
+ * __run_epoch(@s, @end)
+ *
+ * DESCRIPTION
+ *   Let the CPUs execute their operations up to @end concurrently. Each CPU
+ *   gets a view of the machine for the process running on it. Its results
+ *   are buffered, and written to the machine in the order of the CPUs at the
+ *   end of the epoch. The statistics and the cached page frames of the CPUs
+ *   are folded back into the machine as well.
+ *
+ * RETURN
+ *   @false if a CPU ran out of memory, @true otherwise
+ */
+static bool __run_epoch(struct smp *s, unsigned long end)
+{
+	struct vm_machine *vm = s->vm;
+	bool running = true;
+
+	for (unsigned int i = 0; i < vm->config.nr_cpus; i++) {
+		struct vm_machine *view = &s->cpus[i].view;
+
+		*view = *vm;
+		view->cpu = i;
+		view->current = cpu_current(vm, i);
+		view->ptbr = i == vm->cpu ? vm->ptbr : vm->cpus[i].ptbr;
+		view->tlb = vm->cpus[i].tlb;
+		view->config.khugepaged_interval = 0;
+		view->config.tier_interval = 0;
+		view->nr_commands = 0;
+		memset(&view->stats, 0x00, sizeof(view->stats));
+		view->concurrent = true;
+		view->main = vm;
+		view->out = open_memstream(&s->cpus[i].buffer, &s->cpus[i].size);
+	}
+
+	s->end = end;
+	s->nr_epochs++;
+	pthread_barrier_wait(&s->start);
+	pthread_barrier_wait(&s->finish);
+
+	for (unsigned int i = 0; i < vm->config.nr_cpus; i++) {
+		struct smp_cpu *c = s->cpus + i;
+		unsigned long *from = (unsigned long *)&c->view.stats;
+		unsigned long *to = (unsigned long *)&vm->stats;
+
+		fclose(c->view.out);
+		fwrite(c->buffer, 1, c->size, vm->out);
+		free(c->buffer);
+
+		/* All the counters are unsigned long */
+		for (int j = 0; j < sizeof(vm->stats) / sizeof(*to); j++) {
+			to[j] += from[j];
+		}
+		vm->nr_commands += c->view.nr_commands;
+		s->nr_concurrent += c->view.nr_commands;
+		if (c->view.tlb_clock > vm->tlb_clock) vm->tlb_clock = c->view.tlb_clock;
+
+		if (c->stopped) running = false;
+	}
+	drain_page_frames(vm);
+
+	return running;
+}
+
+/**
+ * __smp_run(@s)
+ *
+ * DESCRIPTION
+ *   Execute @s->ops on @s->vm with a host thread for each CPU, until the end
+ *   of the operations or exit.
+ *
+ * RETURN
+ *   The time taken in nsecs
+ */
+static unsigned long __smp_run(struct smp *s)
+{
+	struct vm_machine *vm = s->vm;
+	struct timespec start, end;
+
+	pthread_barrier_init(&s->start, NULL, vm->config.nr_cpus + 1);
+	pthread_barrier_init(&s->finish, NULL, vm->config.nr_cpus + 1);
+	for (unsigned int i = 0; i < vm->config.nr_cpus; i++) {
+		s->cpus[i].smp = s;
+		pthread_create(&s->cpus[i].thread, NULL, __smp_cpu, s->cpus + i);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (unsigned long i = 0; i < s->nr_ops; ) {
+		unsigned long j = i;
+
+		if (!__is_concurrent(vm, s->ops + i)) {
+			if (!vm_execute(vm, s->ops + i)) break;
+			i++;
+			continue;
+		}
+
+		while (j < s->nr_ops && __is_concurrent(vm, s->ops + j)) j++;
+
+		if (!__run_epoch(s, j)) break;
+		i = j;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	s->done = true;
+	pthread_barrier_wait(&s->start);
+	for (unsigned int i = 0; i < vm->config.nr_cpus; i++) {
+		pthread_join(s->cpus[i].thread, NULL);
+		free(s->cpus[i].ops);
+	}
+	pthread_barrier_destroy(&s->start);
+	pthread_barrier_destroy(&s->finish);
+
+	return __nsecs_between(&start, &end);
+}
+
+/**
+ * smp_simulate(@vm, @input)
+ *
+ * DESCRIPTION
+ *   Run the commands from @input on @vm as vm_simulate() does, but with
+ *   each CPU of @vm executed by its own host thread. The page operations
+ *   (access, alloc, and free) of the CPUs between the other commands make up
+ *   an epoch, in which the CPUs execute them concurrently against the shared
+ *   page tables. The other commands are executed alone between the epochs.
+ *
+ *   So the results of each CPU are in order, while the operations of the
+ *   CPUs interleave in any order within an epoch; a page may be mapped to
+ *   different frames, and a fault may be resolved by another thread first.
+ *   khugepaged and the tier scans do not run automatically during the epochs.
+ *
+ * RETURN
+ *   The number of commands executed
+ */
+unsigned long smp_simulate(struct vm_machine *vm, FILE *input)
+{
+	struct smp s = { .vm = vm };
+	unsigned long nsecs;
+
+	s.cpus = calloc(vm->config.nr_cpus, sizeof(*s.cpus));
+	__decode_trace(&s, input);
+
+	nsecs = __smp_run(&s);
+
+	fprintf(vm->con, "smp: %lu commands, %lu on %u CPUs concurrently in %lu epochs, "
+			"%.3f ms (%.3f Mcommands/s)\n",
+			vm->nr_commands, s.nr_concurrent, vm->config.nr_cpus, s.nr_epochs,
+			nsecs / 1000000.0, nsecs ? vm->nr_commands * 1000.0 / nsecs : 0.0);
+
+	for (unsigned long i = 0; i < s.nr_ops; i++) free(s.ops[i].path);
+	free(s.cpus);
+	free(s.ops);
+
+	return vm->nr_commands;
+}
+
+/**
+ * smp_bench_alloc(@config, @max_cpus, @nr_commands, @out)
+ *
+ * DESCRIPTION
+ *   Measure the throughput of the page allocation on 1, 2, 4, ... up to
+ *   @max_cpus CPUs executing concurrently, with the other parameters from
+ *   @config. The CPUs run threads of the initial process, each of which
+ *   allocates and frees its share of the address space over and over,
+ *   @nr_commands in total. A row of the results is reported to @out for
+ *   each.
+ *
+ * RETURN
+ *   0 on success, or the error of vm_machine_init()
+ */
+int smp_bench_alloc(const struct vm_config *config, unsigned int max_cpus,
+		unsigned long nr_commands, FILE *out)
+{
+	const unsigned int nr_pages = NR_PDES_PER_PAGE * NR_PTES_PER_PAGE;
+	FILE *null = fopen("/dev/null", "w");
+	int ret = 0;
+
+	if (!null) return -LIBVM_ENOMEM;
+	if (max_cpus > nr_pages) max_cpus = nr_pages;
+
+	fprintf(out, "%4s | %8s | %10s | %12s | %8s | %8s | %s\n", "cpus", "commands",
+			"ms", "Mcommands/s", "refills", "drains", "batch/high");
+
+	for (unsigned int nr_cpus = 1; ; nr_cpus *= 2) {
+		struct vm_config c = *config;
+		struct vm_machine vm;
+		struct smp s = { .vm = &vm };
+		unsigned long nr_refills = 0, nr_drains = 0;
+		unsigned long nsecs;
+
+		if (nr_cpus > max_cpus) nr_cpus = max_cpus;
+
+		c.nr_cpus = nr_cpus;
+		if ((ret = vm_machine_init(&vm, &c))) break;
+		vm.out = null;
+		vm.con = null;
+		s.cpus = calloc(nr_cpus, sizeof(*s.cpus));
+		if (!s.cpus) {
+			vm_machine_exit(&vm);
+			ret = -LIBVM_ENOMEM;
+			break;
+		}
+
+		/* Each CPU allocates all of its share of the pages, and then frees them */
+		while (s.nr_ops < nr_commands) {
+			for (unsigned int i = 0; i < 2 * (nr_pages + nr_cpus - 1) / nr_cpus; i++) {
+				for (unsigned int cpu = 0; cpu < nr_cpus; cpu++) {
+					unsigned int begin = cpu * nr_pages / nr_cpus;
+					unsigned int nr = (cpu + 1) * nr_pages / nr_cpus - begin;
+					struct vm_op op = {
+						.cpu = cpu,
+						.type = i < nr ? VM_OP_ALLOC : VM_OP_FREE,
+						.arg = begin + i % nr,
+						.rw = ACCESS_READ | ACCESS_WRITE,
+					};
+
+					if (i < 2 * nr) __add_op(&s, &op);
+				}
+			}
+		}
+
+		nsecs = __smp_run(&s);
+
+		for (unsigned int i = 0; i < nr_cpus; i++) {
+			nr_refills += vm.cpus[i].pcp.nr_refills;
+			nr_drains += vm.cpus[i].pcp.nr_drains;
+		}
+		fprintf(out, "%4u | %8lu | %10.3f | %12.3f | %8lu | %8lu | %u/%u\n",
+				nr_cpus, vm.nr_commands, nsecs / 1000000.0,
+				nsecs ? vm.nr_commands * 1000.0 / nsecs : 0.0,
+				nr_refills, nr_drains, vm.config.pcp_batch, vm.config.pcp_high);
+
+		free(s.cpus);
+		free(s.ops);
+		vm_machine_exit(&vm);
+
+		if (nr_cpus == max_cpus) break;
+	}
+	fclose(null);
+	return ret;
+}
@@ -0,0 +1,27 @@
+/**********************************************************************
+ * Copyright (c) 2019-2024
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+#ifndef __SMP_H__
+#define __SMP_H__
+
+#include <stdio.h>
+
+struct vm_machine;
+struct vm_config;
+
+unsigned long smp_simulate(struct vm_machine *vm, FILE *input);
+int smp_bench_alloc(const struct vm_config *config, unsigned int max_cpus,
+		unsigned long nr_commands, FILE *out);
+
+#endif
@@ -0,0 +1,381 @@
+/**********************************************************************
+ * Copyright (c) 2019-2024
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "parser.h"
+
+#include "list_head.h"
+#include "vm.h"
+#include "sweep.h"
+
+#define MAX_SWEEP_VALUES	16
+
+/**
+ * Values to sweep for each parameter. The configurations are the cartesian
+ * product of them.
+ */
+struct sweep_spec {
+	unsigned int tlb[MAX_SWEEP_VALUES];
+	unsigned int nr_tlb;
+	unsigned int ways[MAX_SWEEP_VALUES];
+	unsigned int nr_ways;
+	unsigned int policy[MAX_SWEEP_VALUES];
+	unsigned int nr_policy;
+	unsigned int frames[MAX_SWEEP_VALUES];
+	unsigned int nr_frames;
+};
+
+struct sweep_worker {
+	pthread_t thread;
+
+	/* Machines [@begin, @end) are simulated by this worker */
+	unsigned int begin;
+	unsigned int end;
+
+	struct sweep *sweep;
+};
+
+struct sweep {
+	struct vm_op *ops;
+	unsigned long nr_ops;
+
+	struct vm_machine *machines;
+	bool *running;
+	unsigned int nr_machines;
+};
+
+static const char * const policy_names[] = {
+	[TLB_POLICY_LRU] = "lru",
+	[TLB_POLICY_FIFO] = "fifo",
+	[TLB_POLICY_RANDOM] = "random",
+};
+
+static unsigned long __nsecs_between(struct timespec *start, struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1000000000UL +
+			end->tv_nsec - start->tv_nsec;
+}
+
+static bool __parse_value(const char *key, const char *str, unsigned int *value)
+{
+	if (strcmp(key, "policy") == 0) {
+		for (unsigned int i = 0; i < sizeof(policy_names) / sizeof(*policy_names); i++) {
+			if (strcmp(str, policy_names[i]) == 0) {
+				*value = i;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	/* Fully associative */
+	if (strcmp(key, "ways") == 0 && strcmp(str, "full") == 0) {
+		*value = 0;
+		return true;
+	}
+
+	*value = strtoimax(str, NULL, 0);
+	return *value || strcmp(key, "ways") == 0;
+}
+
+/**
+ * __parse_spec(@str, @spec)
+ *
+ * DESCRIPTION
+ *   Parse @str in the form of "key=value,value,... key=value,..." into @spec.
+ *   The keys are tlb (number of TLB entries), ways (TLB associativity, 0 or
+ *   "full" for fully associative), policy (lru, fifo, or random), and frames
+ *   (number of page frames). Parameters not in @str are not swept.
+ *
+ * RETURN
+ *   @true on success, @false if @str is malformed
+ */
+static bool __parse_spec(const char *str, struct sweep_spec *spec)
+{
+	char *buffer = strdup(str);
+	char *saveptr;
+	bool ok = true;
+
+	for (char *param = strtok_r(buffer, " ;", &saveptr); param && ok;
+			param = strtok_r(NULL, " ;", &saveptr)) {
+		char *values = strchr(param, '=');
+		unsigned int *array;
+		unsigned int *nr;
+		char *saveptr2;
+
+		if (!values) {
+			ok = false;
+			break;
+		}
+		*values++ = '\0';
+
+		if (strcmp(param, "tlb") == 0) {
+			array = spec->tlb;
+			nr = &spec->nr_tlb;
+		} else if (strcmp(param, "ways") == 0) {
+			array = spec->ways;
+			nr = &spec->nr_ways;
+		} else if (strcmp(param, "policy") == 0) {
+			array = spec->policy;
+			nr = &spec->nr_policy;
+		} else if (strcmp(param, "frames") == 0) {
+			array = spec->frames;
+			nr = &spec->nr_frames;
+		} else {
+			ok = false;
+			break;
+		}
+
+		*nr = 0;
+		for (char *value = strtok_r(values, ",", &saveptr2); value;
+				value = strtok_r(NULL, ",", &saveptr2)) {
+			if (*nr == MAX_SWEEP_VALUES || !__parse_value(param, value, array + *nr)) {
+				ok = false;
+				break;
+			}
+			(*nr)++;
+		}
+	}
+
+	free(buffer);
+	return ok;
+}
+
+/**
+ * __decode_trace(@s, @path, @out)
+ *
+ * DESCRIPTION
+ *   Read the trace at @path and decode its commands into @s->ops, up to the
+ *   first exit. Empty lines are dropped, and unknown commands are reported
+ *   to @out.
+ *
+ * RETURN
+ *   @true on success, @false if the trace cannot be opened
+ */
+static bool __decode_trace(struct sweep *s, const char *path, FILE *out)
+{
+	char command[MAX_COMMAND_LEN] = { 0 };
+	unsigned long capacity = 0;
+	FILE *input = fopen(path, "r");
+
+	if (!input) return false;
+
+	while (fgets(command, sizeof(command), input)) {
+		struct vm_op op;
+
+		vm_decode(command, &op, out);
+		if (op.type == VM_OP_NONE) continue;
+
+		/* The machines of different configurations share no checkpoint */
+		if (op.type == VM_OP_CHECKPOINT || op.type == VM_OP_RESTORE) {
+			free(op.path);
+			continue;
+		}
+
+		if (s->nr_ops == capacity) {
+			capacity = capacity ? capacity * 2 : 1024;
+			s->ops = realloc(s->ops, sizeof(*s->ops) * capacity);
+		}
+		s->ops[s->nr_ops++] = op;
+
+		if (op.type == VM_OP_EXIT) break;
+	}
+
+	fclose(input);
+	return true;
+}
+
+/**
+ * __sweep_worker(@arg)
+ *
+ * DESCRIPTION
+ *   Feed each operation to all the machines of the worker in lockstep, so
+ *   the operation is fetched once for all of them. A machine stops when it
+ *   exits or runs out of memory, while the others proceed.
+ */
+static void *__sweep_worker(void *arg)
+{
+	struct sweep_worker *w = arg;
+	struct sweep *s = w->sweep;
+
+	for (unsigned long i = 0; i < s->nr_ops; i++) {
+		const struct vm_op *op = s->ops + i;
+
+		for (unsigned int m = w->begin; m < w->end; m++) {
+			if (!s->running[m]) continue;
+
+			s->running[m] = vm_execute(s->machines + m, op);
+		}
+	}
+	return NULL;
+}
+
+static void __show_results(struct sweep *s, FILE *out)
+{
+	fprintf(out, "%5s | %5s | %6s | %6s | %8s | %8s | %8s | %9s | %8s | %s\n",
+			"tlb", "ways", "policy", "frames", "commands", "hit rate",
+			"misses", "evictions", "faults", "frames used");
+
+	for (unsigned int i = 0; i < s->nr_machines; i++) {
+		struct vm_machine *vm = s->machines + i;
+		struct vm_config *c = &vm->config;
+		struct vm_stats *st = &vm->stats;
+
+		fprintf(out, "%5u | %5u | %6s | %6u | %8lu | %7.2f%% | %8lu | %9lu | %8lu | %u\n",
+				c->nr_tlb_entries, c->tlb_ways, policy_names[c->tlb_policy],
+				c->nr_pageframes, vm->nr_commands,
+				st->nr_translations ? st->nr_tlb_hits * 100.0 / st->nr_translations : 0.0,
+				st->nr_tlb_misses, st->nr_tlb_evictions, st->nr_faults,
+				vm->zone.nr_frames - vm->zone.nr_free_min);
+	}
+}
+
+/**
+ * sweep_trace(@config, @spec, @path, @nr_workers, @out)
+ *
+ * DESCRIPTION
+ *   Decode the trace at @path once, and replay it on a machine for each
+ *   configuration in @spec (see __parse_spec()), with the other parameters
+ *   taken from @config. The machines are split into @nr_workers groups,
+ *   each simulated by a thread in lockstep. @nr_workers 0 means as many
+ *   workers as the online processors. The outputs of the machines are
+ *   discarded, and a table of the results per configuration is reported to
+ *   @out, along with the configurations skipped.
+ *
+ * RETURN
+ *   0 on success
+ *   -LIBVM_EINVAL if @spec is invalid
+ *   -LIBVM_ENOENT if the trace cannot be opened
+ *   -LIBVM_ENOMEM if out of memory
+ */
+int sweep_trace(const struct vm_config *config, const char *spec,
+		const char *path, unsigned int nr_workers, FILE *out)
+{
+	struct sweep_spec sp = {
+		.tlb = { config->nr_tlb_entries }, .nr_tlb = 1,
+		.ways = { config->tlb_ways }, .nr_ways = 1,
+		.policy = { config->tlb_policy }, .nr_policy = 1,
+		.frames = { config->nr_pageframes }, .nr_frames = 1,
+	};
+	struct sweep s = { 0 };
+	struct sweep_worker *workers;
+	struct timespec start, decoded, end;
+	FILE *null;
+
+	if (!__parse_spec(spec, &sp)) return -LIBVM_EINVAL;
+
+	null = fopen("/dev/null", "w");
+	if (!null) return -LIBVM_ENOMEM;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	if (!__decode_trace(&s, path, out)) {
+		fclose(null);
+		return -LIBVM_ENOENT;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &decoded);
+
+	s.machines = malloc(sizeof(*s.machines) *
+			sp.nr_tlb * sp.nr_ways * sp.nr_policy * sp.nr_frames);
+	s.running = malloc(sizeof(*s.running) *
+			sp.nr_tlb * sp.nr_ways * sp.nr_policy * sp.nr_frames);
+	if (!s.machines || !s.running) {
+		free(s.machines);
+		free(s.running);
+		free(s.ops);
+		fclose(null);
+		return -LIBVM_ENOMEM;
+	}
+
+	for (unsigned int t = 0; t < sp.nr_tlb; t++) {
+		for (unsigned int w = 0; w < sp.nr_ways; w++) {
+			for (unsigned int p = 0; p < sp.nr_policy; p++) {
+				for (unsigned int f = 0; f < sp.nr_frames; f++) {
+					struct vm_config c = *config;
+					struct vm_machine *vm = s.machines + s.nr_machines;
+
+					c.use_tlb = true;
+					c.nr_tlb_entries = sp.tlb[t];
+					c.tlb_ways = sp.ways[w];
+					c.tlb_policy = sp.policy[p];
+					c.nr_pageframes = sp.frames[f];
+
+					if (c.tlb_ways > c.nr_tlb_entries ||
+							(c.tlb_ways && c.nr_tlb_entries % c.tlb_ways)) {
+						fprintf(out, "Skip %u-way TLB with %u entries\n",
+								c.tlb_ways, c.nr_tlb_entries);
+						continue;
+					}
+
+					if (vm_machine_init(vm, &c)) {
+						fprintf(out, "Skip %u-way TLB with %u entries on %u frames\n",
+								c.tlb_ways, c.nr_tlb_entries, c.nr_pageframes);
+						continue;
+					}
+					vm->out = null;
+					vm->con = null;
+					s.running[s.nr_machines++] = true;
+				}
+			}
+		}
+	}
+
+	if (!nr_workers) {
+		long nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+		nr_workers = nr_cpus > 0 ? nr_cpus : 1;
+	}
+	if (nr_workers > s.nr_machines) nr_workers = s.nr_machines;
+
+	workers = calloc(nr_workers, sizeof(*workers));
+	for (unsigned int i = 0; i < nr_workers; i++) {
+		workers[i].sweep = &s;
+		workers[i].begin = s.nr_machines * i / nr_workers;
+		workers[i].end = s.nr_machines * (i + 1) / nr_workers;
+		pthread_create(&workers[i].thread, NULL, __sweep_worker, workers + i);
+	}
+	for (unsigned int i = 0; i < nr_workers; i++) {
+		pthread_join(workers[i].thread, NULL);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	__show_results(&s, out);
+
+	fprintf(out, "\n");
+	fprintf(out, "decoded %lu commands in %.3f ms\n", s.nr_ops,
+			__nsecs_between(&start, &decoded) / 1000000.0);
+	fprintf(out, "simulated %u configurations in %.3f ms on %u workers\n",
+			s.nr_machines, __nsecs_between(&decoded, &end) / 1000000.0, nr_workers);
+
+	for (unsigned int i = 0; i < s.nr_machines; i++) {
+		vm_machine_exit(s.machines + i);
+	}
+	free(workers);
+	free(s.machines);
+	free(s.running);
+	free(s.ops);
+	fclose(null);
+
+	return 0;
+}
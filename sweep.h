@@ -0,0 +1,25 @@
+/**********************************************************************
+ * Copyright (c) 2019-2024
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+#ifndef __SWEEP_H__
+#define __SWEEP_H__
+
+#include <stdio.h>
+
+struct vm_config;
+
+int sweep_trace(const struct vm_config *config, const char *spec,
+		const char *path, unsigned int nr_workers, FILE *out);
+
+#endif
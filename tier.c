@@ -0,0 +1,220 @@
+/**********************************************************************
+ * Copyright (c) 2019-2024
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "list_head.h"
+#include "vm.h"
+#include "buddy.h"
+#include "compact.h"
+#include "tier.h"
+
+/**
+ * tier_fast_end(@vm)
+ *
+ * RETURN
+ *   The first frame of the slow tier. The frames below it are in the fast
+ *   tier
+ */
+unsigned int tier_fast_end(struct vm_machine *vm)
+{
+	if (vm->config.nr_fast_frames > vm->config.nr_pageframes) {
+		return vm->config.nr_pageframes;
+	}
+	return vm->config.nr_fast_frames;
+}
+
+/**
+ * tier_alloc(@vm, @zone)
+ *
+ * DESCRIPTION
+ *   Allocate a free frame from @zone, from the fast tier if possible and
+ *   from the slow tier otherwise. The frame starts out as referenced.
+ *
+ * RETURN
+ *   The pfn of the frame, or -1 if no frame is available
+ */
+unsigned int tier_alloc(struct vm_machine *vm, struct buddy *zone)
+{
+	unsigned int pfn = buddy_alloc_range(zone, 0, tier_fast_end(vm));
+
+	if (pfn == -1) {
+		pfn = buddy_alloc_range(zone, tier_fast_end(vm), vm->config.nr_pageframes);
+	}
+	if (pfn != -1) vm->tier_ages[pfn] = 0;
+
+	return pfn;
+}
+
+/**
+ * __find_cold(@vm)
+ *
+ * RETURN
+ *   The movable frame in the fast tier unreferenced for the most scans, at
+ *   least TIER_COLD_SCANS, or -1 if there is no such frame
+ */
+static unsigned int __find_cold(struct vm_machine *vm)
+{
+	unsigned int cold = -1;
+
+	for (unsigned int pfn = 0; pfn < tier_fast_end(vm); pfn++) {
+		if (vm->tier_ages[pfn] < TIER_COLD_SCANS) continue;
+		if (!vm->mapcounts[pfn] || !is_movable_page(vm, pfn)) continue;
+
+		if (cold == -1 || vm->tier_ages[pfn] > vm->tier_ages[cold]) cold = pfn;
+	}
+	return cold;
+}
+
+/**
+ * __demote(@vm)
+ *
+ * DESCRIPTION
+ *   Move the coldest page in the fast tier to a free frame in the slow tier.
+ *
+ * RETURN
+ *   @true if a page is demoted
+ */
+static bool __demote(struct vm_machine *vm)
+{
+	unsigned int from = __find_cold(vm);
+	unsigned int to;
+
+	if (from == -1) return false;
+
+	to = buddy_alloc_range(&vm->zone, tier_fast_end(vm), vm->config.nr_pageframes);
+	if (to == -1) return false;
+
+	migrate_page(vm, from, to);
+	vm->stats.nr_tier_demotions++;
+
+	return true;
+}
+
+/**
+ * __sample_accessed(@vm, @referenced)
+ *
+ * DESCRIPTION
+ *   Harvest the accessed bits of the PTEs of every process into @referenced
+ *   for each frame, and clear them. The TLB entries of the sampled pages are
+ *   flushed as well, so that the next access walks the page table and sets
+ *   the accessed bit again. Huge pages are not tiered.
+ */
+static void __sample_accessed(struct vm_machine *vm, bool *referenced)
+{
+	for (struct process *p = vm->current; p; p = next_process(vm, p)) {
+		for (int i = 0; i < NR_PDES_PER_PAGE; i++) {
+			struct pte_directory *pd = p->pagetable.pdes[i];
+
+			if (!pd) continue;
+
+			for (int j = 0; j < NR_PTES_PER_PAGE; j++) {
+				struct pte *pte = &pd->ptes[j];
+
+				if (!pte_valid(pte) || !pte_accessed(pte)) continue;
+
+				referenced[pte_pfn(pte)] = true;
+				pte_set_flag(pte, PTE_ACCESSED, false);
+				flush_tlb_range(vm, p, i * NR_PTES_PER_PAGE + j, 1);
+			}
+		}
+	}
+}
+
+/**
+ * tier_scan(@vm)
+ *
+ * DESCRIPTION
+ *   Age the frames in use by sampling the accessed bits, and rebalance the
+ *   tiers. A page in the slow tier referenced since the last scan is hot,
+ *   and is promoted to the fast tier. A page in the fast tier unreferenced
+ *   for TIER_COLD_SCANS scans or more is cold, and is demoted to the slow
+ *   tier to make room for the promotions, or to keep TIER_FREE_RATIO of the
+ *   fast tier free for new allocations.
+ *
+ * RETURN
+ *   The number of pages migrated between the tiers
+ */
+unsigned int tier_scan(struct vm_machine *vm)
+{
+	unsigned int fast_end = tier_fast_end(vm);
+	unsigned long nr_migrations = vm->stats.nr_tier_promotions + vm->stats.nr_tier_demotions;
+	bool *referenced = calloc(vm->config.nr_pageframes, sizeof(*referenced));
+
+	__sample_accessed(vm, referenced);
+
+	for (unsigned int pfn = 0; pfn < vm->config.nr_pageframes; pfn++) {
+		if (!vm->mapcounts[pfn]) continue;
+
+		if (referenced[pfn]) {
+			vm->tier_ages[pfn] = 0;
+		} else if (vm->tier_ages[pfn] < (unsigned char)-1) {
+			vm->tier_ages[pfn]++;
+		}
+	}
+
+	for (unsigned int pfn = fast_end; pfn < vm->config.nr_pageframes; pfn++) {
+		unsigned int to;
+
+		if (!referenced[pfn] || !is_movable_page(vm, pfn)) continue;
+
+		to = buddy_alloc_range(&vm->zone, 0, fast_end);
+		if (to == -1 && __demote(vm)) {
+			to = buddy_alloc_range(&vm->zone, 0, fast_end);
+		}
+		if (to == -1) break;
+
+		migrate_page(vm, pfn, to);
+		vm->stats.nr_tier_promotions++;
+	}
+
+	while (buddy_nr_free_range(&vm->zone, 0, fast_end) < fast_end / TIER_FREE_RATIO) {
+		if (!__demote(vm)) break;
+	}
+	free(referenced);
+
+	vm->stats.nr_tier_scans++;
+
+	return vm->stats.nr_tier_promotions + vm->stats.nr_tier_demotions - nr_migrations;
+}
+
+/**
+ * tier_show(@vm, @out)
+ *
+ * DESCRIPTION
+ *   Report the fraction of the accesses served from each tier, their cost,
+ *   and the pages migrated between the tiers.
+ */
+void tier_show(struct vm_machine *vm, FILE *out)
+{
+	unsigned long nr_accesses = vm->stats.nr_tier_fast + vm->stats.nr_tier_slow;
+	unsigned long cycles = vm->stats.nr_tier_fast * vm->config.tier_fast_cycles +
+			vm->stats.nr_tier_slow * vm->config.tier_slow_cycles;
+
+	fprintf(out, "tiers        : %lu fast, %lu slow (%.2f%% fast)\n",
+			vm->stats.nr_tier_fast, vm->stats.nr_tier_slow,
+			nr_accesses ? vm->stats.nr_tier_fast * 100.0 / nr_accesses : 0.0);
+	fprintf(out, "  access cost: %lu cycles (%.1f per access)\n", cycles,
+			nr_accesses ? (double)cycles / nr_accesses : 0.0);
+	fprintf(out, "  migrations : %lu promoted, %lu demoted in %lu scans\n",
+			vm->stats.nr_tier_promotions, vm->stats.nr_tier_demotions,
+			vm->stats.nr_tier_scans);
+	fprintf(out, "  fast tier  : frames 0 - %u, %u free\n", tier_fast_end(vm) - 1,
+			buddy_nr_free_range(&vm->zone, 0, tier_fast_end(vm)));
+	fprintf(out, "  slow tier  : frames %u - %u, %u free\n", tier_fast_end(vm),
+			vm->config.nr_pageframes - 1,
+			buddy_nr_free_range(&vm->zone, tier_fast_end(vm), vm->config.nr_pageframes));
+}
@@ -0,0 +1,28 @@
+/**********************************************************************
+ * Copyright (c) 2019-2024
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+#ifndef __TIER_H__
+#define __TIER_H__
+
+#include <stdio.h>
+
+struct vm_machine;
+struct buddy;
+
+unsigned int tier_fast_end(struct vm_machine *vm);
+unsigned int tier_alloc(struct vm_machine *vm, struct buddy *zone);
+unsigned int tier_scan(struct vm_machine *vm);
+void tier_show(struct vm_machine *vm, FILE *out);
+
+#endif
@@ -0,0 +1,317 @@
+/**********************************************************************
+ * Copyright (c) 2019-2024
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TLB_SIMD
+#endif
+
+#include "tlb.h"
+#include "libvm.h"
+
+/**
+ * __valid_bits(@valid, @index, @nr)
+ *
+ * RETURN
+ *   The valid bits of the @nr (up to 64) entries from @index, in the lower
+ *   bits. The bits of the other CPUs may be updated concurrently.
+ */
+static inline uint64_t __valid_bits(const uint64_t *valid, unsigned int index, unsigned int nr)
+{
+	unsigned int shift = index % 64;
+	uint64_t bits = __atomic_load_n(valid + index / 64, __ATOMIC_RELAXED) >> shift;
+
+	if (shift + nr > 64) {
+		bits |= __atomic_load_n(valid + index / 64 + 1, __ATOMIC_RELAXED) << (64 - shift);
+	}
+	return nr == 64 ? bits : bits & ((1ULL << nr) - 1);
+}
+
+void tlb_index_set(uint32_t *tags, uint64_t *valid, unsigned int index, uint32_t tag)
+{
+	tags[index] = tag;
+	__atomic_fetch_or(valid + index / 64, 1ULL << (index % 64), __ATOMIC_RELAXED);
+}
+
+void tlb_index_clear(uint64_t *valid, unsigned int index)
+{
+	__atomic_fetch_and(valid + index / 64, ~(1ULL << (index % 64)), __ATOMIC_RELAXED);
+}
+
+static int __search_scalar(const uint32_t *tags, const uint64_t *valid, unsigned int first, unsigned int nr, uint32_t tag)
+{
+	for (unsigned int i = 0; i < nr; i++) {
+		if (tags[first + i] == tag && __valid_bits(valid, first + i, 1)) return i;
+	}
+	return -1;
+}
+
+#ifdef TLB_SIMD
+/**
+ * The vectorized searches compare four vectors of tags at once, and test the
+ * matches of all of them with a single movemask. The valid bits are looked
+ * into only on the tag matches, which are rare on the misses.
+ */
+__attribute__((target("sse2")))
+static inline unsigned int __cmpeq_sse2(const uint32_t *tags, __m128i key)
+{
+	__m128i v = _mm_loadu_si128((const __m128i *)tags);
+
+	return _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(v, key)));
+}
+
+__attribute__((target("sse2")))
+static int __search_sse2(const uint32_t *tags, const uint64_t *valid, unsigned int first, unsigned int nr, uint32_t tag)
+{
+	__m128i key = _mm_set1_epi32(tag);
+	unsigned int i;
+	int found;
+
+	for (i = 0; i + 16 <= nr; i += 16) {
+		const __m128i *v = (const __m128i *)(tags + first + i);
+		__m128i any = _mm_or_si128(
+				_mm_or_si128(_mm_cmpeq_epi32(_mm_loadu_si128(v), key),
+						_mm_cmpeq_epi32(_mm_loadu_si128(v + 1), key)),
+				_mm_or_si128(_mm_cmpeq_epi32(_mm_loadu_si128(v + 2), key),
+						_mm_cmpeq_epi32(_mm_loadu_si128(v + 3), key)));
+		uint64_t mask;
+
+		if (!_mm_movemask_epi8(any)) continue;
+
+		mask = __cmpeq_sse2(tags + first + i, key) |
+				__cmpeq_sse2(tags + first + i + 4, key) << 4 |
+				__cmpeq_sse2(tags + first + i + 8, key) << 8 |
+				__cmpeq_sse2(tags + first + i + 12, key) << 12;
+		mask &= __valid_bits(valid, first + i, 16);
+		if (mask) return i + __builtin_ctzll(mask);
+	}
+	for (; i + 4 <= nr; i += 4) {
+		unsigned int mask = __cmpeq_sse2(tags + first + i, key);
+
+		if (mask && (mask &= __valid_bits(valid, first + i, 4))) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+	found = __search_scalar(tags, valid, first + i, nr - i, tag);
+	return found < 0 ? -1 : i + found;
+}
+
+__attribute__((target("avx2")))
+static inline uint64_t __cmpeq_avx2(const uint32_t *tags, __m256i key)
+{
+	__m256i v = _mm256_loadu_si256((const __m256i *)tags);
+
+	return (unsigned int)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(v, key)));
+}
+
+__attribute__((target("avx2")))
+static int __search_avx2(const uint32_t *tags, const uint64_t *valid, unsigned int first, unsigned int nr, uint32_t tag)
+{
+	__m256i key = _mm256_set1_epi32(tag);
+	unsigned int i;
+	int found;
+
+	for (i = 0; i + 32 <= nr; i += 32) {
+		const __m256i *v = (const __m256i *)(tags + first + i);
+		__m256i any = _mm256_or_si256(
+				_mm256_or_si256(_mm256_cmpeq_epi32(_mm256_loadu_si256(v), key),
+						_mm256_cmpeq_epi32(_mm256_loadu_si256(v + 1), key)),
+				_mm256_or_si256(_mm256_cmpeq_epi32(_mm256_loadu_si256(v + 2), key),
+						_mm256_cmpeq_epi32(_mm256_loadu_si256(v + 3), key)));
+		uint64_t mask;
+
+		if (_mm256_testz_si256(any, any)) continue;
+
+		mask = __cmpeq_avx2(tags + first + i, key) |
+				__cmpeq_avx2(tags + first + i + 8, key) << 8 |
+				__cmpeq_avx2(tags + first + i + 16, key) << 16 |
+				__cmpeq_avx2(tags + first + i + 24, key) << 24;
+		mask &= __valid_bits(valid, first + i, 32);
+		if (mask) return i + __builtin_ctzll(mask);
+	}
+	for (; i + 8 <= nr; i += 8) {
+		uint64_t mask = __cmpeq_avx2(tags + first + i, key);
+
+		if (mask && (mask &= __valid_bits(valid, first + i, 8))) {
+			return i + __builtin_ctzll(mask);
+		}
+	}
+	found = __search_scalar(tags, valid, first + i, nr - i, tag);
+	return found < 0 ? -1 : i + found;
+}
+#endif
+
+typedef int (*search_fn)(const uint32_t *, const uint64_t *, unsigned int, unsigned int, uint32_t);
+
+static const struct {
+	const char *name;
+	search_fn search;
+} searches[] = {
+	{ "scalar", __search_scalar },
+#ifdef TLB_SIMD
+	{ "sse2", __search_sse2 },
+	{ "avx2", __search_avx2 },
+#endif
+};
+
+static bool __supported(unsigned int i)
+{
+#ifdef TLB_SIMD
+	if (searches[i].search == __search_sse2) return __builtin_cpu_supports("sse2");
+	if (searches[i].search == __search_avx2) return __builtin_cpu_supports("avx2");
+#endif
+	return true;
+}
+
+static unsigned int selected;
+static pthread_once_t select_once = PTHREAD_ONCE_INIT;
+
+/* Pick the widest search the CPU supports */
+static void __select(void)
+{
+	__builtin_cpu_init();
+
+	for (unsigned int i = 0; i < sizeof(searches) / sizeof(*searches); i++) {
+		if (__supported(i)) selected = i;
+	}
+}
+
+/**
+ * tlb_search(@tags, @valid, @first, @nr, @tag)
+ *
+ * DESCRIPTION
+ *   Search the @nr entries from @first for the valid one tagged with @tag,
+ *   with the widest vector instructions available on the CPU.
+ *
+ * RETURN
+ *   The index of the entry from @first, or -1 if not found
+ */
+int tlb_search(const uint32_t *tags, const uint64_t *valid, unsigned int first, unsigned int nr, uint32_t tag)
+{
+	pthread_once(&select_once, __select);
+
+	return searches[selected].search(tags, valid, first, nr, tag);
+}
+
+const char *tlb_search_name(void)
+{
+	pthread_once(&select_once, __select);
+
+	return searches[selected].name;
+}
+
+/**
+ * tlb_search_invalid(@valid, @first, @nr)
+ *
+ * RETURN
+ *   The index of the first invalid entry among the @nr entries from @first,
+ *   or -1 if all are valid
+ */
+int tlb_search_invalid(const uint64_t *valid, unsigned int first, unsigned int nr)
+{
+	for (unsigned int i = 0; i < nr; i += 64) {
+		unsigned int n = nr - i < 64 ? nr - i : 64;
+		uint64_t invalid = ~__valid_bits(valid, first + i, n);
+
+		if (n < 64) invalid &= (1ULL << n) - 1;
+		if (invalid) return i + __builtin_ctzll(invalid);
+	}
+	return -1;
+}
+
+static unsigned long __nsecs_since(struct timespec *start)
+{
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_sec - start->tv_sec) * 1000000000UL + end.tv_nsec - start->tv_nsec;
+}
+
+/**
+ * tlb_bench(@nr_lookups, @out)
+ *
+ * DESCRIPTION
+ *   Measure the latency of hits and misses of the fully associative search
+ *   over 16 to 4096 valid entries, by each search the CPU supports, and
+ *   report them to @out. The hits are spread over the entries uniformly,
+ *   and the misses scan all.
+ *
+ * RETURN
+ *   0 on success, or -LIBVM_ENOMEM
+ */
+int tlb_bench(unsigned long nr_lookups, FILE *out)
+{
+	const unsigned int max_entries = 4096;
+	uint32_t *tags = malloc(max_entries * sizeof(*tags));
+	uint64_t *valid = malloc(max_entries / 64 * sizeof(*valid));
+	uint32_t *keys = malloc(nr_lookups * sizeof(*keys));
+	unsigned int seed = 0x2545f491;
+
+	if (!tags || !valid || !keys) {
+		free(tags);
+		free(valid);
+		free(keys);
+		return -LIBVM_ENOMEM;
+	}
+
+	/* Distinct tags, all valid */
+	for (unsigned int i = 0; i < max_entries; i++) tags[i] = (7 << TLB_TAG_ASID_SHIFT) | i;
+	memset(valid, 0xff, max_entries / 64 * sizeof(*valid));
+
+	fprintf(out, "%-7s | %7s | %9s | %10s\n", "search", "entries", "hit ns", "miss ns");
+
+	for (unsigned int nr_entries = 16; nr_entries <= max_entries; nr_entries *= 4) {
+		for (unsigned long i = 0; i < nr_lookups; i++) {
+			seed ^= seed << 13;
+			seed ^= seed >> 17;
+			seed ^= seed << 5;
+			keys[i] = tags[seed % nr_entries];
+		}
+
+		for (unsigned int s = 0; s < sizeof(searches) / sizeof(*searches); s++) {
+			volatile long sum = 0;
+			unsigned long hit_nsecs, miss_nsecs;
+			struct timespec start;
+
+			if (!__supported(s)) continue;
+
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			for (unsigned long i = 0; i < nr_lookups; i++) {
+				sum += searches[s].search(tags, valid, 0, nr_entries, keys[i]);
+			}
+			hit_nsecs = __nsecs_since(&start);
+
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			for (unsigned long i = 0; i < nr_lookups; i++) {
+				sum += searches[s].search(tags, valid, 0, nr_entries, keys[i] ^ TLB_TAG_HUGE);
+			}
+			miss_nsecs = __nsecs_since(&start);
+
+			fprintf(out, "%-7s | %7u | %9.2f | %10.2f\n", searches[s].name, nr_entries,
+					(double)hit_nsecs / nr_lookups, (double)miss_nsecs / nr_lookups);
+		}
+	}
+	free(tags);
+	free(valid);
+	free(keys);
+	return 0;
+}
@@ -0,0 +1,44 @@
+/**********************************************************************
+ * Copyright (c) 2019-2024
+ *  Sang-Hoon Kim <sanghoonkim@ajou.ac.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTIABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ **********************************************************************/
+#ifndef __TLB_H__
+#define __TLB_H__
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Structure-of-arrays index of the TLB entries, searched with SIMD compares.
+ * Each entry has a 32-bit tag in a dense array and a bit in a valid
+ * bitmask, in the order of the entries. The tag holds the address space ID
+ * above TLB_TAG_ASID_SHIFT, and the VPN below it, or the huge page number
+ * with TLB_TAG_HUGE for the huge entries.
+ * The address space ID keeps the low 16 bits of the pid only, so pids 65536
+ * apart share it. It is never relied on to tell processes apart, as the TLB
+ * is flushed on every context switch and holds the entries of one process.
+ */
+#define TLB_TAG_HUGE		(1U << 15)
+#define TLB_TAG_ASID_SHIFT	16
+
+void tlb_index_set(uint32_t *tags, uint64_t *valid, unsigned int index, uint32_t tag);
+void tlb_index_clear(uint64_t *valid, unsigned int index);
+
+int tlb_search(const uint32_t *tags, const uint64_t *valid, unsigned int first, unsigned int nr, uint32_t tag);
+int tlb_search_invalid(const uint64_t *valid, unsigned int first, unsigned int nr);
+const char *tlb_search_name(void);
+
+int tlb_bench(unsigned long nr_lookups, FILE *out);
+
+#endif
@@ -18,138 +18,1012 @@
 #include <stdbool.h>
 #include <string.h>
 #include <assert.h>
-#include <getopt.h>
 #include <ctype.h>
 #include <inttypes.h>
 #include <strings.h>
+#include <time.h>
+#include <sys/mman.h>
 
 #include "parser.h"
 
 #include "list_head.h"
 #include "vm.h"
+#include "buddy.h"
+#include "compact.h"
+#include "khugepaged.h"
+#include "replay.h"
+#include "sweep.h"
+#include "mrc.h"
+#include "smp.h"
+#include "numa.h"
+#include "tier.h"
+#include "checkpoint.h"
+
+const char * const vm_cost_names[NR_COSTS] = {
+	[COST_TLB] = "tlb",
+	[COST_WALK] = "walk",
+	[COST_FAULT] = "fault",
+	[COST_COW] = "cow",
+	[COST_ZERO] = "zero",
+	[COST_MEMORY] = "memory",
+	[COST_SWITCH] = "switch",
+	[COST_SHOOTDOWN] = "shootdown",
+};
 
-static bool verbose = true;
+/**
+ * Default cycles of the cost components. No cache is modeled, so each level
+ * of the page table walks goes to the memory.
+ */
+static const unsigned int default_latencies[NR_COSTS] = {
+	[COST_TLB] = 1,
+	[COST_WALK] = TIER_FAST_CYCLES,
+	[COST_FAULT] = 2000,
+	[COST_COW] = 3000,
+	[COST_ZERO] = 1500,
+	[COST_MEMORY] = TIER_FAST_CYCLES,
+	[COST_SWITCH] = 5000,
+	[COST_SHOOTDOWN] = TLB_SHOOTDOWN_IPI_CYCLES,
+};
 
-static bool print_tlb_result = false;
+/**
+ * vm_config_init(@config)
+ *
+ * DESCRIPTION
+ *   Fill @config with the default configuration.
+ */
+void vm_config_init(struct vm_config *config)
+{
+	config->use_tlb = false;
+	config->use_zero_page = false;
+	config->compaction_threshold = 500;
+	config->khugepaged_interval = 0;
+	config->nr_tlb_entries = NR_TLB_ENTRIES;
+	config->tlb_ways = 0;
+	config->tlb_policy = TLB_POLICY_LRU;
+	config->nr_pageframes = NR_PAGEFRAMES;
+	config->mrc_rate = 0.0;
+	config->nr_cpus = 1;
+	config->pcp_high = 0;
+	config->pcp_low = 0;
+	config->pcp_batch = 0;
+	config->nr_nodes = 1;
+	config->mempolicy.mode = NUMA_FIRST_TOUCH;
+	config->mempolicy.node = -1;
+	config->mempolicy.next = 0;
+	config->nr_fast_frames = 0;
+	config->tier_interval = 64;
+	config->tier_fast_cycles = TIER_FAST_CYCLES;
+	config->tier_slow_cycles = TIER_SLOW_CYCLES;
+	memcpy(config->latencies, default_latencies, sizeof(config->latencies));
+	config->nr_cache_levels = 0;
+	config->nr_pwc_entries = 0;
+	config->use_ipt = false;
+	config->use_nested = false;
+	config->use_nested_huge = false;
+	config->interactive = false;
+}
 
 /**
- * Initial process
+ * vm_machine_init(@vm, @config)
+ *
+ * DESCRIPTION
+ *   Initialize @vm with @config. The machine starts with the initial process
+ *   (pid 0) running on all CPUs, empty page table and TLBs, and all page
+ *   frames free. CPU 0 executes the commands first.
+ *   On failure, @vm is left empty so that vm_machine_exit() on it does
+ *   nothing.
+ *
+ * RETURN
+ *   0 on success, -LIBVM_EINVAL if @config is invalid, or -LIBVM_ENOMEM
  */
-static struct process init = {
-	.pid = 0,
-	.list = LIST_HEAD_INIT(init.list),
-	.pagetable = {
-		.pdes = { NULL },
-	},
-};
+int vm_machine_init(struct vm_machine *vm, const struct vm_config *config)
+{
+	unsigned int nr_cpus = 0;
+
+	memset(vm, 0x00, sizeof(*vm));
+	INIT_LIST_HEAD(&vm->processes);
+	if (vm_config_check(config)) return -LIBVM_EINVAL;
+
+	vm->config = *config;
+	if (!vm->config.tlb_ways) vm->config.tlb_ways = vm->config.nr_tlb_entries;
+
+	/* A quarter of the frames per CPU are cached at most by default */
+	if (!vm->config.pcp_batch) {
+		vm->config.pcp_batch = vm->config.nr_pageframes / vm->config.nr_cpus / 8;
+		if (vm->config.pcp_batch > PCP_MAX_BATCH) vm->config.pcp_batch = PCP_MAX_BATCH;
+		if (!vm->config.pcp_batch) vm->config.pcp_batch = 1;
+		if (vm->config.pcp_high && vm->config.pcp_batch > vm->config.pcp_high) {
+			vm->config.pcp_batch = vm->config.pcp_high;
+		}
+	}
+	if (!vm->config.pcp_high) vm->config.pcp_high = vm->config.pcp_batch * 2;
+	if (vm->config.pcp_low >= vm->config.pcp_high) {
+		memset(&vm->config, 0x00, sizeof(vm->config));
+		return -LIBVM_EINVAL;
+	}
+
+	vm->nr_tlb_sets = vm->config.nr_tlb_entries / vm->config.tlb_ways;
+	vm->tlb_seed = 0x2545f491;
+
+	vm->mapcounts = calloc(vm->config.nr_pageframes, sizeof(*vm->mapcounts));
+	if (vm->config.nr_fast_frames) {
+		vm->tier_ages = calloc(vm->config.nr_pageframes, sizeof(*vm->tier_ages));
+	}
+
+	vm->init.pid = 0;
+	vm->init.mempolicy = vm->config.mempolicy;
+	INIT_LIST_HEAD(&vm->init.list);
+	for (int i = 0; i < NR_PDES_PER_PAGE; i++) {
+		pthread_mutex_init(&vm->init.pagetable.locks[i], NULL);
+	}
+
+	vm->cpus = calloc(vm->config.nr_cpus, sizeof(*vm->cpus));
+	vm->tlb_tags = calloc(vm->config.nr_cpus * vm->config.nr_tlb_entries,
+			sizeof(*vm->tlb_tags));
+	vm->tlb_valid = calloc((vm->config.nr_cpus * vm->config.nr_tlb_entries + 63) / 64,
+			sizeof(*vm->tlb_valid));
+	if (!vm->mapcounts || (vm->config.nr_fast_frames && !vm->tier_ages) ||
+			!vm->cpus || !vm->tlb_tags || !vm->tlb_valid) goto out_free;
+
+	vm->cpus[0].tlb = calloc(vm->config.nr_cpus * vm->config.nr_tlb_entries,
+			sizeof(struct tlb_entry));
+	if (!vm->cpus[0].tlb) goto out_free;
+
+	for (nr_cpus = 0; nr_cpus < vm->config.nr_cpus; nr_cpus++) {
+		struct vm_cpu *cpu = vm->cpus + nr_cpus;
+
+		cpu->current = &vm->init;
+		cpu->ptbr = &vm->init.pagetable;
+		cpu->tlb = vm->cpus[0].tlb + nr_cpus * vm->config.nr_tlb_entries;
+		pthread_mutex_init(&cpu->tlb_lock, NULL);
+		if (vm->config.nr_pwc_entries) {
+			cpu->pwc = calloc(vm->config.nr_pwc_entries, sizeof(*cpu->pwc));
+			if (!cpu->pwc) goto out_cpus;
+		}
+		if (!pcp_init(&cpu->pcp, vm->config.pcp_high, vm->config.pcp_low,
+					vm->config.pcp_batch)) {
+			free(cpu->pwc);
+			goto out_cpus;
+		}
+		vm->init.cpumask |= 1UL << nr_cpus;
+	}
+
+	vm->cpu = 0;
+	vm->current = vm->cpus[0].current;
+	vm->ptbr = vm->cpus[0].ptbr;
+	vm->tlb = vm->cpus[0].tlb;
+
+	vm->out = stderr;
+	vm->con = stdout;
+
+	if (!buddy_init(&vm->zone, vm->config.nr_pageframes)) goto out_cpus;
+	pthread_mutex_init(&vm->zone_lock, NULL);
+
+	if (vm->config.mrc_rate && !mrc_init(&vm->mrc, vm->config.mrc_rate)) goto out_buddy;
+	if (vm->config.nr_cache_levels &&
+			!cache_init(&vm->cache, vm->config.caches, vm->config.nr_cache_levels)) {
+		goto out_mrc;
+	}
+	if (vm->config.use_ipt && !ipt_init(&vm->ipt, vm->config.nr_pageframes)) goto out_cache;
+	if (vm->config.use_nested) nested_init(&vm->nested);
+	pthread_mutex_init(&vm->ipt_lock, NULL);
+
+	/* Pin the zero page so that it can never be freed */
+	if (vm->config.use_zero_page) {
+		unsigned int pfn = buddy_alloc(&vm->zone, 0);
+
+		assert(pfn == ZERO_PFN);
+		vm->mapcounts[pfn] = 1;
+	}
+	return 0;
+
+out_cache:
+	if (vm->config.nr_cache_levels) cache_exit(&vm->cache);
+out_mrc:
+	if (vm->config.mrc_rate) mrc_exit(&vm->mrc);
+out_buddy:
+	buddy_exit(&vm->zone);
+out_cpus:
+	while (nr_cpus--) {
+		pcp_exit(&vm->cpus[nr_cpus].pcp);
+		free(vm->cpus[nr_cpus].pwc);
+	}
+	free(vm->cpus[0].tlb);
+out_free:
+	free(vm->mapcounts);
+	free(vm->tier_ages);
+	free(vm->tlb_tags);
+	free(vm->tlb_valid);
+	free(vm->cpus);
+
+	memset(vm, 0x00, sizeof(*vm));
+	INIT_LIST_HEAD(&vm->processes);
+	return -LIBVM_ENOMEM;
+}
+
+static void __free_process(struct vm_machine *vm, struct process *p)
+{
+	for (int i = 0; i < NR_PDES_PER_PAGE; i++) {
+		vm_free(vm, p->pagetable.pdes[i]);
+		p->pagetable.pdes[i] = NULL;
+	}
+	if (p != &vm->init) vm_free(vm, p);
+}
 
 /**
- * Current process. Should not be listed in the @processes
+ * vm_machine_exit(@vm)
+ *
+ * DESCRIPTION
+ *   Release the resources of @vm.
  */
-struct process *current = &init;
+void vm_machine_exit(struct vm_machine *vm)
+{
+	struct process *p, *tmp;
+
+	list_for_each_entry_safe(p, tmp, &vm->processes, list) {
+		list_del_init(&p->list);
+		__free_process(vm, p);
+	}
+
+	/* Free the running ones once, at their first CPUs. Not to look into freed ones */
+	for (unsigned int i = 0; i < vm->config.nr_cpus; i++) {
+		unsigned int first = 0;
+
+		p = cpu_current(vm, i);
+		while (cpu_current(vm, first) != p) first++;
+		if (first == i) __free_process(vm, p);
+	}
+
+	buddy_exit(&vm->zone);
+	if (vm->config.mrc_rate) mrc_exit(&vm->mrc);
+	if (vm->config.nr_cache_levels) cache_exit(&vm->cache);
+	if (vm->config.use_ipt) ipt_exit(&vm->ipt);
+	if (vm->config.use_nested) nested_exit(&vm->nested);
+	free(vm->mapcounts);
+	free(vm->tier_ages);
+	for (unsigned int i = 0; i < vm->config.nr_cpus; i++) {
+		pcp_exit(&vm->cpus[i].pcp);
+		free(vm->cpus[i].pwc);
+	}
+	if (vm->cpus) free(vm->cpus[0].tlb);
+	free(vm->tlb_tags);
+	free(vm->tlb_valid);
+	free(vm->cpus);
+	if (vm->snapshot) munmap(vm->snapshot, vm->snapshot_size);
+}
 
 /**
- * Ready queue. Put @current process to the tail of this list on
- * switch_process(). Don't forget to remove the switched process from the list.
+ * next_process(@vm, @p)
+ *
+ * DESCRIPTION
+ *   Iterate the processes on @vm; @current first, the ones running on the
+ *   other CPUs next, and then the ones in @processes. Start from @current,
+ *   and stop on NULL. A process running on multiple CPUs is visited once.
  */
-LIST_HEAD(processes);
+struct process *next_process(struct vm_machine *vm, struct process *p)
+{
+	if (p->cpumask) {
+		unsigned int cpu = p == vm->current ? 0 : ffsl(p->cpumask);
+
+		for (; cpu < vm->config.nr_cpus; cpu++) {
+			struct process *next = cpu_current(vm, cpu);
+
+			if (next != vm->current && ffsl(next->cpumask) - 1 == cpu) return next;
+		}
+		return list_first_entry_or_null(&vm->processes, struct process, list);
+	}
+	if (list_is_last(&p->list, &vm->processes)) return NULL;
+
+	return list_next_entry(p, list);
+}
 
 /**
- * Page table base register
+ * cpu_current(@vm, @cpu)
+ *
+ * RETURN
+ *   The process running on @cpu
  */
-struct pagetable *ptbr = NULL;
+struct process *cpu_current(struct vm_machine *vm, unsigned int cpu)
+{
+	return cpu == vm->cpu ? vm->current : vm->cpus[cpu].current;
+}
 
 /**
- * Map count for each page frame
+ * select_cpu(@vm, @cpu)
+ *
+ * DESCRIPTION
+ *   Make @cpu execute the following commands. The states of the executing
+ *   CPU are saved, and the ones of @cpu are loaded into @vm.
  */
-unsigned int mapcounts[NR_PAGEFRAMES] = { 0 };
+void select_cpu(struct vm_machine *vm, unsigned int cpu)
+{
+	struct vm_cpu *prev = vm->cpus + vm->cpu;
+	struct vm_cpu *next = vm->cpus + cpu;
+
+	if (cpu == vm->cpu) return;
+
+	prev->current = vm->current;
+	prev->ptbr = vm->ptbr;
+
+	vm->cpu = cpu;
+	vm->current = next->current;
+	vm->ptbr = next->ptbr;
+	vm->tlb = next->tlb;
+}
+
+static unsigned int __flush_tlb_range(struct vm_machine *vm, struct tlb_entry *tlb, unsigned int start, unsigned int nr_pages)
+{
+	unsigned int nr_flushed = 0;
+
+	for (int i = 0; i < vm->config.nr_tlb_entries; i++) {
+		struct tlb_entry *t = tlb + i;
+
+		if (!t->valid) continue;
+		if (t->huge ? (t->vpn + NR_PAGES_PER_HUGE <= start || t->vpn >= start + nr_pages) :
+				(t->vpn - start >= nr_pages)) continue;
+
+		vm_tlb_invalidate(vm, t);
+		nr_flushed++;
+	}
+	return nr_flushed;
+}
 
 /**
- * TLB of the system
+ * flush_tlb_range(@vm, @p, @start, @nr_pages)
+ *
+ * DESCRIPTION
+ *   Invalidate the TLB entries translating the pages [@start, @start +
+ *   @nr_pages) of @p on every CPU running @p, including the huge entries
+ *   overlapping with the range. The executing CPU flushes its own TLB, and
+ *   the other CPUs are interrupted to shoot down theirs, one IPI per CPU.
+ *   The entries in the inverted page table are dropped as well, whether @p
+ *   is running or not.
  */
-struct tlb_entry tlb[NR_TLB_ENTRIES] = {
-	{false, 0, 0},
-};
+void flush_tlb_range(struct vm_machine *vm, struct process *p, unsigned int start, unsigned int nr_pages)
+{
+	struct vm_machine *machine = vm->concurrent ? vm->main : vm;
+	unsigned long targets = p->cpumask;
+	bool remote = false;
+
+	if (vm->config.use_ipt) {
+		vm_lock(vm, &machine->ipt_lock);
+		ipt_invalidate(&machine->ipt, p->pid, start, nr_pages);
+		vm_unlock(vm, &machine->ipt_lock);
+	}
 
-extern unsigned int alloc_page(unsigned int vpn, unsigned int rw);
-extern void free_page(unsigned int vpn);
-extern bool handle_page_fault(unsigned int vpn, unsigned int rw);
-extern void switch_process(unsigned int pid);
+	while (targets) {
+		unsigned int cpu = ffsl(targets) - 1;
 
-extern bool lookup_tlb(unsigned int vpn, unsigned int rw, unsigned int *pfn);
-extern void insert_tlb(unsigned int vpn, unsigned int rw, unsigned int pfn);
+		targets &= targets - 1;
+
+		vm_lock(vm, &vm->cpus[cpu].tlb_lock);
+		if (cpu == vm->cpu) {
+			__flush_tlb_range(vm, vm->tlb, start, nr_pages);
+		} else {
+			vm->stats.nr_ipis++;
+			vm_charge(vm, COST_SHOOTDOWN, 1);
+			vm->stats.nr_shootdown_flushes +=
+					__flush_tlb_range(vm, vm->cpus[cpu].tlb, start, nr_pages);
+			__atomic_add_fetch(&vm->cpus[cpu].nr_ipis, 1, __ATOMIC_RELAXED);
+			remote = true;
+		}
+		vm_unlock(vm, &vm->cpus[cpu].tlb_lock);
+	}
+	if (remote) vm->stats.nr_shootdowns++;
+}
 
 /**
- * __translate()
+ * get_page_frame(@vm)
  *
  * DESCRIPTION
- *   This function simulates the address translation in MMU.
- *   It translates @vpn to @pfn using the page table pointed by @ptbr.
+ *   Allocate a free page frame. The serial simulation takes the one with the
+ *   smallest pfn from the buddy allocator. CPUs executing concurrently take
+ *   the smallest one from their frame caches instead, which are refilled
+ *   from the buddy allocator of @vm->main in batches. When the buddy
+ *   allocator runs out, the frames cached by the other CPUs are reclaimed.
+ *   With multiple memory nodes, the frame is placed according to the memory
+ *   policy of the @current process, and with the tiered memory, in the fast
+ *   tier first. Both bypass the frame caches, which are blind to them.
  *
  * RETURN
- *   @true on successful translation
- *   @false if unable to translate. This includes the case when the page access
- *   is for write (indicated in @rw), but @pte->rw indicates it's read-only.
+ *   The pfn of the frame, or -1 if no frame is available to the CPU
+ */
+unsigned int get_page_frame(struct vm_machine *vm)
+{
+	struct vm_machine *machine = vm->concurrent ? vm->main : vm;
+	struct pcp *pcp = &vm->cpus[vm->cpu].pcp;
+	unsigned int pfn;
+
+	if (vm->config.nr_nodes > 1) {
+		vm_lock(vm, &machine->zone_lock);
+		pfn = numa_alloc(vm, &machine->zone);
+		vm_unlock(vm, &machine->zone_lock);
+		return pfn;
+	}
+	if (vm->config.nr_fast_frames) {
+		vm_lock(vm, &machine->zone_lock);
+		pfn = tier_alloc(vm, &machine->zone);
+		vm_unlock(vm, &machine->zone_lock);
+		return pfn;
+	}
+
+	if (!vm->concurrent) return buddy_alloc(&vm->zone, 0);
+
+	pfn = pcp_alloc(pcp, &vm->main->zone, &vm->main->zone_lock);
+	if (pfn != -1) return pfn;
+
+	drain_page_frames(vm->main);
+
+	return pcp_alloc(pcp, &vm->main->zone, &vm->main->zone_lock);
+}
+
+/**
+ * put_page_frame(@vm, @pfn)
+ *
+ * DESCRIPTION
+ *   Free the page frame @pfn. CPUs executing concurrently keep it in their
+ *   frame caches, which give a batch of frames back to the buddy allocator of
+ *   @vm->main when they get over the high watermark.
+ */
+void put_page_frame(struct vm_machine *vm, unsigned int pfn)
+{
+	struct vm_machine *machine = vm->concurrent ? vm->main : vm;
+
+	if (!vm->concurrent || vm->config.nr_nodes > 1 || vm->config.nr_fast_frames) {
+		vm_lock(vm, &machine->zone_lock);
+		buddy_free(&machine->zone, pfn);
+		vm_unlock(vm, &machine->zone_lock);
+		return;
+	}
+	pcp_free(&vm->cpus[vm->cpu].pcp, &vm->main->zone, &vm->main->zone_lock, pfn);
+}
+
+/**
+ * drain_page_frames(@vm)
+ *
+ * DESCRIPTION
+ *   Give all the frames cached by the CPUs back to the buddy allocator of @vm.
+ */
+void drain_page_frames(struct vm_machine *vm)
+{
+	for (unsigned int i = 0; i < vm->config.nr_cpus; i++) {
+		pcp_drain(&vm->cpus[i].pcp, &vm->zone, &vm->zone_lock);
+	}
+}
+
+extern unsigned int alloc_page(struct vm_machine *vm, unsigned int vpn, unsigned int rw);
+extern unsigned int alloc_huge_page(struct vm_machine *vm, unsigned int vpn, unsigned int rw);
+extern void free_page(struct vm_machine *vm, unsigned int vpn);
+extern bool handle_page_fault(struct vm_machine *vm, unsigned int vpn, unsigned int rw);
+extern void switch_process(struct vm_machine *vm, unsigned int pid);
+
+extern bool lookup_tlb(struct vm_machine *vm, unsigned int vpn, unsigned int rw, unsigned int *pfn);
+extern void insert_tlb(struct vm_machine *vm, unsigned int vpn, unsigned int rw, unsigned int pfn, bool huge);
+
+static void __insert_tlb(struct vm_machine *vm, unsigned int vpn, unsigned int rw, unsigned int pfn, bool huge)
+{
+	vm_lock(vm, &vm->cpus[vm->cpu].tlb_lock);
+	insert_tlb(vm, vpn, rw, pfn, huge);
+	vm_unlock(vm, &vm->cpus[vm->cpu].tlb_lock);
+}
+
+/**
+ * __lookup_pwc(@vm, @pt, @pd_index)
+ *
+ * DESCRIPTION
+ *   Look up the page walk cache of the executing CPU for the page directory
+ *   at @pd_index of @pt. The entries are tagged with the pid of the process,
+ *   so they survive the context switches. Called with the lock for the page
+ *   directory slot held, so the directory cannot be freed under the walk.
+ *
+ * RETURN
+ *   The cached page directory, or NULL on miss or without the cache
+ */
+static struct pte_directory *__lookup_pwc(struct vm_machine *vm, struct pagetable *pt, int pd_index)
+{
+	struct vm_cpu *cpu = &vm->cpus[vm->cpu];
+	unsigned int pid = container_of(pt, struct process, pagetable)->pid;
+	struct pte_directory *pd = NULL;
+
+	if (!vm->config.nr_pwc_entries) return NULL;
+
+	vm_lock(vm, &cpu->tlb_lock);
+	cpu->pwc_clock++;
+	for (unsigned int i = 0; i < vm->config.nr_pwc_entries; i++) {
+		struct pwc_entry *e = cpu->pwc + i;
+
+		if (!e->valid || e->pid != pid || e->pd_index != pd_index) continue;
+
+		e->stamp = cpu->pwc_clock;
+		pd = e->pd;
+		break;
+	}
+	vm_unlock(vm, &cpu->tlb_lock);
+
+	if (pd) {
+		assert(pd == pt->pdes[pd_index]);
+		vm->stats.nr_pwc_hits++;
+	} else {
+		vm->stats.nr_pwc_misses++;
+	}
+	return pd;
+}
+
+/**
+ * __insert_pwc(@vm, @pt, @pd_index, @pd)
+ *
+ * DESCRIPTION
+ *   Cache the page directory @pd at @pd_index of @pt in the page walk cache
+ *   of the executing CPU, replacing the least recently used entry if full.
+ *   Only existing directories are cached, so directories newly allocated or
+ *   copied on fork need no invalidation; the freed ones do (see flush_pwc()).
+ */
+static void __insert_pwc(struct vm_machine *vm, struct pagetable *pt, int pd_index, struct pte_directory *pd)
+{
+	struct vm_cpu *cpu = &vm->cpus[vm->cpu];
+	struct pwc_entry *victim = cpu->pwc;
+
+	if (!vm->config.nr_pwc_entries) return;
+
+	vm_lock(vm, &cpu->tlb_lock);
+	for (unsigned int i = 0; i < vm->config.nr_pwc_entries; i++) {
+		struct pwc_entry *e = cpu->pwc + i;
+
+		if (!e->valid) {
+			victim = e;
+			break;
+		}
+		if (e->stamp < victim->stamp) victim = e;
+	}
+	victim->valid = true;
+	victim->pid = container_of(pt, struct process, pagetable)->pid;
+	victim->pd_index = pd_index;
+	victim->pd = pd;
+	victim->stamp = ++cpu->pwc_clock;
+	vm_unlock(vm, &cpu->tlb_lock);
+}
+
+/**
+ * flush_pwc(@vm, @p, @pd_index)
+ *
+ * DESCRIPTION
+ *   Invalidate the page walk cache entries for the page directory at
+ *   @pd_index of @p on every CPU, as the entries of @p may be left on the
+ *   CPUs it ran on before. Should be called before freeing the directory.
+ */
+void flush_pwc(struct vm_machine *vm, struct process *p, int pd_index)
+{
+	for (unsigned int i = 0; vm->config.nr_pwc_entries && i < vm->config.nr_cpus; i++) {
+		struct vm_cpu *cpu = &vm->cpus[i];
+
+		vm_lock(vm, &cpu->tlb_lock);
+		for (unsigned int j = 0; j < vm->config.nr_pwc_entries; j++) {
+			struct pwc_entry *e = cpu->pwc + j;
+
+			if (e->valid && e->pid == p->pid && e->pd_index == pd_index) e->valid = false;
+		}
+		vm_unlock(vm, &cpu->tlb_lock);
+	}
+}
+
+/**
+ * __cache_cycles(@vm, @paddr, @walk, @memory_cycles)
+ *
+ * DESCRIPTION
+ *   Access @paddr through the data caches, if modeled.
+ *
+ * RETURN
+ *   The cycles of the cache level hit, or @memory_cycles when it goes to
+ *   the memory
+ */
+static unsigned long __cache_cycles(struct vm_machine *vm, unsigned long paddr, bool walk, unsigned long memory_cycles)
+{
+	unsigned int level;
+
+	if (!vm->config.nr_cache_levels) return memory_cycles;
+
+	level = cache_access(&vm->cache, paddr, walk);
+	if (level == vm->cache.nr_levels) return memory_cycles;
+
+	return vm->cache.levels[level].config.cycles;
+}
+
+/**
+ * __walk_host(@vm, @gpfn, @rw, @huge)
+ *
+ * DESCRIPTION
+ *   Walk the host page table to translate the guest frame @gpfn for @rw.
+ *   The faults on the way exit to the host, which fixes up the mapping for
+ *   the walk to resume. @huge is set if a huge host page maps @gpfn.
+ *
+ * RETURN
+ *   The host pfn of @gpfn, with the protection of the host mapping in @rw
+ */
+static unsigned int __walk_host(struct vm_machine *vm, unsigned int gpfn, unsigned int *rw, bool *huge)
+{
+	struct nested *nested = &vm->nested;
+	unsigned int pd_index = gpfn / NR_PTES_PER_PAGE;
+	unsigned int pte_index = gpfn % NR_PTES_PER_PAGE;
+
+	for (int nr_retries = 0; nr_retries < 2; nr_retries++) {
+		struct pte *pte;
+
+		vm->stats.nr_host_walk_refs++;
+		vm_charge_cycles(vm, COST_WALK, __cache_cycles(vm,
+				NESTED_PD_PADDR + pd_index * PTE_SIZE, true,
+				vm->config.latencies[COST_WALK]));
+
+		if (pd_index < nested->nr_pdes && pte_valid(&nested->huge[pd_index])) {
+			pte = &nested->huge[pd_index];
+			*huge = true;
+			*rw = pte_rw(pte);
+			return pte_pfn(pte) + pte_index;
+		}
+
+		if (pd_index < nested->nr_pdes && nested->pdes[pd_index]) {
+			vm->stats.nr_host_walk_refs++;
+			vm_charge_cycles(vm, COST_WALK, __cache_cycles(vm,
+					NESTED_PTE_PADDR + ((unsigned long)pd_index << PAGE_SHIFT) +
+					pte_index * PTE_SIZE, true, vm->config.latencies[COST_WALK]));
+
+			pte = &nested->pdes[pd_index]->ptes[pte_index];
+			if (pte_valid(pte) && (!(*rw & ACCESS_WRITE) || (pte_rw(pte) & ACCESS_WRITE))) {
+				*huge = false;
+				*rw = pte_rw(pte);
+				return pte_pfn(pte);
+			}
+		}
+		nested_handle_fault(vm, gpfn, *rw);
+	}
+	assert(!"The host fault is not fixed up");
+	return -1;
+}
+
+/**
+ * __charge_walk(@vm, @pt, @pd_index, @pte_index)
+ *
+ * DESCRIPTION
+ *   Charge the read of an entry of @pt by a walk; the page directory entry
+ *   at @pd_index if @pte_index is negative, or the PTE at @pte_index under
+ *   it otherwise. The page tables are placed in the physical memory past the
+ *   frames, a page for the page directory and each pte_directory of the
+ *   processes in order of their pids. In a guest, the frame of the entry is
+ *   translated through the host page table first.
+ */
+static void __charge_walk(struct vm_machine *vm, struct pagetable *pt, int pd_index, int pte_index)
+{
+	struct process *p = container_of(pt, struct process, pagetable);
+	unsigned long table = vm->config.nr_pageframes + (unsigned long)p->pid * (1 + NR_PDES_PER_PAGE);
+	unsigned long offset, paddr;
+
+	if (pte_index < 0) {
+		offset = pd_index * PTE_SIZE;
+	} else {
+		table += 1 + pd_index;
+		offset = pte_index * PTE_SIZE;
+	}
+	if (vm->config.use_nested) {
+		unsigned int rw = ACCESS_READ;
+		bool huge;
+
+		table = __walk_host(vm, table, &rw, &huge);
+	}
+	paddr = (table << PAGE_SHIFT) + offset;
+	vm_charge_cycles(vm, COST_WALK,
+			__cache_cycles(vm, paddr, true, vm->config.latencies[COST_WALK]));
+}
+
+/**
+ * __lookup_ipt(@vm, @pt, @rw, @vpn, @pfn)
+ *
+ * DESCRIPTION
+ *   Look up the inverted page table for @vpn of the process of @pt, and
+ *   cache the translation in the TLB if it allows @rw. Each hash group read
+ *   is charged as a walk step. The table is placed in the physical memory at
+ *   IPT_PADDR, far past the frames and the radix page tables.
+ *   Called with the lock for the page directory slot of @vpn held.
+ *
+ * RETURN
+ *   @true if translated, @false if it should walk the radix page table
+ */
+#define IPT_PADDR	(1UL << 40)
+
+static bool __lookup_ipt(struct vm_machine *vm, struct pagetable *pt, unsigned int rw, unsigned int vpn, unsigned int *pfn)
+{
+	struct vm_machine *machine = vm->concurrent ? vm->main : vm;
+	struct process *p = container_of(pt, struct process, pagetable);
+	struct ipt *ipt = &machine->ipt;
+	unsigned long nr_probes;
+	struct ipt_entry *e;
+	bool translated = false;
+	unsigned int entry_rw = 0;
+
+	vm_lock(vm, &machine->ipt_lock);
+	nr_probes = ipt->nr_probes;
+	e = ipt_lookup(ipt, p->pid, vpn);
+	nr_probes = ipt->nr_probes - nr_probes;
+
+	if (e && (!(rw & ACCESS_WRITE) || (e->rw & ACCESS_WRITE))) {
+		*pfn = e->pfn;
+		entry_rw = e->rw;
+		translated = true;
+	}
+	vm_unlock(vm, &machine->ipt_lock);
+
+	for (unsigned long i = 0; i < nr_probes; i++) {
+		unsigned long paddr = IPT_PADDR + (unsigned long)
+				ipt_group(ipt, p->pid, vpn, i > 0) * IPT_GROUP_SIZE * IPT_ENTRY_SIZE;
+
+		vm_charge_cycles(vm, COST_WALK,
+				__cache_cycles(vm, paddr, true, vm->config.latencies[COST_WALK]));
+	}
+
+	if (translated && vm->config.use_tlb) {
+		__insert_tlb(vm, vpn, entry_rw, *pfn, false);
+	}
+	return translated;
+}
+
+static void __insert_ipt(struct vm_machine *vm, struct pagetable *pt, unsigned int vpn, unsigned int pfn, unsigned int rw)
+{
+	struct vm_machine *machine = vm->concurrent ? vm->main : vm;
+
+	if (!vm->config.use_ipt) return;
+
+	vm_lock(vm, &machine->ipt_lock);
+	ipt_insert(&machine->ipt, container_of(pt, struct process, pagetable)->pid, vpn, pfn, rw);
+	vm_unlock(vm, &machine->ipt_lock);
+}
+
+/**
+ * __walk_nested(@vm, @rw, @pfn, @prot, @huge)
+ *
+ * DESCRIPTION
+ *   Complete the two-dimensional walk in a guest by translating the guest
+ *   frame @pfn to the host frame for @rw. The TLB caches the combined
+ *   translation, so @prot is narrowed down to the protection of the host
+ *   mapping, and @huge is cleared unless the host maps a huge page as well.
+ */
+static void __walk_nested(struct vm_machine *vm, unsigned int rw, unsigned int *pfn, unsigned int *prot, bool *huge)
+{
+	unsigned int host_rw = rw;
+	bool host_huge;
+
+	if (!vm->config.use_nested) return;
+
+	*pfn = __walk_host(vm, *pfn, &host_rw, &host_huge);
+	*prot &= host_rw;
+	*huge = *huge && host_huge;
+}
+
+/**
+ * __walk_pagetable(@vm, @pt, @rw, @vpn, @pfn, @walked)
+ *
+ * DESCRIPTION
+ *   Walk @pt to translate @vpn for @rw, and cache the translation in the TLB.
+ *   Called with the lock for the page directory slot of @vpn held.
+ *   A batch passes the directory of its preceding walk in the same slot in
+ *   @walked to skip reading the page directory entry again, and gets the
+ *   directory of this walk back. Single translations pass NULL.
+ *
+ * RETURN
+ *   @true on successful translation, @false otherwise
  */
-static bool __translate(unsigned int rw, unsigned int vpn, unsigned int *pfn, bool *from_tlb)
+static bool __walk_pagetable(struct vm_machine *vm, struct pagetable *pt, unsigned int rw, unsigned int vpn, unsigned int *pfn, struct pte_directory **walked)
 {
 	int pd_index = vpn / NR_PTES_PER_PAGE;
 	int pte_index = vpn % NR_PTES_PER_PAGE;
 
-	struct pagetable *pt = ptbr;
 	struct pte_directory *pd;
 	struct pte *pte;
+	unsigned int prot;
+	bool huge;
 
-	/* Lookup the mapping from TLB */
-	if (print_tlb_result && lookup_tlb(vpn, rw, pfn)) {
-		*from_tlb = true;
-		return true;
+	vm->stats.nr_walks++;
+
+	if (walked && *walked) {
+		pd = *walked;
+		vm->stats.nr_batch_dir_saves++;
+	} else {
+		/* The page walk cache skips reading the page directory entry */
+		pd = __lookup_pwc(vm, pt, pd_index);
 	}
+	if (!pd) {
+		vm->stats.nr_walk_refs++;
+		__charge_walk(vm, pt, pd_index, -1);
 
-	/* Nah, TLB miss */
-	*from_tlb = false;
+		/* Directory-level huge mapping */
+		if (pte_valid(&pt->huge[pd_index])) {
+			pte = &pt->huge[pd_index];
 
-	/* Page table is invalid */
-	if (!pt) return false;
+			if ((rw & ACCESS_WRITE) && !(pte_rw(pte) & ACCESS_WRITE)) return false;
+
+			*pfn = pte_pfn(pte) + pte_index;
+			pte_set_flag(pte, PTE_ACCESSED, true);
+			if (rw & ACCESS_WRITE) pte_set_flag(pte, PTE_DIRTY, true);
+			__insert_ipt(vm, pt, vpn, *pfn, pte_rw(pte));
 
-	pd = pt->pdes[pd_index];
+			prot = pte_rw(pte);
+			huge = true;
+			__walk_nested(vm, rw, pfn, &prot, &huge);
 
-	/* Page directory does not exist */
-	if (!pd) return false;
+			if (vm->config.use_tlb) {
+				__insert_tlb(vm, vpn, prot, *pfn, huge);
+			}
+			return true;
+		}
 
+		pd = pt->pdes[pd_index];
+
+		/* Page directory does not exist */
+		if (!pd) return false;
+
+		__insert_pwc(vm, pt, pd_index, pd);
+	}
+	if (walked) *walked = pd;
+
+	vm->stats.nr_walk_refs++;
+	__charge_walk(vm, pt, pd_index, pte_index);
 	pte = &pd->ptes[pte_index];
 
 	/* PTE is invalid */
-	if (!pte->valid) return false;
+	if (!pte_valid(pte)) return false;
 
 	/* Unable to handle the write access */
 	if (rw & ACCESS_WRITE) {
-		if (!(pte->rw & ACCESS_WRITE)) return false;
+		if (!(pte_rw(pte) & ACCESS_WRITE)) return false;
 	}
-	*pfn = pte->pfn;
+	*pfn = pte_pfn(pte);
+	pte_set_flag(pte, PTE_ACCESSED, true);
+	if (rw & ACCESS_WRITE) pte_set_flag(pte, PTE_DIRTY, true);
+	__insert_ipt(vm, pt, vpn, *pfn, pte_rw(pte));
+
+	prot = pte_rw(pte);
+	huge = false;
+	__walk_nested(vm, rw, pfn, &prot, &huge);
 
 	/* Insert the mapping into TLB */
-	if (print_tlb_result) {
-		insert_tlb(vpn, pte->rw, *pfn);
+	if (vm->config.use_tlb) {
+		__insert_tlb(vm, vpn, prot, *pfn, huge);
 	}
 
 	return true;
 }
 
 /**
- * __access_memory
+ * __probe_tlb(@vm, @rw, @vpn, @pfn)
+ *
+ * DESCRIPTION
+ *   Account the translation of @vpn, and look it up in the TLB of the CPU.
+ *   The caller holds the TLB lock of the CPU when the TLB is used.
+ *
+ * RETURN
+ *   @true with the frame in @pfn if it hits in the TLB
+ */
+static bool __probe_tlb(struct vm_machine *vm, unsigned int rw, unsigned int vpn, unsigned int *pfn)
+{
+	int pd_index = vpn / NR_PTES_PER_PAGE;
+	struct pagetable *pt = vm->ptbr;
+
+	vm->stats.nr_translations++;
+
+	/**
+	 * Feed the page to the miss-ratio curve analysis. Pages mapped by a huge
+	 * mapping share a TLB entry, so they are accounted as a single page
+	 * tagged beyond the VPN space.
+	 */
+	if (vm->config.mrc_rate) {
+		mrc_access(&vm->mrc, vm->current->pid, pt && pte_valid(&pt->huge[pd_index]) ?
+				NR_PDES_PER_PAGE * NR_PTES_PER_PAGE + pd_index : vpn);
+	}
+
+	if (!vm->config.use_tlb) return false;
+
+	/* Lookup the mapping from TLB */
+	vm_charge(vm, COST_TLB, 1);
+	if (lookup_tlb(vm, vpn, rw, pfn)) {
+		vm->stats.nr_tlb_hits++;
+		return true;
+	}
+	vm->stats.nr_tlb_misses++;
+	return false;
+}
+
+/**
+ * __translate()
+ *
+ * DESCRIPTION
+ *   This function simulates the address translation in MMU.
+ *   It translates @vpn to @pfn using the page table pointed by @ptbr.
+ *   A huge mapping in the page directory terminates the walk one level early,
+ *   and is cached in the TLB as a single entry covering the whole huge page.
+ *
+ * RETURN
+ *   @true on successful translation
+ *   @false if unable to translate. This includes the case when the page access
+ *   is for write (indicated in @rw), but the PTE indicates it's read-only.
+ */
+static bool __translate(struct vm_machine *vm, unsigned int rw, unsigned int vpn, unsigned int *pfn, bool *from_tlb)
+{
+	int pd_index = vpn / NR_PTES_PER_PAGE;
+	struct pagetable *pt = vm->ptbr;
+	bool translated;
+
+	if (vm->config.use_tlb) vm_lock(vm, &vm->cpus[vm->cpu].tlb_lock);
+	translated = __probe_tlb(vm, rw, vpn, pfn);
+	if (vm->config.use_tlb) vm_unlock(vm, &vm->cpus[vm->cpu].tlb_lock);
+
+	*from_tlb = translated;
+	if (translated) return true;
+
+	/* Nah, TLB miss. Page table is invalid */
+	if (!pt) return false;
+
+	vm_lock(vm, &pt->locks[pd_index]);
+	translated = vm->config.use_ipt && __lookup_ipt(vm, pt, rw, vpn, pfn);
+	if (!translated) translated = __walk_pagetable(vm, pt, rw, vpn, pfn, NULL);
+	vm_unlock(vm, &pt->locks[pd_index]);
+
+	return translated;
+}
+
+static unsigned long __sum_cycles(struct vm_machine *vm)
+{
+	unsigned long cycles = 0;
+
+	for (int i = 0; i < NR_COSTS; i++) cycles += vm->stats.cycles[i];
+
+	return cycles;
+}
+
+/**
+ * __access_data(@vm, @pfn, @offset)
+ *
+ * DESCRIPTION
+ *   Access the data at @offset of the frame @pfn through the caches, and
+ *   charge the memory of the node or the tier holding the frame.
+ */
+static void __access_data(struct vm_machine *vm, unsigned int pfn, unsigned int offset)
+{
+	unsigned long cycles = vm->config.latencies[COST_MEMORY];
+
+	if (vm->config.nr_nodes > 1) {
+		if (numa_node_of(vm, pfn) == numa_cpu_node(vm, vm->cpu)) {
+			vm->stats.nr_numa_local++;
+		} else {
+			vm->stats.nr_numa_remote++;
+		}
+	}
+	if (vm->config.nr_fast_frames) {
+		if (pfn < tier_fast_end(vm)) {
+			vm->stats.nr_tier_fast++;
+			cycles = vm->config.tier_fast_cycles;
+		} else {
+			vm->stats.nr_tier_slow++;
+			cycles = vm->config.tier_slow_cycles;
+		}
+	}
+	vm_charge_cycles(vm, COST_MEMORY, __cache_cycles(vm,
+			((unsigned long)pfn << PAGE_SHIFT) + offset, false, cycles));
+}
+
+/**
+ * vm_access(@vm, @vpn, @rw, @offset, @pfn)
  *
  * DESCRIPTION
  *   Simulate the MMU in the processor and call page fault handler
- *   if necessary.
+ *   if necessary. The cycles charged on the way are accounted to the access.
+ *   The data at @offset of the translated frame, put in @pfn, is accessed
+ *   through the caches then.
  *
  * RETURN
- *   @true on successful access
- *   @false if unable to access @vpn for @rw
+ *   0 on successful access
+ *   -LIBVM_EFAULT if unable to access @vpn for @rw
  */
-static bool __access_memory(unsigned int vpn, unsigned int rw)
+int vm_access(struct vm_machine *vm, unsigned int vpn, unsigned int rw, unsigned int offset, unsigned int *pfn)
 {
-	unsigned int pfn;
+	unsigned long start = __sum_cycles(vm);
+	bool accessed = false;
 	int ret;
 	int nr_retries = 0;
 
@@ -162,29 +1036,327 @@ static bool __access_memory(unsigned int vpn, unsigned int rw)
 	 */
 	assert(vpn < NR_PDES_PER_PAGE * NR_PTES_PER_PAGE);
 
-	do {
+	vm->stats.nr_accesses++;
+	__atomic_add_fetch(&vm->current->nr_accesses, 1, __ATOMIC_RELAXED);
+
+	do {
+		bool from_tlb;
+		/* Ask MMU to translate VPN */
+		if (__translate(vm, rw, vpn, pfn, &from_tlb)) {
+			/* Success on address translation */
+			if (vm->config.use_tlb) {
+				fprintf(vm->out, "%c |", from_tlb ? 'o' : 'x');
+			}
+			fprintf(vm->out, " %3u --> %-3u\n", vpn, *pfn);
+
+			__access_data(vm, *pfn, offset);
+			accessed = true;
+			goto out;
+		}
+
+		/**
+		 * Failed to translate the address. So, call OS through the page fault
+		 * and restart the translation if the fault is successfully handled.
+		 * Count the number of retries to prevent buggy translation.
+		 */
+		nr_retries++;
+		vm->stats.nr_faults++;
+		vm_charge(vm, COST_FAULT, 1);
+	} while ((ret = handle_page_fault(vm, vpn, rw)) == true && nr_retries < 2);
+
+	if (ret == false) {
+		fprintf(vm->out, "Unable to access %u\n", vpn);
+	}
+out:
+	vm->stats.access_cycles += __sum_cycles(vm) - start;
+	return accessed ? 0 : -LIBVM_EFAULT;
+}
+
+/**
+ * vm_translate_batch(@vm, @xlates, @nr, @pfns, @status)
+ *
+ * DESCRIPTION
+ *   Translate the @nr pages in @xlates for the current process at once, and
+ *   put the frames in @pfns and how they are translated in @status, in the
+ *   order of @xlates.
+ *   The whole batch is looked up in the TLB first under a single hold of the
+ *   TLB lock. The misses are then walked in the order of the pages, so that
+ *   the walks in a page directory slot take its lock once and read the page
+ *   directory entry once, and the same page is walked once for the same
+ *   access. The pages failed to translate are faulted in last, in the order
+ *   of @xlates. So the translations before a fault in the batch see the
+ *   mappings before the fault.
+ *
+ * RETURN
+ *   The number of pages translated
+ */
+unsigned int vm_translate_batch(struct vm_machine *vm, const struct vm_xlate *xlates, unsigned int nr, unsigned int *pfns, enum vm_xlate_status *status)
+{
+	struct pagetable *pt = vm->ptbr;
+	unsigned int counts[NR_PDES_PER_PAGE * NR_PTES_PER_PAGE + 1] = { 0 };
+	unsigned int *order = malloc(sizeof(*order) * nr);
+	struct pte_directory *walked = NULL;
+	int locked = -1;
+	unsigned int nr_misses = 0;
+	unsigned int nr_translated = 0;
+	const struct vm_xlate *prev = NULL;
+
+	vm->stats.nr_batched += nr;
+
+	/* Probe the TLB for the whole batch, and count the misses by pages */
+	if (vm->config.use_tlb) vm_lock(vm, &vm->cpus[vm->cpu].tlb_lock);
+	for (unsigned int i = 0; i < nr; i++) {
+		const struct vm_xlate *x = xlates + i;
+
+		assert(x->rw == ACCESS_READ || x->rw == ACCESS_WRITE);
+		assert(x->vpn < NR_PDES_PER_PAGE * NR_PTES_PER_PAGE);
+
+		if (__probe_tlb(vm, x->rw, x->vpn, pfns + i)) {
+			status[i] = VM_XLATE_TLB;
+			nr_translated++;
+		} else {
+			status[i] = VM_XLATE_FAIL;
+			counts[x->vpn + 1]++;
+			nr_misses++;
+		}
+	}
+	if (vm->config.use_tlb) vm_unlock(vm, &vm->cpus[vm->cpu].tlb_lock);
+
+	/**
+	 * Sort the misses by the pages, keeping the order of the same page.
+	 * Without the memory to sort them, walk the misses in the order of
+	 * @xlates as vm_access() would do one by one.
+	 */
+	if (order) {
+		for (unsigned int i = 1; i <= NR_PDES_PER_PAGE * NR_PTES_PER_PAGE; i++) {
+			counts[i] += counts[i - 1];
+		}
+		for (unsigned int i = 0; i < nr; i++) {
+			if (status[i] == VM_XLATE_FAIL) order[counts[xlates[i].vpn]++] = i;
+		}
+	}
+
+	for (unsigned int i = 0; pt && i < (order ? nr_misses : nr); i++) {
+		unsigned int index = order ? order[i] : i;
+		const struct vm_xlate *x = xlates + index;
+		int pd_index = x->vpn / NR_PTES_PER_PAGE;
+		bool translated;
+
+		if (status[index] != VM_XLATE_FAIL) continue;
+
+		if (pd_index != locked) {
+			if (locked >= 0) vm_unlock(vm, &pt->locks[locked]);
+			vm_lock(vm, &pt->locks[pd_index]);
+			locked = pd_index;
+			walked = NULL;
+		}
+
+		/* Share the walk of the same page for the same access */
+		if (prev && prev->vpn == x->vpn && prev->rw == x->rw) {
+			if (status[prev - xlates] == VM_XLATE_WALK) {
+				pfns[index] = pfns[prev - xlates];
+				status[index] = VM_XLATE_WALK;
+				nr_translated++;
+				vm->stats.nr_batch_walk_saves++;
+			}
+			continue;
+		}
+		prev = x;
+
+		translated = vm->config.use_ipt &&
+				__lookup_ipt(vm, pt, x->rw, x->vpn, pfns + index);
+		if (!translated) {
+			translated = __walk_pagetable(vm, pt, x->rw, x->vpn, pfns + index, &walked);
+		}
+		if (translated) {
+			status[index] = VM_XLATE_WALK;
+			nr_translated++;
+		}
+	}
+	if (locked >= 0) vm_unlock(vm, &pt->locks[locked]);
+	free(order);
+
+	/* Handle the faults, and translate the pages again */
+	for (unsigned int i = 0; i < nr; i++) {
+		bool translated = false;
+		bool from_tlb;
+
+		if (status[i] != VM_XLATE_FAIL) continue;
+
+		for (int nr_retries = 0; !translated && nr_retries < 2; nr_retries++) {
+			vm->stats.nr_faults++;
+			vm_charge(vm, COST_FAULT, 1);
+
+			if (!handle_page_fault(vm, xlates[i].vpn, xlates[i].rw)) break;
+			translated = __translate(vm, xlates[i].rw, xlates[i].vpn, pfns + i, &from_tlb);
+		}
+		if (translated) {
+			status[i] = VM_XLATE_FAULT;
+			nr_translated++;
+		}
+	}
+	return nr_translated;
+}
+
+/**
+ * vm_access_batch(@vm, @xlates, @nr, @pfns, @status)
+ *
+ * DESCRIPTION
+ *   Access the @nr pages in @xlates, translated in a batch by
+ *   vm_translate_batch(). The data at the beginning of the frames are
+ *   accessed in the order of @xlates then.
+ *
+ * RETURN
+ *   The number of pages accessed
+ */
+unsigned int vm_access_batch(struct vm_machine *vm, const struct vm_xlate *xlates, unsigned int nr, unsigned int *pfns, enum vm_xlate_status *status)
+{
+	unsigned long cycles = __sum_cycles(vm);
+	unsigned int nr_translated;
+
+	vm->stats.nr_accesses += nr;
+	__atomic_add_fetch(&vm->current->nr_accesses, nr, __ATOMIC_RELAXED);
+
+	nr_translated = vm_translate_batch(vm, xlates, nr, pfns, status);
+
+	for (unsigned int i = 0; i < nr; i++) {
+		if (status[i] == VM_XLATE_FAIL) {
+			fprintf(vm->out, "Unable to access %u\n", xlates[i].vpn);
+			continue;
+		}
+		if (vm->config.use_tlb) {
+			fprintf(vm->out, "%c |", status[i] == VM_XLATE_TLB ? 'o' : 'x');
+		}
+		fprintf(vm->out, " %3u --> %-3u\n", xlates[i].vpn, pfns[i]);
+
+		__access_data(vm, pfns[i], 0);
+	}
+	vm->stats.access_cycles += __sum_cycles(vm) - cycles;
+
+	return nr_translated;
+}
+
+/**
+ * __access_range(@vm, @start, @rw, @nr)
+ *
+ * DESCRIPTION
+ *   Access @nr pages from @start for @rw, translated in a batch.
+ *
+ * RETURN
+ *   @true if all the pages are accessed
+ */
+static bool __access_range(struct vm_machine *vm, unsigned int start, unsigned int rw, unsigned int nr)
+{
+	struct vm_xlate xlates[NR_PDES_PER_PAGE * NR_PTES_PER_PAGE];
+	unsigned int pfns[NR_PDES_PER_PAGE * NR_PTES_PER_PAGE];
+	enum vm_xlate_status status[NR_PDES_PER_PAGE * NR_PTES_PER_PAGE];
+
+	if (start + nr > NR_PDES_PER_PAGE * NR_PTES_PER_PAGE || start + nr < start) {
+		fprintf(vm->out, "Unable to access %u - %u\n", start, start + nr - 1);
+		return false;
+	}
+
+	for (unsigned int i = 0; i < nr; i++) {
+		xlates[i].vpn = start + i;
+		xlates[i].rw = rw;
+	}
+	return vm_access_batch(vm, xlates, nr, pfns, status) == nr;
+}
+
+static unsigned long __bench_nsecs(const struct timespec *start)
+{
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_sec - start->tv_sec) * 1000000000UL + end.tv_nsec - start->tv_nsec;
+}
+
+/**
+ * vm_translate_bench(@config, @nr_lookups, @out)
+ *
+ * DESCRIPTION
+ *   Measure the translations per second of @nr_lookups random reads over
+ *   the whole address space on a machine of @config, and report them to
+ *   @out. They are issued one by one through the access path with its
+ *   output, through the translation alone, and in batches of 16, 64, and 256.
+ *
+ * RETURN
+ *   0 on success
+ *   -LIBVM_EINVAL if @config is invalid
+ *   -LIBVM_ENOMEM if out of memory, or @config has not enough frames to map
+ *   the address space
+ */
+int vm_translate_bench(const struct vm_config *config, unsigned long nr_lookups, FILE *out)
+{
+	const unsigned int nr_batches[] = { 16, 64, 256 };
+	struct vm_machine vm;
+	struct vm_xlate *xlates = malloc(sizeof(*xlates) * nr_lookups);
+	unsigned int *pfns = malloc(sizeof(*pfns) * nr_lookups);
+	enum vm_xlate_status *status = malloc(sizeof(*status) * nr_lookups);
+	uint32_t seed = 0x2545f491;
+	struct timespec start;
+	unsigned long nsecs;
+	int ret = -LIBVM_ENOMEM;
+
+	if (!xlates || !pfns || !status) goto out_free;
+	if ((ret = vm_machine_init(&vm, config))) goto out_free;
+	vm.out = fopen("/dev/null", "w");
+	vm.con = vm.out;
+	if (!vm.out) {
+		ret = -LIBVM_ENOMEM;
+		goto out_exit;
+	}
+
+	for (unsigned int vpn = 0; vpn < NR_PDES_PER_PAGE * NR_PTES_PER_PAGE; vpn++) {
+		if (alloc_page(&vm, vpn, ACCESS_READ | ACCESS_WRITE) == -1) {
+			ret = -LIBVM_ENOMEM;
+			goto out;
+		}
+	}
+	for (unsigned long i = 0; i < nr_lookups; i++) {
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+		xlates[i].vpn = seed % (NR_PDES_PER_PAGE * NR_PTES_PER_PAGE);
+		xlates[i].rw = ACCESS_READ;
+	}
+
+	fprintf(out, "%-9s | %5s | %14s\n", "path", "batch", "translations/s");
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (unsigned long i = 0; i < nr_lookups; i++) {
+		vm_access(&vm, xlates[i].vpn, xlates[i].rw, 0, pfns + i);
+	}
+	nsecs = __bench_nsecs(&start);
+	fprintf(out, "%-9s | %5u | %14.0f\n", "access", 1, nr_lookups * 1e9 / nsecs);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (unsigned long i = 0; i < nr_lookups; i++) {
 		bool from_tlb;
-		/* Ask MMU to translate VPN */
-		if (__translate(rw, vpn, &pfn, &from_tlb)) {
-			/* Success on address translation */
-			if (print_tlb_result) {
-				fprintf(stderr, "%c |", from_tlb ? 'o' : 'x');
-			}
-			fprintf(stderr, " %3u --> %-3u\n", vpn, pfn);
-			return true;
-		}
 
-		/**
-		 * Failed to translate the address. So, call OS through the page fault
-		 * and restart the translation if the fault is successfully handled.
-		 * Count the number of retries to prevent buggy translation.
-		 */
-		nr_retries++;
-	} while ((ret = handle_page_fault(vpn, rw)) == true && nr_retries < 2);
+		__translate(&vm, xlates[i].rw, xlates[i].vpn, pfns + i, &from_tlb);
+	}
+	nsecs = __bench_nsecs(&start);
+	fprintf(out, "%-9s | %5u | %14.0f\n", "translate", 1, nr_lookups * 1e9 / nsecs);
 
-	if (ret == false) {
-		fprintf(stderr, "Unable to access %u\n", vpn);
+	for (int b = 0; b < sizeof(nr_batches) / sizeof(*nr_batches); b++) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (unsigned long i = 0; i < nr_lookups; i += nr_batches[b]) {
+			unsigned int nr = nr_lookups - i < nr_batches[b] ? nr_lookups - i : nr_batches[b];
+
+			vm_translate_batch(&vm, xlates + i, nr, pfns + i, status + i);
+		}
+		nsecs = __bench_nsecs(&start);
+		fprintf(out, "%-9s | %5u | %14.0f\n", "batch", nr_batches[b], nr_lookups * 1e9 / nsecs);
 	}
+out:
+	fclose(vm.out);
+out_exit:
+	vm_machine_exit(&vm);
+out_free:
+	free(xlates);
+	free(pfns);
+	free(status);
 
 	return ret;
 }
@@ -205,113 +1377,463 @@ static unsigned int __make_rwflag(const char *rw)
 	return rwflag;
 }
 
-static bool __alloc_page(unsigned int vpn, unsigned int rw)
+/**
+ * vm_alloc_page(@vm, @vpn, @rw, @pfn)
+ *
+ * DESCRIPTION
+ *   Allocate a page at @vpn for @rw, which includes ACCESS_READ, to the
+ *   current process, and put its frame in @pfn.
+ *
+ * RETURN
+ *   0 on success, -LIBVM_EEXIST if @vpn is already allocated, or
+ *   -LIBVM_ENOMEM if the memory is full
+ */
+int vm_alloc_page(struct vm_machine *vm, unsigned int vpn, unsigned int rw, unsigned int *pfn)
 {
-	unsigned int pfn;
 	bool from_tlb;
 
 	assert(rw);
 	assert(rw & ACCESS_READ);
 
 	/* Check whether the requested VPN is already allocated */
-	if (__translate(ACCESS_READ, vpn, &pfn, &from_tlb)) {
-		fprintf(stderr, "%u is already allocated to %u\n", vpn, pfn);
+	if (__translate(vm, ACCESS_READ, vpn, pfn, &from_tlb)) {
+		fprintf(vm->out, "%u is already allocated to %u\n", vpn, *pfn);
+		return -LIBVM_EEXIST;
+	}
+
+	*pfn = alloc_page(vm, vpn, rw);
+	if (*pfn == -1) {
+		fprintf(vm->out, "memory is full\n");
+		return -LIBVM_ENOMEM;
+	}
+	fprintf(vm->out, "alloc %3u --> %-3u\n", vpn, *pfn);
+	
+	return 0;
+}
+
+/**
+ * vm_alloc_huge_page(@vm, @vpn, @rw, @pfn)
+ *
+ * DESCRIPTION
+ *   Allocate a huge page at @vpn for @rw to the current process, and put
+ *   its first frame in @pfn.
+ *
+ * RETURN
+ *   0 on success, -LIBVM_EINVAL if @vpn is not aligned to the huge page,
+ *   -LIBVM_EEXIST if a page in the range is allocated, or -LIBVM_ENOMEM if
+ *   there is no contiguous memory for it
+ */
+int vm_alloc_huge_page(struct vm_machine *vm, unsigned int vpn, unsigned int rw, unsigned int *pfn)
+{
+	int pd_index = vpn / NR_PTES_PER_PAGE;
+	struct pte_directory *pd = vm->ptbr->pdes[pd_index];
+
+	assert(rw & ACCESS_READ);
+
+	if (vpn % NR_PAGES_PER_HUGE) {
+		fprintf(vm->out, "%u is not aligned to huge page\n", vpn);
+		return -LIBVM_EINVAL;
+	}
+
+	/* The whole range should be unmapped */
+	if (pte_valid(&vm->ptbr->huge[pd_index])) {
+		fprintf(vm->out, "%u is already allocated to %u\n",
+				vpn, pte_pfn(&vm->ptbr->huge[pd_index]));
+		return -LIBVM_EEXIST;
+	}
+	for (int i = 0; pd && i < NR_PTES_PER_PAGE; i++) {
+		if (!pte_valid(&pd->ptes[i])) continue;
+
+		fprintf(vm->out, "%u is already allocated to %u\n",
+				vpn + i, pte_pfn(&pd->ptes[i]));
+		return -LIBVM_EEXIST;
+	}
+
+	*pfn = alloc_huge_page(vm, vpn, rw);
+	if (*pfn == -1) {
+		fprintf(vm->out, "no contiguous memory for huge page\n");
+		return -LIBVM_ENOMEM;
+	}
+	fprintf(vm->out, "alloc %3u --> %-3u (huge, %u pages)\n",
+			vpn, *pfn, NR_PAGES_PER_HUGE);
+
+	return 0;
+}
+
+static bool __alloc_order(struct vm_machine *vm, unsigned int order)
+{
+	unsigned int pfn;
+
+	if (order >= NR_ORDERS) {
+		fprintf(vm->out, "order should be less than %d\n", NR_ORDERS);
 		return false;
 	}
 
-	pfn = alloc_page(vpn, rw);
+	pfn = compact_alloc(vm, order);
 	if (pfn == -1) {
-		fprintf(stderr, "memory is full\n");
+		fprintf(vm->out, "no free block of order %u\n", order);
 		return false;
 	}
-	fprintf(stderr, "alloc %3u --> %-3u\n", vpn, pfn);
-	
+	fprintf(vm->out, "alloc-order %u --> %u - %u\n", order, pfn,
+			pfn + (1 << order) - 1);
+
+	return true;
+}
+
+static bool __free_order(struct vm_machine *vm, unsigned int pfn)
+{
+	/* Should be a block from alloc-order, not a frame mapped to processes */
+	if (pfn >= vm->config.nr_pageframes || !buddy_is_head(&vm->zone, pfn) || vm->mapcounts[pfn]) {
+		fprintf(vm->out, "%u is not allocated by alloc-order\n", pfn);
+		return false;
+	}
+	fprintf(vm->out, "free-order %u (order %u)\n", pfn, vm->zone.pages[pfn].order);
+	buddy_free(&vm->zone, pfn);
+
 	return true;
 }
 
-static bool __free_page(unsigned int vpn)
+static void __compact_memory(struct vm_machine *vm)
+{
+	struct compact_result r;
+
+	compact_memory(vm, &r);
+
+	fprintf(vm->out, "compact: %u pages migrated in %lu ns\n",
+			r.nr_migrated, r.nsecs);
+	fprintf(vm->out, "  largest free order : %d --> %d\n",
+			(int)r.largest_order[0], (int)r.largest_order[1]);
+	fprintf(vm->out, "  unusable index (huge) : %.3f --> %.3f\n",
+			r.unusable_index[0] / 1000.0, r.unusable_index[1] / 1000.0);
+}
+
+/**
+ * vm_free_page(@vm, @vpn)
+ *
+ * DESCRIPTION
+ *   Deallocate the page at @vpn from the current process.
+ *
+ * RETURN
+ *   0 on success, -LIBVM_ENOENT if @vpn is not allocated
+ */
+int vm_free_page(struct vm_machine *vm, unsigned int vpn)
 {
 	unsigned int pfn;
 	bool from_tlb;
 
-	if (!__translate(ACCESS_READ, vpn, &pfn, &from_tlb)) {
-		fprintf(stderr, "%u is not allocated\n", vpn);
-		return false;
+	if (!__translate(vm, ACCESS_READ, vpn, &pfn, &from_tlb)) {
+		fprintf(vm->out, "%u is not allocated\n", vpn);
+		return -LIBVM_ENOENT;
 	}
-	fprintf(stderr, "free %u (pfn %u)\n", vpn, pfn);
-	free_page(vpn);
+	fprintf(vm->out, "free %u (pfn %u)\n", vpn, pfn);
+	free_page(vm, vpn);
 
-	return true;
+	return 0;
+}
+
+/**
+ * vm_find_process(@vm, @pid)
+ *
+ * RETURN
+ *   The process with @pid, or NULL if there is none
+ */
+struct process *vm_find_process(struct vm_machine *vm, unsigned int pid)
+{
+	for (struct process *p = vm->current; p; p = next_process(vm, p)) {
+		if (p->pid == pid) return p;
+	}
+	return NULL;
+}
+
+/**
+ * vm_switch(@vm, @pid)
+ *
+ * DESCRIPTION
+ *   Switch to the process @pid, forking it from the current one if there is
+ *   no such process.
+ */
+void vm_switch(struct vm_machine *vm, unsigned int pid)
+{
+	if (pid != vm->current->pid) vm_charge(vm, COST_SWITCH, 1);
+	switch_process(vm, pid);
+}
+
+/**
+ * vm_exit_process(@vm, @next)
+ *
+ * DESCRIPTION
+ *   Exit the current process; deallocate all its pages, switch to the
+ *   process @next, and release the exited one. @next is forked with nothing
+ *   mapped if there is no such process.
+ *
+ * RETURN
+ *   0 on success, -LIBVM_EINVAL if @next is the current process, or
+ *   -LIBVM_EBUSY if the current process is running on other CPUs as well
+ */
+int vm_exit_process(struct vm_machine *vm, unsigned int next)
+{
+	struct process *p = vm->current;
+
+	if (next == p->pid) return -LIBVM_EINVAL;
+	if (p->cpumask & ~(1UL << vm->cpu)) return -LIBVM_EBUSY;
+
+	for (unsigned int vpn = 0; vpn < NR_PDES_PER_PAGE * NR_PTES_PER_PAGE; vpn++) {
+		int pd_index = vpn / NR_PTES_PER_PAGE;
+		struct pte_directory *pd = p->pagetable.pdes[pd_index];
+
+		if (pte_valid(&p->pagetable.huge[pd_index]) ||
+				(pd && pte_valid(&pd->ptes[vpn % NR_PTES_PER_PAGE]))) {
+			free_page(vm, vpn);
+		}
+	}
+	vm_switch(vm, next);
+
+	/* The walk caches may hold the directories of @p, which a fork reusing the pid would hit */
+	for (int i = 0; i < NR_PDES_PER_PAGE; i++) {
+		flush_pwc(vm, p, i);
+	}
+	list_del_init(&p->list);
+	__free_process(vm, p);
+
+	return 0;
 }
 
-static void __init_system(void)
+static void __exit_process(struct vm_machine *vm, unsigned int next)
 {
-	ptbr = &init.pagetable;
+	unsigned int pid = vm->current->pid;
+	int ret = vm_exit_process(vm, next);
+
+	if (ret == -LIBVM_EINVAL) {
+		fprintf(vm->out, "Unable to exit %u to itself\n", pid);
+	} else if (ret == -LIBVM_EBUSY) {
+		fprintf(vm->out, "Unable to exit %u running on other CPUs\n", pid);
+	} else {
+		fprintf(vm->out, "exit %u\n", pid);
+	}
 }
 
-static void __show_pageframes(void)
+static void __show_pageframes(struct vm_machine *vm)
 {
-	for (unsigned int i = 0; i < NR_PAGEFRAMES; i++) {
-		if (!mapcounts[i]) continue;
-		fprintf(stderr, "%3u: %d\n", i, mapcounts[i]);
+	for (unsigned int i = 0; i < vm->config.nr_pageframes; i++) {
+		if (!vm->mapcounts[i]) continue;
+		fprintf(vm->out, "%3u: %d\n", i, vm->mapcounts[i]);
+	}
+
+	/**
+	 * Every mapping to the zero page is a page that would hold a private
+	 * frame without it. Exclude the pinning reference, and account the
+	 * zero page itself against the savings, which never go below 0.
+	 */
+	if (vm->config.use_zero_page) {
+		unsigned int nr_mappings = vm->mapcounts[ZERO_PFN] - 1;
+
+		fprintf(vm->out, "zero page: %u mappings, %u frames saved\n",
+				nr_mappings, nr_mappings ? nr_mappings - 1 : 0);
 	}
-	fprintf(stderr, "\n");
+	buddy_show(&vm->zone, vm->out);
+	fprintf(vm->out, "\n");
 }
 
-static void __show_pagetable(void)
+static void __show_pagetable(struct vm_machine *vm)
 {
-	fprintf(stderr, "\n*** PID %u ***\n", current->pid);
+	fprintf(vm->out, "\n*** PID %u ***\n", vm->current->pid);
 
 	for (int i = 0; i < NR_PDES_PER_PAGE; i++) {
-		struct pte_directory *pd = current->pagetable.pdes[i];
+		struct pte_directory *pd = vm->current->pagetable.pdes[i];
+		struct pte *huge = &vm->current->pagetable.huge[i];
+
+		if (pte_valid(huge)) {
+			fprintf(vm->out, "%02d:** | v %c%c | %-3d - %-3d (huge)\n", i,
+				pte_rw(huge) & ACCESS_READ ? 'r' : ' ',
+				pte_rw(huge) & ACCESS_WRITE ? 'w' : ' ',
+				pte_pfn(huge), pte_pfn(huge) + NR_PAGES_PER_HUGE - 1);
+			fprintf(vm->con, "\n");
+			continue;
+		}
 
 		if (!pd) continue;
 
 		for (int j = 0; j < NR_PTES_PER_PAGE; j++) {
 			struct pte *pte = &pd->ptes[j];
 
-			if (!verbose && !pte->valid) continue;
-			fprintf(stderr, "%02d:%02d | %c %c%c | %-3d\n", i, j,
-				pte->valid ? 'v' : ' ',
-				pte->valid ? (pte->rw & ACCESS_READ ? 'r' : ' ') : ' ',
-				pte->rw & ACCESS_WRITE ? 'w' : ' ',
-				pte->pfn);
+			if (!vm->config.interactive && !pte_valid(pte)) continue;
+			fprintf(vm->out, "%02d:%02d | %c %c%c | %-3d\n", i, j,
+				pte_valid(pte) ? 'v' : ' ',
+				pte_valid(pte) ? (pte_rw(pte) & ACCESS_READ ? 'r' : ' ') : ' ',
+				pte_rw(pte) & ACCESS_WRITE ? 'w' : ' ',
+				pte_pfn(pte));
 		}
-		printf("\n");
+		fprintf(vm->con, "\n");
 	}
 }
 
-static void __show_tlb(void)
+static void __show_tlb(struct vm_machine *vm)
 {
-	for (int i = 0; i < sizeof(tlb) / sizeof(*tlb); i++) {
-		struct tlb_entry *t = tlb + i;
+	for (int i = 0; i < vm->config.nr_tlb_entries; i++) {
+		struct tlb_entry *t = vm->tlb + i;
 
 		if (!t->valid) continue;
 
-		fprintf(stderr, "%c%c | %3d -> %-3d\n",
+		if (t->huge) {
+			fprintf(vm->out, "%c%c | %3d -> %-3d (huge, %u pages)\n",
+					t->rw & ACCESS_READ ? 'r' : ' ',
+					t->rw & ACCESS_WRITE ? 'w' : ' ',
+					t->vpn, t->pfn, NR_PAGES_PER_HUGE);
+			continue;
+		}
+		fprintf(vm->out, "%c%c | %3d -> %-3d\n",
 				t->rw & ACCESS_READ ? 'r' : ' ',
 				t->rw & ACCESS_WRITE ? 'w' : ' ',
 				t->vpn, t->pfn);
 	}
 }
 
-static void __print_help(void)
+/**
+ * __show_cycles(@vm)
+ *
+ * DESCRIPTION
+ *   Report the simulated cycles by component and by process, and the
+ *   average memory access time (AMAT) of the accesses. The accesses are
+ *   charged for the translations, the faults, and the copies and the
+ *   zero-fills in them, besides the memory access itself.
+ */
+static void __show_cycles(struct vm_machine *vm)
+{
+	unsigned long total = __sum_cycles(vm);
+
+	fprintf(vm->out, "cycles       : %lu (AMAT %.1f cycles over %lu accesses)\n", total,
+			vm->stats.nr_accesses ?
+				(double)vm->stats.access_cycles / vm->stats.nr_accesses : 0.0,
+			vm->stats.nr_accesses);
+	for (int i = 0; i < NR_COSTS; i++) {
+		if (!vm->stats.cycles[i]) continue;
+		fprintf(vm->out, "  %-10s : %lu (%.2f%%)\n", vm_cost_names[i], vm->stats.cycles[i],
+				vm->stats.cycles[i] * 100.0 / total);
+	}
+	for (struct process *p = vm->current; p; p = next_process(vm, p)) {
+		fprintf(vm->out, "  pid %-6u : %lu cycles, %lu accesses\n", p->pid, p->cycles,
+				p->nr_accesses);
+	}
+}
+
+/**
+ * __show_ipt(@vm)
+ *
+ * DESCRIPTION
+ *   Report the inverted page table, and compare its footprint with the one
+ *   of the radix page tables; a page directory for each process and a page
+ *   for each pte_directory, PTE_SIZE bytes per entry.
+ */
+static void __show_ipt(struct vm_machine *vm)
+{
+	unsigned long radix_bytes = 0;
+
+	for (struct process *p = vm->current; p; p = next_process(vm, p)) {
+		radix_bytes += NR_PDES_PER_PAGE * PTE_SIZE;
+		for (int i = 0; i < NR_PDES_PER_PAGE; i++) {
+			if (p->pagetable.pdes[i]) radix_bytes += NR_PTES_PER_PAGE * PTE_SIZE;
+		}
+	}
+	ipt_show(&vm->ipt, vm->out);
+	fprintf(vm->out, "  radix      : %lu bytes in the page tables\n", radix_bytes);
+}
+
+static void __show_stats(struct vm_machine *vm)
+{
+	fprintf(vm->out, "translations : %lu\n", vm->stats.nr_translations);
+	fprintf(vm->out, "tlb hits     : %lu\n", vm->stats.nr_tlb_hits);
+	fprintf(vm->out, "tlb misses   : %lu (%lu evictions)\n",
+			vm->stats.nr_tlb_misses, vm->stats.nr_tlb_evictions);
+	fprintf(vm->out, "walks        : %lu (%lu entries read)\n",
+			vm->stats.nr_walks, vm->stats.nr_walk_refs);
+	if (vm->config.nr_pwc_entries) {
+		unsigned long nr_lookups = vm->stats.nr_pwc_hits + vm->stats.nr_pwc_misses;
+
+		fprintf(vm->out, "pwc          : %lu hits, %lu misses (%.2f%% hit), %lu walk steps saved\n",
+				vm->stats.nr_pwc_hits, vm->stats.nr_pwc_misses,
+				nr_lookups ? vm->stats.nr_pwc_hits * 100.0 / nr_lookups : 0.0,
+				vm->stats.nr_pwc_hits);
+	}
+	if (vm->stats.nr_batched) {
+		fprintf(vm->out, "batched      : %lu translations, %lu walks and %lu directory reads shared\n",
+				vm->stats.nr_batched, vm->stats.nr_batch_walk_saves,
+				vm->stats.nr_batch_dir_saves);
+	}
+	fprintf(vm->out, "page faults  : %lu\n", vm->stats.nr_faults);
+	fprintf(vm->out, "huge splits  : %lu\n", vm->stats.nr_huge_splits);
+	fprintf(vm->out, "huge collapses : %lu (%lu copied)\n",
+			vm->stats.nr_huge_collapses, vm->stats.nr_huge_collapse_copies);
+	fprintf(vm->out, "tlb misses saved by huge pages : %lu\n",
+			vm->stats.nr_huge_tlb_saves);
+	fprintf(vm->out, "compactions  : %lu (%lu pages migrated, %lu ns)\n",
+			vm->stats.nr_compactions, vm->stats.nr_pages_migrated, vm->stats.compact_nsecs);
+	fprintf(vm->out, "shootdowns   : %lu (%lu IPIs, %lu entries, %lu cycles)\n",
+			vm->stats.nr_shootdowns, vm->stats.nr_ipis, vm->stats.nr_shootdown_flushes,
+			vm->stats.cycles[COST_SHOOTDOWN]);
+	__show_cycles(vm);
+	if (vm->config.nr_nodes > 1) numa_show(vm, vm->out);
+	if (vm->config.nr_fast_frames) tier_show(vm, vm->out);
+	if (vm->config.nr_cache_levels) cache_show(&vm->cache, vm->out);
+	if (vm->config.use_ipt) __show_ipt(vm);
+	if (vm->config.use_nested) nested_show(vm, vm->out);
+	if (vm->config.nr_cpus > 1) {
+		for (unsigned int i = 0; i < vm->config.nr_cpus; i++) {
+			fprintf(vm->out, "  cpu %-3u    : pid %u, %lu IPIs received\n", i,
+					cpu_current(vm, i)->pid, vm->cpus[i].nr_ipis);
+		}
+	}
+	fprintf(vm->out, "\n");
+}
+
+static void __set_mempolicy(struct vm_machine *vm, enum numa_policy mode, int node)
+{
+	if (node >= (int)vm->config.nr_nodes) {
+		fprintf(vm->out, "No node %d\n", node);
+		return;
+	}
+	vm->current->mempolicy.mode = mode;
+	vm->current->mempolicy.node = node;
+
+	fprintf(vm->out, "mempolicy %u: %s", vm->current->pid, numa_policy_name(mode));
+	if (node >= 0) fprintf(vm->out, " on node %d", node);
+	fprintf(vm->out, "\n");
+}
+
+static void __print_help(FILE *out)
 {
-	printf("  help | ?     : Print out this help message \n");
-	printf("  exit         : Exit the simulation\n");
-	printf("\n");
-	printf("  switch [pid] : Do context switch to pid @pid\n");
-	printf("                 Fork @pid if there is no process with the pid\n");
-	printf("  show         : Show the page table of the current process\n");
-	printf("  frames       : Show the status for each page frame\n");
-	printf("  tlb          : Show TLB entries\n");
-	printf("\n");
-	printf("  alloc [vpn] r|w  : Allocate a page according to the rw flag\n");
-	printf("  free [vpn]       : Deallocate the page at VPN @vpn\n");
-	printf("  access [vpn] r|w : Access VPN @vpn for read or write\n");
-	printf("  read [vpn]       : Equivalent to access @vpn r\n");
-	printf("  write [vpn]      : Equivalent to access @vpn w\n");
-	printf("\n");
+	fprintf(out, "  help | ?     : Print out this help message \n");
+	fprintf(out, "  exit         : Exit the simulation\n");
+	fprintf(out, "\n");
+	fprintf(out, "  switch [pid] : Do context switch to pid @pid\n");
+	fprintf(out, "                 Fork @pid if there is no process with the pid\n");
+	fprintf(out, "  exit-process [pid] : Exit the current process, and switch to pid @pid\n");
+	fprintf(out, "  cpu [cpu]    : Execute the following commands on CPU @cpu\n");
+	fprintf(out, "  @[cpu] ...   : Execute the command on CPU @cpu\n");
+	fprintf(out, "  show         : Show the page table of the vm->current process\n");
+	fprintf(out, "  frames       : Show the status for each page frame\n");
+	fprintf(out, "  tlb          : Show TLB entries\n");
+	fprintf(out, "  stats        : Show the translation statistics\n");
+	fprintf(out, "  compact      : Compact the physical memory\n");
+	fprintf(out, "  khugepaged   : Collapse fully populated page directories\n");
+	fprintf(out, "  tier         : Promote hot pages and demote cold ones (with -T)\n");
+	fprintf(out, "  mrc          : Show the TLB miss-ratio curve (with -m)\n");
+	fprintf(out, "  mempolicy [policy] {node} : Place the frames of the current process\n");
+	fprintf(out, "                 by first-touch, interleave, bind, or preferred\n");
+	fprintf(out, "  migrate [vpn] [node] : Migrate the page at @vpn to @node\n");
+	fprintf(out, "  checkpoint [file] : Save the state of the machine into @file\n");
+	fprintf(out, "  restore [file]    : Restore the state of the machine from @file\n");
+	fprintf(out, "\n");
+	fprintf(out, "  alloc [vpn] r|w  : Allocate a page according to the rw flag\n");
+	fprintf(out, "  alloc-huge [vpn] r|w : Allocate a huge page at aligned VPN @vpn\n");
+	fprintf(out, "  alloc-order [order]  : Allocate 2^@order contiguous frames\n");
+	fprintf(out, "  free-order [pfn]     : Free the frames allocated by alloc-order\n");
+	fprintf(out, "  free [vpn]       : Deallocate the page at VPN @vpn\n");
+	fprintf(out, "  access [vpn] r|w {offset} : Access VPN @vpn for read or write\n");
+	fprintf(out, "                     at byte @offset in the page (default 0)\n");
+	fprintf(out, "  read [vpn] {offset}  : Equivalent to access @vpn r\n");
+	fprintf(out, "  write [vpn] {offset} : Equivalent to access @vpn w\n");
+	fprintf(out, "  batch [vpn] r|w [nr] : Access @nr pages from @vpn, translated in a batch\n");
+	fprintf(out, "\n");
 }
 
 static bool strmatch(char * const str, const char *expect)
@@ -320,129 +1842,476 @@ static bool strmatch(char * const str, const char *expect)
 			(strncmp(str, expect, strlen(expect)) == 0);
 }
 
-static void __do_simulation(FILE *input)
+static enum vm_op_type __decode_mempolicy(struct vm_op *op, const char *policy, const char *node)
 {
-	char command[MAX_COMMAND_LEN] = { 0 };
+	enum numa_policy mode;
 
-	__init_system();
+	if (!numa_parse_policy(policy, &mode)) return VM_OP_UNKNOWN;
 
-	while (fgets(command, sizeof(command), input)) {
-		char *tokens[MAX_NR_TOKENS] = { NULL };
-		int nr_tokens = 0;
-
-		/* Make the command lowercase */
-		for (size_t i = 0; i < strlen(command); i++) {
-			command[i] = tolower(command[i]);
-		}
-
-		nr_tokens = parse_command(command, tokens);
-
-		if (nr_tokens == 0) continue;
-
-		if (nr_tokens == 1) {
-			if (strmatch(tokens[0], "exit")) break;
-			if (strmatch(tokens[0], "show")) {
-				__show_pagetable();
-			} else if (strmatch(tokens[0], "frames")) {
-				__show_pageframes();
-			} else if (strmatch(tokens[0], "tlb")) {
-				__show_tlb();
-			} else if (strmatch(tokens[0], "help") || strmatch(tokens[0], "?")) {
-				__print_help();
-			} else {
-				printf("Unknown command %s\n", tokens[0]);
-			}
-		} else if (nr_tokens == 2) {
-			unsigned int arg = strtoimax(tokens[1], NULL, 0);
-
-			if (strmatch(tokens[0], "switch") || strmatch(tokens[0], "s")) {
-				switch_process(arg);
-			} else if (strmatch(tokens[0], "free") || strmatch(tokens[0], "f")) {
-				__free_page(arg);
-			} else if (strmatch(tokens[0], "read") || strmatch(tokens[0], "r")) {
-				__access_memory(arg, ACCESS_READ);
-			} else if (strmatch(tokens[0], "write") || strmatch(tokens[0], "w")) {
-				__access_memory(arg, ACCESS_WRITE);
-			} else {
-				printf("Unknown command %s\n", tokens[0]);
-			}
-		} else if (nr_tokens == 3) {
-			unsigned int vpn = strtoimax(tokens[1], NULL, 0);
-			unsigned int rw = __make_rwflag(tokens[2]);
-
-			if (strmatch(tokens[0], "alloc") || strmatch(tokens[0], "a")) {
-				if (!__alloc_page(vpn, rw)) break;
-			} else if (strmatch(tokens[0], "access")) {
-				__access_memory(vpn, rw);
-			} else {
-				printf("Unknown command %s\n", tokens[0]);
-			}
-		} else {
-			assert(!"Unknown command in trace");
+	op->arg = mode;
+	op->rw = node ? strtoimax(node, NULL, 0) : -1;
+	return VM_OP_MEMPOLICY;
+}
+
+/**
+ * vm_decode(@command, @op, @con)
+ *
+ * DESCRIPTION
+ *   Decode the text @command into @op. @command is modified while parsed.
+ *   A command may be prefixed with @<cpu> to run it on the CPU.
+ *   Unknown commands are reported to @con, and decoded into VM_OP_UNKNOWN.
+ *   Empty lines and comments are decoded into VM_OP_NONE.
+ */
+void vm_decode(char *command, struct vm_op *op, FILE *con)
+{
+	char *tokens[MAX_NR_TOKENS] = { NULL };
+	int nr_tokens = 0;
+
+	nr_tokens = parse_command(command, tokens);
+
+	/* Make the command lowercase, except the file names */
+	for (int i = 0; i < nr_tokens; i++) {
+		if (i && (strcasecmp(tokens[i - 1], "checkpoint") == 0 ||
+				strcasecmp(tokens[i - 1], "restore") == 0)) continue;
+
+		for (char *c = tokens[i]; *c; c++) *c = tolower(*c);
+	}
+
+	op->cpu = -1;
+	op->type = VM_OP_UNKNOWN;
+	op->arg = 0;
+	op->rw = 0;
+	op->offset = 0;
+	op->path = NULL;
+
+	/* Command tagged with the CPU to run on, e.g., @1 read 3 */
+	if (nr_tokens && tokens[0][0] == '@') {
+		op->cpu = strtoimax(tokens[0] + 1, NULL, 0);
+		memmove(tokens, tokens + 1, sizeof(*tokens) * --nr_tokens);
+	}
+
+	if (nr_tokens == 0) {
+		op->type = op->cpu >= 0 ? VM_OP_CPU : VM_OP_NONE;
+		op->arg = op->cpu;
+	} else if (nr_tokens == 1) {
+		if (strmatch(tokens[0], "exit")) {
+			op->type = VM_OP_EXIT;
+		} else if (strmatch(tokens[0], "show")) {
+			op->type = VM_OP_SHOW;
+		} else if (strmatch(tokens[0], "frames")) {
+			op->type = VM_OP_FRAMES;
+		} else if (strmatch(tokens[0], "tlb")) {
+			op->type = VM_OP_TLB;
+		} else if (strmatch(tokens[0], "stats")) {
+			op->type = VM_OP_STATS;
+		} else if (strmatch(tokens[0], "compact")) {
+			op->type = VM_OP_COMPACT;
+		} else if (strmatch(tokens[0], "khugepaged")) {
+			op->type = VM_OP_KHUGEPAGED;
+		} else if (strmatch(tokens[0], "tier")) {
+			op->type = VM_OP_TIER;
+		} else if (strmatch(tokens[0], "mrc")) {
+			op->type = VM_OP_MRC;
+		} else if (strmatch(tokens[0], "help") || strmatch(tokens[0], "?")) {
+			op->type = VM_OP_HELP;
+		}
+	} else if (nr_tokens == 2) {
+		op->arg = strtoimax(tokens[1], NULL, 0);
+
+		if (strmatch(tokens[0], "switch") || strmatch(tokens[0], "s")) {
+			op->type = VM_OP_SWITCH;
+		} else if (strmatch(tokens[0], "cpu")) {
+			op->type = VM_OP_CPU;
+		} else if (strmatch(tokens[0], "free") || strmatch(tokens[0], "f")) {
+			op->type = VM_OP_FREE;
+		} else if (strmatch(tokens[0], "alloc-order")) {
+			op->type = VM_OP_ALLOC_ORDER;
+		} else if (strmatch(tokens[0], "free-order")) {
+			op->type = VM_OP_FREE_ORDER;
+		} else if (strmatch(tokens[0], "exit-process")) {
+			op->type = VM_OP_EXIT_PROCESS;
+		} else if (strmatch(tokens[0], "checkpoint")) {
+			op->type = VM_OP_CHECKPOINT;
+			op->path = strdup(tokens[1]);
+		} else if (strmatch(tokens[0], "restore")) {
+			op->type = VM_OP_RESTORE;
+			op->path = strdup(tokens[1]);
+		} else if (strmatch(tokens[0], "mempolicy")) {
+			op->type = __decode_mempolicy(op, tokens[1], NULL);
+		} else if (strmatch(tokens[0], "read") || strmatch(tokens[0], "r")) {
+			op->type = VM_OP_ACCESS;
+			op->rw = ACCESS_READ;
+		} else if (strmatch(tokens[0], "write") || strmatch(tokens[0], "w")) {
+			op->type = VM_OP_ACCESS;
+			op->rw = ACCESS_WRITE;
+		}
+	} else if (nr_tokens == 3) {
+		op->arg = strtoimax(tokens[1], NULL, 0);
+		op->rw = __make_rwflag(tokens[2]);
+
+		if (strmatch(tokens[0], "alloc") || strmatch(tokens[0], "a")) {
+			op->type = VM_OP_ALLOC;
+		} else if (strmatch(tokens[0], "alloc-huge")) {
+			op->type = VM_OP_ALLOC_HUGE;
+		} else if (strmatch(tokens[0], "access")) {
+			op->type = VM_OP_ACCESS;
+		} else if (strmatch(tokens[0], "migrate")) {
+			op->type = VM_OP_MIGRATE;
+			op->rw = strtoimax(tokens[2], NULL, 0);
+		} else if (strmatch(tokens[0], "mempolicy")) {
+			op->type = __decode_mempolicy(op, tokens[1], tokens[2]);
+		} else if (strmatch(tokens[0], "read") || strmatch(tokens[0], "r")) {
+			op->type = VM_OP_ACCESS;
+			op->rw = ACCESS_READ;
+			op->offset = strtoimax(tokens[2], NULL, 0) & (PAGE_SIZE - 1);
+		} else if (strmatch(tokens[0], "write") || strmatch(tokens[0], "w")) {
+			op->type = VM_OP_ACCESS;
+			op->rw = ACCESS_WRITE;
+			op->offset = strtoimax(tokens[2], NULL, 0) & (PAGE_SIZE - 1);
 		}
+	} else if (nr_tokens == 4) {
+		op->arg = strtoimax(tokens[1], NULL, 0);
+		op->rw = __make_rwflag(tokens[2]);
+		op->offset = strtoimax(tokens[3], NULL, 0) & (PAGE_SIZE - 1);
+
+		if (strmatch(tokens[0], "access")) {
+			op->type = VM_OP_ACCESS;
+		} else if (strmatch(tokens[0], "batch")) {
+			op->type = VM_OP_BATCH;
+			op->rw = op->rw & ACCESS_WRITE ? ACCESS_WRITE : ACCESS_READ;
+			op->offset = strtoimax(tokens[3], NULL, 0);
+		}
+	} else {
+		assert(!"Unknown command in trace");
+	}
 
-		if (verbose) printf("%d >> ", current->pid);
+	if (op->type == VM_OP_UNKNOWN) {
+		fprintf(con, "Unknown command %s\n", tokens[0]);
 	}
 }
 
-static void __print_usage(const char * name)
+/**
+ * vm_tick(@vm)
+ *
+ * DESCRIPTION
+ *   Count a command executed on @vm, and run khugepaged and the tier scan if
+ *   they are due.
+ */
+void vm_tick(struct vm_machine *vm)
 {
-	printf("Usage: %s {-q} {-f [workload file]}\n", name);
-	printf("\n");
-	printf("  -t: Show TLB result\n");
-	printf("  -q: Run quietly\n\n");
+	vm->nr_commands++;
+
+	if (vm->config.khugepaged_interval &&
+			vm->nr_commands % vm->config.khugepaged_interval == 0) {
+		khugepaged_scan(vm);
+	}
+	if (vm->config.nr_fast_frames && vm->config.tier_interval &&
+			vm->nr_commands % vm->config.tier_interval == 0) {
+		tier_scan(vm);
+	}
 }
 
-int main(int argc, char * argv[])
+/**
+ * vm_execute(@vm, @op)
+ *
+ * DESCRIPTION
+ *   Execute the decoded command @op on @vm, and tick @vm with it.
+ *   A command tagged with a CPU makes the CPU execute the commands from it.
+ *
+ * RETURN
+ *   @false if the simulation should stop; on exit, or when the memory is
+ *   exhausted. @true otherwise
+ */
+bool vm_execute(struct vm_machine *vm, const struct vm_op *op)
 {
-	int opt;
-	FILE *input = stdin;
+	unsigned int pfn;
 
-	while ((opt = getopt(argc, argv, "qht")) != -1) {
-		switch (opt) {
-		case 'q':
-			verbose = false;
-			break;
-		case 't':
-			print_tlb_result = true;
-			break;
-		case 'h':
-		default:
-			__print_usage(argv[0]);
-			return EXIT_FAILURE;
+	if (op->cpu >= 0 || op->type == VM_OP_CPU) {
+		unsigned int cpu = op->type == VM_OP_CPU ? op->arg : op->cpu;
+
+		if (cpu >= vm->config.nr_cpus) {
+			fprintf(vm->con, "No cpu %u\n", cpu);
+			return true;
 		}
+		select_cpu(vm, cpu);
 	}
 
-	if (verbose && !argv[optind]) {
-		printf("*******************************************************\n");
-		printf("            V M     S I M U L A T O R\n");
-		printf("\n");
-		printf("                                   >> 2024 Spring <<\n");
-		printf("\n");
-		printf("********************************************************\n");
+	switch (op->type) {
+	case VM_OP_NONE:
+		return true;
+	case VM_OP_UNKNOWN:
+		break;
+	case VM_OP_EXIT:
+		return false;
+	case VM_OP_SHOW:
+		__show_pagetable(vm);
+		break;
+	case VM_OP_FRAMES:
+		__show_pageframes(vm);
+		break;
+	case VM_OP_TLB:
+		__show_tlb(vm);
+		break;
+	case VM_OP_STATS:
+		__show_stats(vm);
+		break;
+	case VM_OP_COMPACT:
+		__compact_memory(vm);
+		break;
+	case VM_OP_KHUGEPAGED:
+		fprintf(vm->out, "khugepaged: %u collapsed\n", khugepaged_scan(vm));
+		break;
+	case VM_OP_TIER:
+		if (vm->config.nr_fast_frames) {
+			fprintf(vm->out, "tier: %u migrated\n", tier_scan(vm));
+		}
+		break;
+	case VM_OP_MRC:
+		if (vm->config.mrc_rate) mrc_show(&vm->mrc, vm->out);
+		break;
+	case VM_OP_HELP:
+		__print_help(vm->con);
+		break;
+	case VM_OP_SWITCH:
+		vm_switch(vm, op->arg);
+		break;
+	case VM_OP_EXIT_PROCESS:
+		__exit_process(vm, op->arg);
+		break;
+	case VM_OP_CPU:
+		break;
+	case VM_OP_MEMPOLICY:
+		__set_mempolicy(vm, op->arg, op->rw);
+		break;
+	case VM_OP_MIGRATE:
+		numa_migrate(vm, op->arg, op->rw);
+		break;
+	case VM_OP_FREE:
+		vm_free_page(vm, op->arg);
+		break;
+	case VM_OP_ALLOC_ORDER:
+		__alloc_order(vm, op->arg);
+		break;
+	case VM_OP_FREE_ORDER:
+		__free_order(vm, op->arg);
+		break;
+	case VM_OP_ACCESS:
+		vm_access(vm, op->arg, op->rw, op->offset, &pfn);
+		break;
+	case VM_OP_BATCH:
+		__access_range(vm, op->arg, op->rw, op->offset);
+		break;
+	case VM_OP_ALLOC:
+		if (vm_alloc_page(vm, op->arg, op->rw, &pfn)) return false;
+		break;
+	case VM_OP_ALLOC_HUGE:
+		if (vm_alloc_huge_page(vm, op->arg, op->rw, &pfn)) return false;
+		break;
+	case VM_OP_CHECKPOINT:
+		checkpoint_save(vm, op->path);
+		break;
+	case VM_OP_RESTORE:
+		/* Nothing to run on if the machine is lost on the way */
+		if (!checkpoint_restore(vm, op->path) && !vm->cpus) return false;
+		break;
 	}
 
-	if (argv[optind]) {
-		if (verbose) printf("Use file \"%s\" for input.\n", argv[optind]);
+	vm_tick(vm);
+	return true;
+}
 
-		input = fopen(argv[optind], "r");
-		if (!input) {
-			fprintf(stderr, "No input file %s\n", argv[optind]);
-			return EXIT_FAILURE;
-		}
-		verbose = false;
-	} else {
-		if (verbose) printf("Use stdin for input.\n");
+/**
+ * vm_simulate(@vm, @input)
+ *
+ * DESCRIPTION
+ *   Run the commands from @input on @vm until the end of @input or exit.
+ *   The results go to @vm->out, and the console messages to @vm->con.
+ *   The miss-ratio curve is reported at the end if the analysis is enabled.
+ *
+ * RETURN
+ *   The number of commands executed
+ */
+unsigned long vm_simulate(struct vm_machine *vm, FILE *input)
+{
+	char command[MAX_COMMAND_LEN] = { 0 };
+
+	while (fgets(command, sizeof(command), input)) {
+		struct vm_op op;
+		bool running;
+
+		vm_decode(command, &op, vm->con);
+
+		if (op.type == VM_OP_NONE) continue;
+		running = vm_execute(vm, &op);
+		free(op.path);
+		if (!running) break;
+
+		if (vm->config.interactive) fprintf(vm->con, "%d >> ", vm->current->pid);
+	}
+
+	if (vm->config.mrc_rate) mrc_show(&vm->mrc, vm->out);
+
+	return vm->nr_commands;
+}
+
+static bool __parse_nodes(char *arg, struct vm_config *config)
+{
+	char *policy = strchr(arg, ',');
+	char *node = NULL;
+
+	if (policy) {
+		*policy++ = '\0';
+		node = strchr(policy, ',');
+		if (node) *node++ = '\0';
 	}
 
-	if (verbose) {
-		printf("Type 'help' or '?' for help.\n\n");
-		printf("%d >> ", current->pid);
+	config->nr_nodes = strtoimax(arg, NULL, 0);
+	if (!config->nr_nodes || config->nr_nodes > MAX_NODES) return false;
+
+	if (policy && !numa_parse_policy(policy, &config->mempolicy.mode)) return false;
+
+	if (node) {
+		config->mempolicy.node = strtoimax(node, NULL, 0);
+		if (config->mempolicy.node < 0 ||
+				config->mempolicy.node >= (int)config->nr_nodes) return false;
 	}
+	return true;
+}
 
-	__do_simulation(input);
+static bool __parse_latencies(char *arg, struct vm_config *config)
+{
+	char *saveptr;
+
+	for (char *tok = strtok_r(arg, ",", &saveptr); tok; tok = strtok_r(NULL, ",", &saveptr)) {
+		char *value = strchr(tok, '=');
+		int i;
+
+		if (!value) return false;
+		*value++ = '\0';
+
+		for (i = 0; i < NR_COSTS; i++) {
+			if (strmatch(tok, vm_cost_names[i])) break;
+		}
+		if (i == NR_COSTS) return false;
+
+		config->latencies[i] = strtoimax(value, NULL, 0);
+	}
+	return true;
+}
 
-	if (input != stdin) fclose(input);
+/**
+ * vm_config_option(@config, @opt, @arg)
+ *
+ * DESCRIPTION
+ *   Apply the command line option @opt of the machine, one of
+ *   VM_CONFIG_OPTIONS, to @config with its argument @arg. @arg may be
+ *   modified on the way.
+ *
+ * RETURN
+ *   0 on success, -LIBVM_EINVAL if @opt is not an option of the machine or
+ *   @arg is invalid for it
+ */
+int vm_config_option(struct vm_config *config, int opt, char *arg)
+{
+	switch (opt) {
+	case 't':
+		config->use_tlb = true;
+		break;
+	case 'z':
+		config->use_zero_page = true;
+		break;
+	case 'c':
+		config->compaction_threshold = strtoimax(arg, NULL, 0);
+		break;
+	case 'k':
+		config->khugepaged_interval = strtoimax(arg, NULL, 0);
+		break;
+	case 'm':
+		config->mrc_rate = strtod(arg, NULL);
+		if (config->mrc_rate <= 0.0 || config->mrc_rate > 1.0) return -LIBVM_EINVAL;
+		break;
+	case 'p':
+		config->nr_cpus = strtoimax(arg, NULL, 0);
+		if (!config->nr_cpus || config->nr_cpus > MAX_CPUS) return -LIBVM_EINVAL;
+		break;
+	case 'w':
+		if (sscanf(arg, "%u,%u,%u", &config->pcp_high, &config->pcp_low,
+					&config->pcp_batch) < 1 || !config->pcp_high ||
+				config->pcp_low >= config->pcp_high ||
+				config->pcp_batch > config->pcp_high) return -LIBVM_EINVAL;
+		break;
+	case 'n':
+		if (!__parse_nodes(arg, config)) return -LIBVM_EINVAL;
+		break;
+	case 'T':
+		if (sscanf(arg, "%u,%u,%u,%u", &config->nr_fast_frames,
+					&config->tier_interval, &config->tier_fast_cycles,
+					&config->tier_slow_cycles) < 1 || !config->nr_fast_frames) {
+			return -LIBVM_EINVAL;
+		}
+		break;
+	case 'L':
+		if (!__parse_latencies(arg, config)) return -LIBVM_EINVAL;
+		break;
+	case 'C':
+		if (!cache_parse(arg, config->caches, &config->nr_cache_levels)) return -LIBVM_EINVAL;
+		break;
+	case 'd':
+		config->nr_pwc_entries = strtoimax(arg, NULL, 0);
+		break;
+	case 'I':
+		config->use_ipt = true;
+		break;
+	case 'G':
+		config->use_nested = true;
+		break;
+	case 'H':
+		config->use_nested_huge = true;
+		break;
+	default:
+		return -LIBVM_EINVAL;
+	}
+	return 0;
+}
 
-	return EXIT_SUCCESS;
+/**
+ * vm_config_check(@config)
+ *
+ * RETURN
+ *   NULL if the options in @config can be combined on a machine, or the
+ *   reason why not
+ */
+const char *vm_config_check(const struct vm_config *config)
+{
+	if (!config->nr_cpus || config->nr_cpus > MAX_CPUS) {
+		return "The number of CPUs is out of range";
+	}
+	if (!config->nr_nodes || config->nr_nodes > MAX_NODES ||
+			config->mempolicy.node >= (int)config->nr_nodes) {
+		return "The memory policy refers to a node not on the machine";
+	}
+	if (!config->nr_pageframes) return "The machine should have page frames";
+	if (!config->nr_tlb_entries || config->tlb_ways > config->nr_tlb_entries ||
+			(config->tlb_ways && config->nr_tlb_entries % config->tlb_ways)) {
+		return "The TLB entries should be split evenly into the ways";
+	}
+	if (config->pcp_high && (config->pcp_low >= config->pcp_high ||
+				config->pcp_batch > config->pcp_high)) {
+		return "The frame cache watermarks are out of order";
+	}
+	if (config->mrc_rate < 0.0 || config->mrc_rate > 1.0) {
+		return "The sampling rate is out of range";
+	}
+	if (config->nr_nodes > 1 && config->nr_fast_frames) {
+		return "The tiered memory is modeled on a single node";
+	}
+	if (config->use_nested_huge && !config->use_nested) {
+		return "The host huge pages back a guest on -G";
+	}
+	if (config->use_nested && (config->use_ipt ||
+				config->nr_nodes > 1 || config->nr_fast_frames)) {
+		return "The guest is modeled on serial CPUs, without the inverted "
+				"page table, the nodes, and the tiers";
+	}
+	return NULL;
 }
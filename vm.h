@@ -15,11 +15,36 @@
 #ifndef __VM_H__
 #define __VM_H__
 
+#include <stdio.h>
+#include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
 
-/* The number of physical page frames of the system */
+#include "list_head.h"
+#include "buddy.h"
+#include "pcp.h"
+#include "mrc.h"
+#include "numa.h"
+#include "cache.h"
+#include "ipt.h"
+#include "nested.h"
+#include "tlb.h"
+#include "libvm.h"
+
+/* Default number of physical page frames of the system */
 #define NR_PAGEFRAMES	128
 
+/**
+ * Page frame reserved for the shared zero page. It is pinned on the system
+ * start-up when the zero page is enabled, so its mapcount never drops to 0.
+ */
+#define ZERO_PFN		0
+
+/* Size of a page, for the physical addresses in the cache model */
+#define PAGE_SHIFT		12
+#define PAGE_SIZE		(1 << PAGE_SHIFT)
+
 /* The number of PTEs in a page */
 #define PTES_PER_PAGE_SHIFT	4
 #define NR_PTES_PER_PAGE    (1 << PTES_PER_PAGE_SHIFT)
@@ -27,27 +52,129 @@
 #define PDES_PER_PAGE_SHIFT 2
 #define NR_PDES_PER_PAGE	(1 << PDES_PER_PAGE_SHIFT)
 
+/**
+ * A huge page is mapped by a single page directory slot, covering the pages
+ * that a pte_directory would map. Its frames are contiguous and aligned.
+ */
+#define HUGE_PAGE_ORDER		PTES_PER_PAGE_SHIFT
+#define NR_PAGES_PER_HUGE	(1 << HUGE_PAGE_ORDER)
+
 /* Protection bits for read and write */
 #define ACCESS_NONE  0x00
 #define ACCESS_READ  0x01
 #define ACCESS_WRITE 0x02
 
 /**
- * 2-level page table abstraction
+ * 2-level page table abstraction. A PTE is packed into a 64-bit word, and
+ * accessed through the pte_*() helpers below.
  */
 struct pte {
-	bool valid;
-	unsigned int rw;
-	unsigned int pfn;
-	unsigned int private;	/* May use to backup something ;-) */
+	uint64_t val;
 };
 
+/**
+ * Layout of the PTE word. A valid PTE holds the pfn, and an invalid one may
+ * hold the swap slot of the page instead. A copy-on-write page is mapped
+ * without ACCESS_WRITE in @rw, and gets it back on the first write fault.
+ * The accessed and dirty bits are set by the MMU on the page table walks.
+ */
+#define PTE_PFN_MASK		0xffffffffULL
+#define PTE_VALID			(1ULL << 32)
+#define PTE_RW_SHIFT		33
+#define PTE_RW_MASK			(3ULL << PTE_RW_SHIFT)
+#define PTE_COW				(1ULL << 35)
+#define PTE_ACCESSED		(1ULL << 36)
+#define PTE_DIRTY			(1ULL << 37)
+#define PTE_SWAP_SHIFT		40
+
+/* Size of a page table entry in the memory, for the cache model */
+#define PTE_SIZE	sizeof(struct pte)
+
+static inline bool pte_valid(const struct pte *pte)
+{
+	return pte->val & PTE_VALID;
+}
+
+static inline unsigned int pte_pfn(const struct pte *pte)
+{
+	return pte->val & PTE_PFN_MASK;
+}
+
+static inline unsigned int pte_rw(const struct pte *pte)
+{
+	return (pte->val & PTE_RW_MASK) >> PTE_RW_SHIFT;
+}
+
+static inline bool pte_cow(const struct pte *pte)
+{
+	return pte->val & PTE_COW;
+}
+
+static inline bool pte_accessed(const struct pte *pte)
+{
+	return pte->val & PTE_ACCESSED;
+}
+
+static inline bool pte_dirty(const struct pte *pte)
+{
+	return pte->val & PTE_DIRTY;
+}
+
+static inline unsigned int pte_swap_slot(const struct pte *pte)
+{
+	return pte->val >> PTE_SWAP_SHIFT;
+}
+
+/* Map @pfn for @rw, clearing the other bits */
+static inline void pte_set(struct pte *pte, unsigned int pfn, unsigned int rw)
+{
+	pte->val = PTE_VALID | (uint64_t)rw << PTE_RW_SHIFT | pfn;
+}
+
+static inline void pte_clear(struct pte *pte)
+{
+	pte->val = 0;
+}
+
+static inline void pte_set_pfn(struct pte *pte, unsigned int pfn)
+{
+	pte->val = (pte->val & ~PTE_PFN_MASK) | pfn;
+}
+
+static inline void pte_set_rw(struct pte *pte, unsigned int rw)
+{
+	pte->val = (pte->val & ~PTE_RW_MASK) | (uint64_t)rw << PTE_RW_SHIFT;
+}
+
+static inline void pte_set_flag(struct pte *pte, uint64_t flag, bool set)
+{
+	pte->val = set ? pte->val | flag : pte->val & ~flag;
+}
+
+/* Keep the page out in the swap @slot. The PTE is invalid then */
+static inline void pte_set_swap(struct pte *pte, unsigned int slot)
+{
+	pte->val = (uint64_t)slot << PTE_SWAP_SHIFT;
+}
+
 struct pte_directory {
 	struct pte ptes[NR_PTES_PER_PAGE];
 };
 
 struct pagetable {
 	struct pte_directory *pdes[NR_PDES_PER_PAGE];
+
+	/**
+	 * Directory-level (huge) mappings. When huge[i] is valid, it maps
+	 * NR_PAGES_PER_HUGE pages from huge[i].pfn, and pdes[i] must be NULL.
+	 */
+	struct pte huge[NR_PDES_PER_PAGE];
+
+	/**
+	 * Serialize the updates on each page directory slot; @pdes[i], @huge[i],
+	 * and the PTEs under them, while the CPUs are executing concurrently.
+	 */
+	pthread_mutex_t locks[NR_PDES_PER_PAGE];
 };
 
 
@@ -59,16 +186,520 @@ struct process {
 
 	struct pagetable pagetable;
 
+	/**
+	 * CPUs running this process, and thus possibly caching its translations.
+	 * Threads of a process may run on multiple CPUs at the same time.
+	 */
+	unsigned long cpumask;
+
+	/* Placement of the page frames. Inherited by the children */
+	struct mempolicy mempolicy;
+
+	/* Simulated cycles spent by and for this process, and its accesses */
+	unsigned long cycles;
+	unsigned long nr_accesses;
+
 	struct list_head list;  /* List head to chain processes on the system */
 };
 
 struct tlb_entry {
-	bool valid;
-	int rw;
-	unsigned int vpn;
+	unsigned short vpn;
+	unsigned short touched;	/* Pages accessed through the huge entry, a bit each */
 	unsigned int pfn;
-	unsigned int private;
+	unsigned char rw;
+	bool valid;
+	bool huge;		/* Covers NR_PAGES_PER_HUGE pages from @vpn */
+	uint32_t stamp;		/* Low bits of @tlb_clock at the last use (LRU) or insertion (FIFO) */
 };
 
+/**
+ * Entry of the page walk cache, caching a page directory pointer to skip the
+ * upper level of the walk
+ */
+struct pwc_entry {
+	bool valid;
+	unsigned int pid;		/* Address space the entry belongs to */
+	unsigned int pd_index;	/* Upper bits of the VPN */
+	struct pte_directory *pd;
+	unsigned long stamp;	/* Time of the last use */
+};
+
+/* Default number of TLB entries */
 #define NR_TLB_ENTRIES	(1 << (PTES_PER_PAGE_SHIFT * 2))
+
+/* Maximum number of CPUs, limited by the bits in process->cpumask */
+#define MAX_CPUS	(sizeof(unsigned long) * 8)
+
+/**
+ * Approximate cycles for the initiator of a TLB shootdown to interrupt a
+ * remote CPU and wait for its acknowledgement
+ */
+#define TLB_SHOOTDOWN_IPI_CYCLES	2000
+
+/* Upper bound of the number of frames moved to or from a frame cache at once */
+#define PCP_MAX_BATCH	8
+
+/**
+ * Approximate cycles to access a frame in the fast (local DRAM) and the slow
+ * (CXL-attached) memory tiers by default
+ */
+#define TIER_FAST_CYCLES	250
+#define TIER_SLOW_CYCLES	600
+
+/**
+ * A page in the fast tier is cold when it has not been referenced for this
+ * number of scans. Cold pages are demoted to keep 1/TIER_FREE_RATIO of the
+ * fast tier free.
+ */
+#define TIER_COLD_SCANS		2
+#define TIER_FREE_RATIO		8
+
+/**
+ * Components of the simulated cost. Each event of a component takes the
+ * cycles configured in @vm_config.latencies.
+ */
+enum vm_cost {
+	COST_TLB,		/* TLB lookup */
+	COST_WALK,		/* Page table entry read by a walk, per level */
+	COST_FAULT,		/* Entering and leaving the page fault handler */
+	COST_COW,		/* Copying a page on write */
+	COST_ZERO,		/* Zero-filling a newly allocated frame */
+	COST_MEMORY,	/* Accessing the data, through the caches if modeled */
+	COST_SWITCH,	/* Context switch */
+	COST_SHOOTDOWN,	/* Shootdown IPI to a remote CPU */
+	NR_COSTS,
+};
+
+/**
+ * Victim selection when the TLB set for a new entry is full
+ */
+enum tlb_policy {
+	TLB_POLICY_LRU,
+	TLB_POLICY_FIFO,
+	TLB_POLICY_RANDOM,
+};
+
+
+/**
+ * Event counters of the system
+ */
+struct vm_stats {
+	unsigned long nr_translations;
+	unsigned long nr_tlb_hits;
+	unsigned long nr_tlb_misses;
+	unsigned long nr_tlb_evictions;
+	unsigned long nr_walks;		/* Page table walks on TLB misses */
+	unsigned long nr_walk_refs;	/* Page table entries read by the walks */
+	unsigned long nr_pwc_hits;	/* Walks skipping the upper level */
+	unsigned long nr_pwc_misses;
+	unsigned long nr_batched;		/* Translations requested in batches */
+	unsigned long nr_batch_walk_saves;	/* Walks shared by the same pages in a batch */
+	unsigned long nr_batch_dir_saves;	/* Directory entries shared in a batch */
+	unsigned long nr_host_walk_refs;	/* Host page table entries read by the walks */
+	unsigned long nr_host_faults;
+	unsigned long nr_host_cows;		/* Host zero frames copied on write */
+	unsigned long nr_faults;
+	unsigned long nr_huge_splits;
+	unsigned long nr_huge_collapses;
+	unsigned long nr_huge_collapse_copies;	/* Collapses copying into new frames */
+	unsigned long nr_huge_tlb_saves;		/* TLB misses saved by huge entries */
+	unsigned long nr_compactions;
+	unsigned long nr_pages_migrated;
+	unsigned long compact_nsecs;
+	unsigned long nr_shootdowns;	/* PTE updates that interrupted other CPUs */
+	unsigned long nr_ipis;
+	unsigned long nr_shootdown_flushes;	/* Remote TLB entries invalidated */
+	unsigned long nr_numa_local;	/* Accesses to the node of the CPU */
+	unsigned long nr_numa_remote;
+	unsigned long nr_numa_migrations;
+	unsigned long nr_tier_fast;		/* Accesses served from the fast tier */
+	unsigned long nr_tier_slow;
+	unsigned long nr_tier_promotions;
+	unsigned long nr_tier_demotions;
+	unsigned long nr_tier_scans;
+	unsigned long nr_accesses;		/* Accesses to the memory by the workload */
+	unsigned long access_cycles;	/* Cycles spent in the accesses */
+	unsigned long cycles[NR_COSTS];
+};
+
+
+/**
+ * Configuration of a simulated machine
+ */
+struct vm_config {
+	/* Translate through the TLB */
+	bool use_tlb;
+
+	/* Map read-only zero page for newly allocated pages and copy on write */
+	bool use_zero_page;
+
+	/**
+	 * Compact the memory automatically when a high-order allocation fails
+	 * and the unusable free space index for the order is at least this
+	 * (in 1/1000). Setting it over 1000 disables the automatic compaction.
+	 */
+	unsigned int compaction_threshold;
+
+	/* Run khugepaged every this number of commands. 0 disables it */
+	unsigned int khugepaged_interval;
+
+	/**
+	 * TLB geometry. @nr_tlb_entries should be a multiple of @tlb_ways.
+	 * @tlb_ways 0 makes the TLB fully associative.
+	 */
+	unsigned int nr_tlb_entries;
+	unsigned int tlb_ways;
+	enum tlb_policy tlb_policy;
+
+	/* The number of physical page frames */
+	unsigned int nr_pageframes;
+
+	/**
+	 * Sampling rate (0.0 - 1.0] of the miss-ratio curve analysis over the
+	 * translations. 0 disables the analysis.
+	 */
+	double mrc_rate;
+
+	/* The number of CPUs, up to MAX_CPUS */
+	unsigned int nr_cpus;
+
+	/**
+	 * Watermarks and batch size of the per-CPU frame caches (see pcp.h),
+	 * used while the CPUs are executing concurrently. 0 for @pcp_batch and
+	 * @pcp_high sizes them by the number of frames per CPU.
+	 */
+	unsigned int pcp_high;
+	unsigned int pcp_low;
+	unsigned int pcp_batch;
+
+	/**
+	 * The number of memory nodes, up to MAX_NODES, and the memory policy of
+	 * the initial process
+	 */
+	unsigned int nr_nodes;
+	struct mempolicy mempolicy;
+
+	/**
+	 * The number of frames in the fast memory tier, from frame 0. The rest
+	 * are in the slow tier. 0 disables the tiering. The tiers are rebalanced
+	 * every @tier_interval commands, and accessed at the cycles below.
+	 */
+	unsigned int nr_fast_frames;
+	unsigned int tier_interval;
+	unsigned int tier_fast_cycles;
+	unsigned int tier_slow_cycles;
+
+	/**
+	 * Cycles taken by each event of the cost components. The memory
+	 * accesses take the tier cycles instead with the tiered memory.
+	 */
+	unsigned int latencies[NR_COSTS];
+
+	/**
+	 * Data cache hierarchy behind the translations, from L1 to LLC.
+	 * 0 levels disables the cache model.
+	 */
+	unsigned int nr_cache_levels;
+	struct cache_config caches[MAX_CACHE_LEVELS];
+
+	/* Entries of the per-CPU page walk caches. 0 disables them */
+	unsigned int nr_pwc_entries;
+
+	/**
+	 * Look up the translations in the hashed inverted page table on the TLB
+	 * misses, walking the radix page tables only when they miss there
+	 */
+	bool use_ipt;
+
+	/**
+	 * Run the processes in a virtualized guest, translating the guest frames
+	 * through the host page table on every walk. The host backs the guest
+	 * frames with huge pages if @use_nested_huge is set.
+	 */
+	bool use_nested;
+	bool use_nested_huge;
+
+	/* Prompt for the commands on the console, and show the invalid PTEs too */
+	bool interactive;
+};
+
+/**
+ * Command line options of the machine, parsed by vm_config_option()
+ */
+#define VM_CONFIG_OPTIONS	"tzc:k:m:p:w:n:T:L:C:d:IGH"
+
+/**
+ * Per-CPU states. The ones of the CPU executing the commands are kept in
+ * struct vm_machine while it is executing.
+ */
+struct vm_cpu {
+	struct process *current;
+	struct pagetable *ptbr;
+	struct tlb_entry *tlb;
+
+	unsigned long nr_ipis;	/* Shootdown IPIs received */
+
+	/* Taken to look up or update @tlb while executing concurrently */
+	pthread_mutex_t tlb_lock;
+
+	/* Free page frames cached for this CPU while executing concurrently */
+	struct pcp pcp;
+
+	/* Page walk cache. Also under @tlb_lock */
+	struct pwc_entry *pwc;
+	unsigned long pwc_clock;
+};
+
+/**
+ * A simulated machine. Bundles all the states of the system so that multiple
+ * machines can be simulated independently in one address space.
+ */
+struct vm_machine {
+	/* Initial process */
+	struct process init;
+
+	/**
+	 * Current process of the executing CPU. Should not be listed in the
+	 * @processes, nor the processes running on the other CPUs.
+	 */
+	struct process *current;
+
+	/**
+	 * Ready queue. Put @current process to the tail of this list on
+	 * switch_process() unless it is still running on other CPUs. Don't
+	 * forget to remove the switched process from the list.
+	 */
+	struct list_head processes;
+
+	/* Page table base register of the executing CPU */
+	struct pagetable *ptbr;
+
+	/**
+	 * TLB of the executing CPU, grouped into sets of @config.tlb_ways
+	 * entries
+	 */
+	struct tlb_entry *tlb;
+	unsigned int nr_tlb_sets;
+
+	/**
+	 * Tags and valid bits of the TLB entries of all the CPUs, in the order of
+	 * the entries from @cpus[0].tlb, for the vectorized search. See tlb.h.
+	 */
+	uint32_t *tlb_tags;
+	uint64_t *tlb_valid;
+	unsigned long tlb_clock;	/* Advances on each TLB lookup and insertion */
+	unsigned int tlb_seed;		/* For the random replacement */
+
+	/* Map count for each page frame */
+	unsigned int *mapcounts;
+
+	/* Tier scans each frame has gone unreferenced, with the tiered memory */
+	unsigned char *tier_ages;
+
+	/* Buddy allocator managing the free page frames */
+	struct buddy zone;
+	pthread_mutex_t zone_lock;
+
+	/* Stack distance analyzer, when @config.mrc_rate is set */
+	struct mrc mrc;
+
+	/* Data caches, when @config.nr_cache_levels is set */
+	struct cache cache;
+
+	/* Hashed inverted page table, when @config.use_ipt is set */
+	struct ipt ipt;
+	pthread_mutex_t ipt_lock;
+
+	/* Host of the guest, when @config.use_nested is set */
+	struct nested nested;
+
+	struct vm_stats stats;
+
+	struct vm_config config;
+
+	/* CPUs of the system, and the one executing the commands */
+	struct vm_cpu *cpus;
+	unsigned int cpu;
+
+	/* Commands executed so far */
+	unsigned long nr_commands;
+
+	/**
+	 * Set on the per-CPU views of @main executing the CPUs concurrently.
+	 * They share the page tables, the TLBs, and the mapcounts of @main, and
+	 * take the locks above to update them. See smp.c.
+	 */
+	bool concurrent;
+	struct vm_machine *main;
+
+	/**
+	 * Streams for the simulation results and for the console messages
+	 * such as prompts. stderr and stdout by default.
+	 */
+	FILE *out;
+	FILE *con;
+
+	/**
+	 * Checkpoint mapped on restore. The restored processes and page
+	 * directories stay in it, thus must not be freed. See checkpoint.c.
+	 */
+	char *snapshot;
+	size_t snapshot_size;
+};
+
+/**
+ * A command of the workload, decoded
+ */
+enum vm_op_type {
+	VM_OP_NONE,		/* Empty line or comment */
+	VM_OP_UNKNOWN,
+	VM_OP_EXIT,
+	VM_OP_SHOW,
+	VM_OP_FRAMES,
+	VM_OP_TLB,
+	VM_OP_STATS,
+	VM_OP_COMPACT,
+	VM_OP_KHUGEPAGED,
+	VM_OP_TIER,
+	VM_OP_MRC,
+	VM_OP_HELP,
+	VM_OP_SWITCH,
+	VM_OP_EXIT_PROCESS,	/* @arg is the pid to switch to */
+	VM_OP_CPU,
+	VM_OP_MEMPOLICY,	/* @arg is the policy, and @rw the node */
+	VM_OP_MIGRATE,		/* @rw is the node to migrate to */
+	VM_OP_FREE,
+	VM_OP_ALLOC_ORDER,
+	VM_OP_FREE_ORDER,
+	VM_OP_ACCESS,
+	VM_OP_ALLOC,
+	VM_OP_ALLOC_HUGE,
+	VM_OP_BATCH,		/* @offset is the number of pages from @arg */
+	VM_OP_CHECKPOINT,	/* @path is the file to save into */
+	VM_OP_RESTORE,		/* @path is the file to restore from */
+};
+
+struct vm_op {
+	int cpu;			/* CPU to execute on, or -1 for the executing one */
+	enum vm_op_type type;
+	unsigned int arg;	/* VPN, pid, pfn, or order */
+	unsigned int rw;	/* Access type, or the node for the NUMA commands */
+	unsigned int offset;	/* Byte offset of the access in the page */
+	char *path;			/* Allocated file name, or NULL */
+};
+
+/**
+ * A translation of a batch, and its result
+ */
+enum vm_xlate_status {
+	VM_XLATE_TLB,		/* Hit in the TLB */
+	VM_XLATE_WALK,		/* Walked the page table */
+	VM_XLATE_FAULT,		/* Translated after handling the page faults */
+	VM_XLATE_FAIL,		/* Unable to access */
+};
+
+struct vm_xlate {
+	unsigned int vpn;
+	unsigned int rw;	/* Either ACCESS_READ or ACCESS_WRITE */
+};
+
+extern const char * const vm_cost_names[NR_COSTS];
+
+void vm_config_init(struct vm_config *config);
+int vm_config_option(struct vm_config *config, int opt, char *arg);
+const char *vm_config_check(const struct vm_config *config);
+int vm_machine_init(struct vm_machine *vm, const struct vm_config *config);
+void vm_machine_exit(struct vm_machine *vm);
+struct process *next_process(struct vm_machine *vm, struct process *p);
+struct process *cpu_current(struct vm_machine *vm, unsigned int cpu);
+void select_cpu(struct vm_machine *vm, unsigned int cpu);
+void flush_tlb_range(struct vm_machine *vm, struct process *p, unsigned int start, unsigned int nr_pages);
+void flush_pwc(struct vm_machine *vm, struct process *p, int pd_index);
+unsigned int get_page_frame(struct vm_machine *vm);
+void put_page_frame(struct vm_machine *vm, unsigned int pfn);
+void drain_page_frames(struct vm_machine *vm);
+void vm_decode(char *command, struct vm_op *op, FILE *con);
+void vm_tick(struct vm_machine *vm);
+bool vm_execute(struct vm_machine *vm, const struct vm_op *op);
+unsigned long vm_simulate(struct vm_machine *vm, FILE *input);
+int vm_alloc_page(struct vm_machine *vm, unsigned int vpn, unsigned int rw, unsigned int *pfn);
+int vm_alloc_huge_page(struct vm_machine *vm, unsigned int vpn, unsigned int rw, unsigned int *pfn);
+int vm_free_page(struct vm_machine *vm, unsigned int vpn);
+int vm_access(struct vm_machine *vm, unsigned int vpn, unsigned int rw, unsigned int offset, unsigned int *pfn);
+unsigned int vm_access_batch(struct vm_machine *vm, const struct vm_xlate *xlates, unsigned int nr, unsigned int *pfns, enum vm_xlate_status *status);
+void vm_switch(struct vm_machine *vm, unsigned int pid);
+struct process *vm_find_process(struct vm_machine *vm, unsigned int pid);
+int vm_exit_process(struct vm_machine *vm, unsigned int next);
+unsigned int vm_translate_batch(struct vm_machine *vm, const struct vm_xlate *xlates, unsigned int nr, unsigned int *pfns, enum vm_xlate_status *status);
+int vm_translate_bench(const struct vm_config *config, unsigned long nr_lookups, FILE *out);
+
+/**
+ * vm_lock(@vm, @lock), vm_unlock(@vm, @lock)
+ *
+ * DESCRIPTION
+ *   Lock and unlock @lock only when @vm is executing concurrently, so that
+ *   the serial simulation does not pay for the locking.
+ */
+static inline void vm_lock(struct vm_machine *vm, pthread_mutex_t *lock)
+{
+	if (vm->concurrent) pthread_mutex_lock(lock);
+}
+
+static inline void vm_unlock(struct vm_machine *vm, pthread_mutex_t *lock)
+{
+	if (vm->concurrent) pthread_mutex_unlock(lock);
+}
+
+/**
+ * vm_free(@vm, @ptr)
+ *
+ * DESCRIPTION
+ *   Free @ptr allocated for a process or a page directory, unless it is in
+ *   the snapshot @vm is restored from.
+ */
+static inline void vm_free(struct vm_machine *vm, void *ptr)
+{
+	if ((uintptr_t)ptr - (uintptr_t)vm->snapshot < vm->snapshot_size) return;
+	free(ptr);
+}
+
+/**
+ * vm_tlb_index(@vm, @t)
+ *
+ * RETURN
+ *   The index of the TLB entry @t in @vm->tlb_tags and @vm->tlb_valid
+ */
+static inline unsigned int vm_tlb_index(struct vm_machine *vm, struct tlb_entry *t)
+{
+	return t - vm->cpus[0].tlb;
+}
+
+/* Invalidate the TLB entry @t, in the vectorized index as well */
+static inline void vm_tlb_invalidate(struct vm_machine *vm, struct tlb_entry *t)
+{
+	t->valid = false;
+	t->huge = false;
+	t->pfn = 0;
+	t->vpn = 0;
+	t->rw = 0;
+	tlb_index_clear(vm->tlb_valid, vm_tlb_index(vm, t));
+}
+
+/**
+ * vm_charge_cycles(@vm, @cost, @cycles), vm_charge(@vm, @cost, @nr)
+ *
+ * DESCRIPTION
+ *   Account @cycles, or @nr events of @cost, to @vm and its @current
+ *   process. The threads of the process may be charging it concurrently.
+ */
+static inline void vm_charge_cycles(struct vm_machine *vm, enum vm_cost cost, unsigned long cycles)
+{
+	vm->stats.cycles[cost] += cycles;
+	__atomic_add_fetch(&vm->current->cycles, cycles, __ATOMIC_RELAXED);
+}
+
+static inline void vm_charge(struct vm_machine *vm, enum vm_cost cost, unsigned int nr)
+{
+	vm_charge_cycles(vm, cost, (unsigned long)vm->config.latencies[cost] * nr);
+}
 #endif